@@ -0,0 +1,65 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/chain/abi_serializer_cache.hpp>
+#include <fc/io/raw.hpp>
+
+namespace eosio { namespace chain {
+
+   std::shared_ptr<const abi_serializer> abi_serializer_cache::get( account_name account, uint64_t abi_sequence,
+                                                                    const char* abi, size_t abi_size,
+                                                                    const fc::microseconds& max_serialization_time ) {
+      if( abi_size <= 4 ) /// packsize of an empty abi, see abi_serializer::is_empty_abi
+         return nullptr;
+
+      {
+         std::lock_guard<std::mutex> g( mtx );
+         auto itr = entries.find( account.value );
+         if( itr != entries.end() && itr->second.abi_sequence == abi_sequence &&
+             itr->second.abi.size() == abi_size && std::equal( abi, abi + abi_size, itr->second.abi.begin() ) ) {
+            itr->second.last_used = ++use_count;
+            ++hits;
+            return itr->second.serializer;
+         }
+         ++misses;
+      }
+
+      // built outside the lock, two threads missing on the same account build it twice and the last one is kept
+      abi_def def;
+      fc::datastream<const char*> ds( abi, abi_size );
+      fc::raw::unpack( ds, def );
+      auto serializer = std::make_shared<const abi_serializer>( def, max_serialization_time );
+
+      std::lock_guard<std::mutex> g( mtx );
+      auto& e = entries[account.value];
+      e.abi_sequence = abi_sequence;
+      e.abi.assign( abi, abi + abi_size );
+      e.serializer = serializer;
+      e.last_used = ++use_count;
+      if( entries.size() > max_entries )
+         evict_least_recently_used();
+      return serializer;
+   }
+
+   void abi_serializer_cache::clear() {
+      std::lock_guard<std::mutex> g( mtx );
+      entries.clear();
+   }
+
+   abi_serializer_cache::stats_type abi_serializer_cache::stats()const {
+      std::lock_guard<std::mutex> g( mtx );
+      return stats_type{ hits, misses, entries.size() };
+   }
+
+   void abi_serializer_cache::evict_least_recently_used() {
+      auto oldest = entries.begin();
+      for( auto itr = entries.begin(); itr != entries.end(); ++itr ) {
+         if( itr->second.last_used < oldest->second.last_used )
+            oldest = itr;
+      }
+      if( oldest != entries.end() )
+         entries.erase( oldest );
+   }
+
+} }  /// eosio::chain
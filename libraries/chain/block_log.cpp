@@ -4,17 +4,416 @@
  */
 #include <eosio/chain/block_log.hpp>
 #include <eosio/chain/exceptions.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
+#include <mutex>
+#include <thread>
 #include <fc/io/raw.hpp>
 
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+
 #define LOG_READ  (std::ios::in | std::ios::binary)
 #define LOG_WRITE (std::ios::out | std::ios::binary | std::ios::app)
 
 namespace eosio { namespace chain {
 
-   const uint32_t block_log::supported_version = 1;
+   namespace bio = boost::iostreams;
+
+   static const uint32_t genesis_log_version = 1; ///< starts at block 1
+   static const uint32_t stride_log_version = 2;  ///< records the number of its first block after the version
+
+   const uint32_t block_log::supported_version = stride_log_version;
 
    namespace detail {
+      struct log_header {
+         uint32_t      version = 0;
+         uint32_t      first_block_num = 1;
+         genesis_state genesis;
+      };
+
+      static log_header read_header( std::istream& in ) {
+         log_header h;
+         in.read( (char*)&h.version, sizeof(h.version) );
+         EOS_ASSERT( h.version > 0, block_log_exception, "Block log was not setup properly with genesis information." );
+         EOS_ASSERT( h.version <= block_log::supported_version, block_log_unsupported_version,
+                    "Unsupported version of block log. Block log version is ${version} while code supports version ${supported}",
+                    ("version", h.version)("supported", block_log::supported_version) );
+         if( h.version >= stride_log_version )
+            in.read( (char*)&h.first_block_num, sizeof(h.first_block_num) );
+         fc::raw::unpack( in, h.genesis );
+         return h;
+      }
+
+      /// the block at `i` of a mapped log file and its index
+      static std::pair<const char*, size_t> block_range( const boost::interprocess::mapped_region& log,
+                                                        const boost::interprocess::mapped_region& index, uint64_t i ) {
+         uint64_t count = index.get_size() / sizeof(uint64_t);
+         if (i >= count)
+            return {nullptr, 0};
+         auto positions = static_cast<const char*>(index.get_address());
+         uint64_t pos, end;
+         memcpy(&pos, positions + sizeof(uint64_t) * i, sizeof(pos));
+         // every block is followed by its own position
+         if (i + 1 < count)
+            memcpy(&end, positions + sizeof(uint64_t) * (i + 1), sizeof(end));
+         else
+            end = log.get_size();
+         end -= sizeof(uint64_t);
+         EOS_ASSERT(pos < end && end <= log.get_size(), reversible_blocks_exception,
+                   "Invalid position of block in block log.", ("index", i)("pos", pos)("end", end));
+         return {static_cast<const char*>(log.get_address()) + pos, end - pos};
+      }
+
+      static uint64_t read_position( const char* log, uint64_t at ) {
+         uint64_t pos;
+         memcpy(&pos, log + at, sizeof(pos));
+         return pos;
+      }
+
+      /**
+       * Writes the index of a log ending at `log.get_size()` by following the position after each block back
+       * to the previous one, without unpacking any block. Returns false, leaving no index behind, if the
+       * positions do not lead back to `first_pos`, e.g. when the tail of the log was not completely written.
+       */
+      static bool write_index_backward( const boost::interprocess::mapped_region& log, uint64_t first_pos,
+                                        const fc::path& index_file ) {
+         auto data = static_cast<const char*>(log.get_address());
+         auto walk = [&]( auto&& visit ) {
+            uint64_t end = log.get_size();
+            while( end >= first_pos + 2 * sizeof(uint64_t) ) {
+               uint64_t pos = read_position(data, end - sizeof(uint64_t));
+               if( pos < first_pos || pos >= end - sizeof(uint64_t) )
+                  return false;
+               visit( pos );
+               if( pos == first_pos )
+                  return true;
+               end = pos;
+            }
+            return false;
+         };
+
+         uint64_t count = 0;
+         if( !walk( [&]( uint64_t ) { ++count; } ) )
+            return false;
+
+         fc::remove_all(index_file);
+         { std::ofstream create(index_file.generic_string().c_str(), std::ios::out | std::ios::binary); }
+         fc::resize_file(index_file, count * sizeof(uint64_t));
+         using namespace boost::interprocess;
+         file_mapping index_mapping(index_file.generic_string().c_str(), read_write);
+         mapped_region index(index_mapping, read_write);
+         auto positions = static_cast<char*>(index.get_address());
+         walk( [&]( uint64_t pos ) {
+            --count;
+            memcpy(positions + sizeof(uint64_t) * count, &pos, sizeof(pos));
+         });
+         index.flush();
+         return true;
+      }
+
+      /**
+       * Appends to `index` the positions of the blocks from `pos` on, found by unpacking one block after the
+       * other. Stops before the first block that cannot be unpacked or is not followed by its position,
+       * setting `error`, and returns where it stopped.
+       */
+      static uint64_t write_index_forward( std::istream& log, uint64_t pos, uint64_t end_pos, std::ostream& index,
+                                           string& error ) {
+         log.seekg(pos);
+         const uint64_t start_pos = pos;
+         const uint64_t report_step = std::max<uint64_t>(1, (end_pos - pos) / 10);
+         uint64_t next_report = pos + report_step;
+         signed_block tmp;
+         while( pos < end_pos ) {
+            if( pos >= next_report ) {
+               ilog( "Unpacked ${p}% of the blocks", ("p", (pos - start_pos) * 100 / (end_pos - start_pos)) );
+               next_report += report_step;
+            }
+            uint64_t block_pos = std::numeric_limits<uint64_t>::max();
+            try {
+               fc::raw::unpack(log, tmp);
+               if( uint64_t(log.tellg()) + sizeof(block_pos) <= end_pos )
+                  log.read((char*)&block_pos, sizeof(block_pos));
+            } catch( const fc::exception& e ) {
+               error = e.to_detail_string();
+               break;
+            } catch( const std::exception& e ) {
+               error = e.what();
+               break;
+            }
+            if( block_pos != pos ) {
+               error = "block " + std::to_string(tmp.block_num()) + " is not followed by its position";
+               break;
+            }
+            index.write((char*)&pos, sizeof(pos));
+            pos = log.tellg();
+         }
+         log.clear();
+         return pos;
+      }
+
+      static unsigned scan_threads() {
+         return std::max(1u, std::thread::hardware_concurrency());
+      }
+
+      /**
+       * Unpacks every block of a mapped log and its index on all cores, checking that each one fills exactly
+       * the space up to its position and has the expected number. Returns how many blocks from the start
+       * are good. Blocks not linking back to the one before are only reported, as repair_log always did.
+       */
+      static uint64_t verify_blocks( const boost::interprocess::mapped_region& log,
+                                     const boost::interprocess::mapped_region& index,
+                                     uint32_t first_block_num, const fc::path& name ) {
+         const uint64_t count = index.get_size() / sizeof(uint64_t);
+         if( count == 0 )
+            return 0;
+         const unsigned threads = scan_threads();
+         const uint64_t chunk_size = std::max<uint64_t>(1024, count / (threads * 8));
+         const uint64_t chunks = (count + chunk_size - 1) / chunk_size;
+
+         struct chunk_result {
+            block_id_type first_previous;
+            block_id_type last_id;
+         };
+         vector<chunk_result>   results(chunks);
+         std::atomic<uint64_t>  next_chunk{0};
+         std::atomic<uint64_t>  first_bad{count};
+         std::atomic<uint64_t>  verified{0};
+
+         auto verify_chunk = [&]( uint64_t c ) {
+            auto& r = results[c];
+            uint64_t end = std::min(count, (c + 1) * chunk_size);
+            signed_block_header h;
+            for( uint64_t i = c * chunk_size; i < end && i < first_bad; ++i ) {
+               bool good = false;
+               try {
+                  auto data = block_range(log, index, i);
+                  fc::datastream<const char*> ds(data.first, data.second);
+                  signed_block b;
+                  fc::raw::unpack(ds, b);
+                  uint64_t pos = data.first - static_cast<const char*>(log.get_address());
+                  good = ds.remaining() == 0 && b.block_num() == first_block_num + i &&
+                         read_position(data.first, data.second) == pos;
+                  h = b;
+               } catch( ... ) {}
+               if( !good ) {
+                  uint64_t bad = first_bad;
+                  while( i < bad && !first_bad.compare_exchange_weak(bad, i) ) {}
+                  return;
+               }
+               auto id = h.id();
+               if( i == c * chunk_size )
+                  r.first_previous = h.previous;
+               else if( h.previous != r.last_id )
+                  elog( "Block ${num} (${id}) does not link back to previous block. Expected previous: ${expected}. Actual previous: ${actual}.",
+                        ("num", h.block_num())("id", id)("expected", r.last_id)("actual", h.previous) );
+               r.last_id = id;
+            }
+            uint64_t n = end - c * chunk_size;
+            uint64_t before = verified.fetch_add(n);
+            if( (before + n) * 10 / count != before * 10 / count )
+               ilog( "Verified ${p}% of ${f}", ("p", (before + n) * 100 / count)("f", name) );
+         };
+
+         vector<std::thread> workers;
+         for( unsigned t = 0; t < threads && t < chunks; ++t ) {
+            workers.emplace_back( [&]() {
+               for( uint64_t c = next_chunk++; c < chunks && c * chunk_size < first_bad; c = next_chunk++ )
+                  verify_chunk( c );
+            });
+         }
+         for( auto& w : workers )
+            w.join();
+
+         uint64_t good = first_bad;
+         for( uint64_t c = 1; c < chunks && c * chunk_size < good; ++c ) {
+            if( results[c].first_previous != results[c - 1].last_id )
+               elog( "Block ${num} does not link back to previous block. Expected previous: ${expected}. Actual previous: ${actual}.",
+                     ("num", first_block_num + c * chunk_size)("expected", results[c - 1].last_id)("actual", results[c].first_previous) );
+         }
+         return good;
+      }
+
+      /// rebuilds the index of a log file, following the positions back if it can and unpacking every block if not
+      static void construct_index( const fc::path& block_file, const fc::path& index_file ) {
+         std::fstream block_stream;
+         block_stream.exceptions(std::fstream::failbit | std::fstream::badbit);
+         block_stream.open(block_file.generic_string().c_str(), LOG_READ);
+         auto header = read_header(block_stream);
+         uint64_t first_pos = block_stream.tellg();
+         uint64_t end_pos = fc::file_size(block_file);
+
+         using namespace boost::interprocess;
+         if( end_pos <= first_pos ) { // no block after the header yet
+            fc::remove_all(index_file);
+            std::ofstream create(index_file.generic_string().c_str(), std::ios::out | std::ios::binary);
+            return;
+         }
+         file_mapping log_mapping(block_file.generic_string().c_str(), read_only);
+         mapped_region log(log_mapping, read_only);
+
+         if( !write_index_backward(log, first_pos, index_file) ) {
+            wlog( "Positions in ${f} do not lead back to its first block, unpacking every block", ("f", block_file) );
+            fc::remove_all(index_file);
+            std::fstream index_stream;
+            index_stream.exceptions(std::fstream::failbit | std::fstream::badbit);
+            index_stream.open(index_file.generic_string().c_str(), LOG_WRITE);
+            string error;
+            auto pos = write_index_forward(block_stream, first_pos, end_pos, index_stream, error);
+            EOS_ASSERT( pos == end_pos, block_log_exception, "Cannot read block at ${pos} of ${f}: ${error}",
+                        ("pos", pos)("f", block_file)("error", error) );
+         }
+
+         file_mapping index_mapping(index_file.generic_string().c_str(), read_only);
+         mapped_region index(index_mapping, read_only);
+         uint64_t count = index.get_size() / sizeof(uint64_t);
+         uint64_t good = verify_blocks(log, index, header.first_block_num, block_file);
+         EOS_ASSERT( good == count, block_log_exception,
+                     "Block ${num} of ${f} is corrupt, recover the block log with --hard-replay-blockchain",
+                     ("num", header.first_block_num + good)("f", block_file) );
+      }
+
+      static vector<char> zlib_compress( const char* data, size_t size ) {
+         vector<char> out;
+         bio::filtering_ostream comp;
+         comp.push(bio::zlib_compressor(bio::zlib::best_compression));
+         comp.push(bio::back_inserter(out));
+         bio::write(comp, data, size);
+         bio::close(comp);
+         return out;
+      }
+
+      static vector<char> zlib_decompress( const char* data, size_t size ) {
+         vector<char> out;
+         bio::filtering_ostream decomp;
+         decomp.push(bio::zlib_decompressor());
+         decomp.push(bio::back_inserter(out));
+         bio::write(decomp, data, size);
+         bio::close(decomp);
+         return out;
+      }
+
+      /**
+       * A closed file of the block log in the retained directory, either as it was written, or compressed into
+       * a .zlog of one zlib stream per block and a .zindex of their offsets followed by the end of the last one.
+       */
+      class block_stride {
+         public:
+            block_stride( uint32_t first, uint32_t last, const fc::path& dir, bool compressed )
+            :first_block_num(first), last_block_num(last), compressed(compressed),
+             log_file(dir / file_name(first, last, compressed ? ".zlog" : ".log")),
+             index_file(dir / file_name(first, last, compressed ? ".zindex" : ".index")) {}
+
+            static string file_name( uint32_t first, uint32_t last, const char* extension ) {
+               return "blocks-" + std::to_string(first) + "-" + std::to_string(last) + extension;
+            }
+
+            uint32_t block_count()const { return last_block_num - first_block_num + 1; }
+
+            std::pair<const char*, size_t> get_serialized_block( uint32_t block_num )const {
+               if (compressed || !map())
+                  return {nullptr, 0};
+               return block_range(log, index, block_num - first_block_num);
+            }
+
+            vector<char> read_serialized_block( uint32_t block_num )const {
+               if (!compressed) {
+                  auto data = get_serialized_block(block_num);
+                  return vector<char>(data.first, data.first + data.second);
+               }
+               uint64_t i = block_num - first_block_num;
+               if (!map() || (i + 1) * sizeof(uint64_t) >= index.get_size())
+                  return {};
+               auto offsets = static_cast<const char*>(index.get_address());
+               uint64_t pos, end;
+               memcpy(&pos, offsets + sizeof(uint64_t) * i, sizeof(pos));
+               memcpy(&end, offsets + sizeof(uint64_t) * (i + 1), sizeof(end));
+               EOS_ASSERT(pos < end && end <= log.get_size(), reversible_blocks_exception,
+                         "Invalid position of block in compressed block log.", ("block_num", block_num)("pos", pos)("end", end));
+               return zlib_decompress(static_cast<const char*>(log.get_address()) + pos, end - pos);
+            }
+
+            /// whether the index has one entry per block, plus the end of the last block if compressed
+            bool index_complete()const {
+               return fc::exists(index_file) &&
+                      fc::file_size(index_file) == sizeof(uint64_t) * (block_count() + (compressed ? 1 : 0));
+            }
+
+            void remove()const {
+               fc::remove_all(log_file);
+               fc::remove_all(index_file);
+            }
+
+            const uint32_t first_block_num;
+            const uint32_t last_block_num;
+            const bool     compressed;
+            const fc::path log_file;
+            const fc::path index_file;
+
+         private:
+            /// maps the files on first use, false once the retention removed them
+            bool map()const {
+               std::lock_guard<std::mutex> g(mutex);
+               if (!mapped) {
+                  try {
+                     using namespace boost::interprocess;
+                     file_mapping log_mapping(log_file.generic_string().c_str(), read_only);
+                     file_mapping index_mapping(index_file.generic_string().c_str(), read_only);
+                     log = mapped_region(log_mapping, read_only);
+                     index = mapped_region(index_mapping, read_only);
+                  } catch (const boost::interprocess::interprocess_exception&) {
+                     return false;
+                  }
+                  mapped = true;
+               }
+               return true;
+            }
+
+            mutable std::mutex                          mutex;
+            mutable bool                                mapped = false;
+            mutable boost::interprocess::mapped_region  log;
+            mutable boost::interprocess::mapped_region  index;
+      };
+
+      /// writes a compressed copy of an uncompressed stride next to it, or returns null once `stop` is set
+      static std::shared_ptr<const block_stride> compress_stride( const block_stride& s, const fc::path& dir,
+                                                                  const std::atomic<bool>& stop ) {
+         auto z = std::make_shared<block_stride>(s.first_block_num, s.last_block_num, dir, true);
+         auto log_tmp = z->log_file.generic_string() + ".tmp";
+         auto index_tmp = z->index_file.generic_string() + ".tmp";
+         fc::remove_all(log_tmp);
+         fc::remove_all(index_tmp);
+         {
+            std::fstream log_stream;
+            std::fstream index_stream;
+            log_stream.exceptions(std::fstream::failbit | std::fstream::badbit);
+            index_stream.exceptions(std::fstream::failbit | std::fstream::badbit);
+            log_stream.open(log_tmp.c_str(), LOG_WRITE);
+            index_stream.open(index_tmp.c_str(), LOG_WRITE);
+
+            uint64_t pos = 0;
+            for (uint32_t n = s.first_block_num; n <= s.last_block_num; ++n) {
+               if (stop)
+                  return nullptr; // the .tmp files are removed on the next start
+               auto data = s.get_serialized_block(n);
+               EOS_ASSERT(data.second, block_log_exception, "Block ${n} is missing from ${f}", ("n", n)("f", s.log_file));
+               auto packed = zlib_compress(data.first, data.second);
+               index_stream.write((char*)&pos, sizeof(pos));
+               log_stream.write(packed.data(), packed.size());
+               pos += packed.size();
+            }
+            index_stream.write((char*)&pos, sizeof(pos));
+         }
+         // the log is what makes the stride visible at startup, so it goes last
+         fc::rename(index_tmp, z->index_file);
+         fc::rename(log_tmp, z->log_file);
+         return z;
+      }
+
       class block_log_impl {
          public:
             signed_block_ptr         head;
@@ -27,6 +426,86 @@ namespace eosio { namespace chain {
             bool                     index_write;
             bool                     genesis_written_to_block_log = false;
 
+            block_log_retention      retention;
+            fc::path                 retained_dir;
+            genesis_state            genesis;             ///< repeated in the header of every file
+            uint32_t                 first_block_num = 1; ///< of blocks.log
+            uint64_t                 first_block_pos = 0; ///< end of the header of blocks.log
+            std::thread              archiver;            ///< applies the retention to the closed files
+            std::mutex               archiver_mutex;
+            std::condition_variable  archiver_cv;
+            bool                     retention_pending = false; ///< strides were added since the last pass
+            bool                     retention_running = false;
+            std::atomic<bool>        archiver_stop{false};
+
+            std::mutex                               reader_mutex;
+            std::shared_ptr<const block_log_reader>  reader;          ///< null until asked for after the log changed
+            uint32_t                                 reader_first_num = 1; ///< what the next reader covers
+            uint32_t                                 reader_head_num = 0;
+            uint64_t                                 reader_log_size = 0;
+            std::shared_ptr<const stride_list>       strides = std::make_shared<stride_list>(); ///< replaced, never modified
+
+            /// called once blocks up to `head_num`, ending at `log_size`, are flushed
+            void log_advanced( uint32_t first_num, uint32_t head_num, uint64_t log_size ) {
+               std::lock_guard<std::mutex> g( reader_mutex );
+               reader_first_num = first_num;
+               reader_head_num = head_num;
+               reader_log_size = log_size;
+               reader.reset();
+            }
+
+            std::shared_ptr<const stride_list> get_strides() {
+               std::lock_guard<std::mutex> g( reader_mutex );
+               return strides;
+            }
+
+            /// swaps `old` for `with`, or drops it if `with` is null
+            void replace_stride( const std::shared_ptr<const block_stride>& old, const std::shared_ptr<const block_stride>& with ) {
+               std::lock_guard<std::mutex> g( reader_mutex );
+               auto list = std::make_shared<stride_list>();
+               for( const auto& s : *strides ) {
+                  if( s != old )
+                     list->push_back( s );
+                  else if( with )
+                     list->push_back( with );
+               }
+               strides = list;
+               reader.reset();
+            }
+
+            void load_strides();
+            void recover_rotation();
+            void rotate();
+            void run_archiver();
+            void apply_retention();
+
+            /// hands the retention to the archiver thread without waiting for it
+            void start_retention() {
+               {
+                  std::lock_guard<std::mutex> g( archiver_mutex );
+                  retention_pending = true;
+               }
+               archiver_cv.notify_all();
+               if( !archiver.joinable() )
+                  archiver = std::thread( [this]() { run_archiver(); } );
+            }
+
+            void wait_for_retention() {
+               std::unique_lock<std::mutex> g( archiver_mutex );
+               archiver_cv.wait( g, [this]() { return !(retention_pending || retention_running) || archiver_stop; } );
+            }
+
+            /// abandons a compression in progress, which is redone on the next start
+            void stop_archiver() {
+               {
+                  std::lock_guard<std::mutex> g( archiver_mutex );
+                  archiver_stop = true;
+               }
+               archiver_cv.notify_all();
+               if( archiver.joinable() )
+                  archiver.join();
+            }
+
             inline void check_block_read() {
                if (block_write) {
                   block_stream.close();
@@ -62,12 +541,274 @@ namespace eosio { namespace chain {
                }
             }
       };
+
+      void block_log_impl::load_strides() {
+         std::map<uint32_t, std::shared_ptr<const block_stride>> found;
+         if( fc::is_directory( retained_dir ) ) {
+            for( fc::directory_iterator itr( retained_dir ), end; itr != end; ++itr ) {
+               auto name = (*itr).filename().generic_string();
+               unsigned first = 0, last = 0;
+               char extension[8] = {};
+               if( sscanf( name.c_str(), "blocks-%u-%u.%7s", &first, &last, extension ) != 3 || first == 0 || last < first )
+                  continue;
+               string ext = extension;
+               if( ext == "log.tmp" || ext == "zlog.tmp" || ext == "zindex.tmp" ) {
+                  fc::remove_all( *itr ); // compression that did not finish
+                  continue;
+               }
+               if( ext != "log" && ext != "zlog" )
+                  continue;
+
+               auto s = std::make_shared<block_stride>( first, last, retained_dir, ext == "zlog" );
+               if( !s->index_complete() ) {
+                  if( s->compressed ) {
+                     wlog( "Ignoring ${f}, its index is missing or incomplete", ("f", s->log_file) );
+                     continue;
+                  }
+                  ilog( "Reconstructing index of ${f}", ("f", s->log_file) );
+                  construct_index( s->log_file, s->index_file );
+               }
+               auto& slot = found[first];
+               if( !slot ) {
+                  slot = s;
+               } else if( s->compressed != slot->compressed ) { // compressed, but the original was not removed yet
+                  (s->compressed ? slot : s)->remove();
+                  if( s->compressed )
+                     slot = s;
+               }
+            }
+         }
+
+         auto list = std::make_shared<stride_list>();
+         for( const auto& s : found )
+            list->push_back( s.second );
+         std::lock_guard<std::mutex> g( reader_mutex );
+         strides = list;
+      }
+
+      /**
+       * A rotation writes the next blocks.log and blocks.index as .tmp files before moving the full ones away,
+       * so a crash in between leaves either the full files in place, and the .tmp files are dropped, or the
+       * .tmp files, which are then moved into place. Never a blocks.log without a header.
+       */
+      void block_log_impl::recover_rotation() {
+         fc::path block_tmp = block_file.generic_string() + ".tmp";
+         fc::path index_tmp = index_file.generic_string() + ".tmp";
+         if( fc::exists( block_tmp ) && !fc::exists( block_file ) ) {
+            ilog( "Completing the rotation of ${f}", ("f", block_file) );
+            if( fc::exists( index_tmp ) )
+               fc::rename( index_tmp, index_file );
+            fc::rename( block_tmp, block_file );
+         }
+         fc::remove_all( block_tmp );
+         fc::remove_all( index_tmp );
+      }
+
+      /// moves the full blocks.log and its index to the retained directory and starts both over
+      void block_log_impl::rotate() {
+         uint32_t last = head->block_num();
+         block_stream.close();
+         index_stream.close();
+         if( !fc::is_directory( retained_dir ) )
+            fc::create_directories( retained_dir );
+
+         fc::path block_tmp = block_file.generic_string() + ".tmp";
+         fc::path index_tmp = index_file.generic_string() + ".tmp";
+         {
+            std::ofstream log_stream;
+            std::ofstream new_index;
+            log_stream.exceptions( std::fstream::failbit | std::fstream::badbit );
+            new_index.exceptions( std::fstream::failbit | std::fstream::badbit );
+            log_stream.open( block_tmp.generic_string().c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+            new_index.open( index_tmp.generic_string().c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+
+            uint32_t version = stride_log_version;
+            uint32_t next_num = last + 1;
+            auto data = fc::raw::pack( genesis );
+            log_stream.write( (char*)&version, sizeof(version) );
+            log_stream.write( (char*)&next_num, sizeof(next_num) );
+            log_stream.write( data.data(), data.size() );
+            first_block_pos = log_stream.tellp();
+         }
+
+         auto closed = std::make_shared<block_stride>( first_block_num, last, retained_dir, false );
+         {
+            std::lock_guard<std::mutex> g( reader_mutex ); // no reader may map blocks.log while it moves
+            fc::rename( index_file, closed->index_file );
+            fc::rename( block_file, closed->log_file );
+            fc::rename( index_tmp, index_file );
+            fc::rename( block_tmp, block_file );
+            auto list = std::make_shared<stride_list>( *strides );
+            list->push_back( closed );
+            strides = list;
+            reader_first_num = last + 1;
+            reader_head_num = last;
+            reader_log_size = 0;
+            reader.reset();
+         }
+         ilog( "Moved blocks ${first} to ${last} to ${f}", ("first", first_block_num)("last", last)("f", closed->log_file) );
+
+         first_block_num = last + 1;
+         block_stream.open( block_file.generic_string().c_str(), LOG_WRITE );
+         index_stream.open( index_file.generic_string().c_str(), LOG_WRITE );
+         block_write = true;
+         index_write = true;
+
+         start_retention();
+      }
+
+      /// applies the retention whenever a stride was added, until stopped
+      void block_log_impl::run_archiver() {
+         std::unique_lock<std::mutex> g( archiver_mutex );
+         while( true ) {
+            archiver_cv.wait( g, [this]() { return retention_pending || archiver_stop; } );
+            if( archiver_stop )
+               break;
+            retention_pending = false;
+            retention_running = true;
+            g.unlock();
+            apply_retention();
+            g.lock();
+            retention_running = false;
+            archiver_cv.notify_all();
+         }
+      }
+
+      /// runs on the archiver thread, the only one removing strides
+      void block_log_impl::apply_retention() {
+         try {
+            vector<std::shared_ptr<const block_stride>> plain;
+            vector<std::shared_ptr<const block_stride>> packed;
+            for( const auto& s : *get_strides() )
+               (s->compressed ? packed : plain).push_back( s );
+
+            for( size_t i = 0; plain.size() - i > retention.max_retained_files; ++i ) {
+               if( archiver_stop )
+                  return;
+               const auto& s = plain[i];
+               if( retention.max_archived_files > 0 ) {
+                  ilog( "Compressing ${f}", ("f", s->log_file) );
+                  auto z = compress_stride( *s, retained_dir, archiver_stop );
+                  if( !z )
+                     return;
+                  replace_stride( s, z );
+                  packed.push_back( z );
+               } else {
+                  ilog( "Removing ${f}", ("f", s->log_file) );
+                  replace_stride( s, nullptr );
+               }
+               s->remove();
+            }
+
+            std::sort( packed.begin(), packed.end(), []( const auto& a, const auto& b ) {
+               return a->first_block_num < b->first_block_num;
+            });
+            for( size_t i = 0; packed.size() - i > retention.max_archived_files; ++i ) {
+               ilog( "Removing ${f}", ("f", packed[i]->log_file) );
+               replace_stride( packed[i], nullptr );
+               packed[i]->remove();
+            }
+         } FC_LOG_AND_DROP()
+      }
+   }
+
+   block_log_reader::block_log_reader(const fc::path& block_file, const fc::path& index_file, uint32_t first_num, uint32_t head_num,
+                                      uint64_t log_size, std::shared_ptr<const detail::stride_list> strides)
+   :first_num(first_num), head_num(head_num), strides(std::move(strides)) {
+      if (head_num < first_num)
+         return; // nothing in blocks.log yet
+      using namespace boost::interprocess;
+      file_mapping block_mapping(block_file.generic_string().c_str(), read_only);
+      file_mapping index_mapping(index_file.generic_string().c_str(), read_only);
+      blocks = mapped_region(block_mapping, read_only, 0, log_size);
+      index = mapped_region(index_mapping, read_only, 0, sizeof(uint64_t) * (head_num - first_num + 1));
+   }
+
+   uint32_t block_log_reader::first_block_num()const {
+      return strides->empty() ? first_num : strides->front()->first_block_num;
+   }
+
+   const detail::block_stride* block_log_reader::find_stride(uint32_t block_num)const {
+      auto itr = std::lower_bound(strides->begin(), strides->end(), block_num, [](const auto& s, uint32_t n) {
+         return s->last_block_num < n;
+      });
+      if (itr == strides->end() || (*itr)->first_block_num > block_num)
+         return nullptr;
+      return itr->get();
+   }
+
+   uint64_t block_log_reader::get_block_pos(uint32_t block_num)const {
+      if (block_num < first_num || block_num > head_num)
+         return block_log::npos;
+      uint64_t pos;
+      memcpy(&pos, static_cast<const char*>(index.get_address()) + sizeof(uint64_t) * (block_num - first_num), sizeof(pos));
+      return pos;
+   }
+
+   std::pair<const char*, size_t> block_log_reader::get_serialized_block(uint32_t block_num)const {
+      if (block_num == 0 || block_num > head_num)
+         return {nullptr, 0};
+      if (block_num < first_num) {
+         auto s = find_stride(block_num);
+         return s ? s->get_serialized_block(block_num) : std::pair<const char*, size_t>(nullptr, 0);
+      }
+      return detail::block_range(blocks, index, block_num - first_num);
    }
 
-   block_log::block_log(const fc::path& data_dir)
+   std::pair<const char*, size_t> block_log_reader::get_serialized_block(uint32_t block_num, vector<char>& archived)const {
+      auto data = get_serialized_block(block_num);
+      if (!data.second && block_num > 0 && block_num < first_num) {
+         auto s = find_stride(block_num);
+         if (s && s->compressed) {
+            archived = s->read_serialized_block(block_num);
+            data = {archived.data(), archived.size()};
+         }
+      }
+      return data;
+   }
+
+   vector<char> block_log_reader::read_serialized_block_by_num(uint32_t block_num)const {
+      vector<char> archived;
+      auto data = get_serialized_block(block_num, archived);
+      if (archived.size())
+         return archived;
+      return vector<char>(data.first, data.first + data.second);
+   }
+
+   signed_block_ptr block_log_reader::read_block_by_num(uint32_t block_num)const {
+      signed_block_ptr b;
+      vector<char> archived;
+      auto data = get_serialized_block(block_num, archived);
+      if (data.second) {
+         fc::datastream<const char*> ds(data.first, data.second);
+         b = std::make_shared<signed_block>();
+         fc::raw::unpack(ds, *b);
+         EOS_ASSERT(b->block_num() == block_num, reversible_blocks_exception,
+                   "Wrong block was read from block log.", ("returned", b->block_num())("expected", block_num));
+      }
+      return b;
+   }
+
+   block_id_type block_log_reader::read_block_id_by_num(uint32_t block_num)const {
+      block_id_type id;
+      vector<char> archived;
+      auto data = get_serialized_block(block_num, archived);
+      if (data.second) {
+         fc::datastream<const char*> ds(data.first, data.second);
+         signed_block_header h;
+         fc::raw::unpack(ds, h);
+         id = h.id();
+         EOS_ASSERT(block_header::num_from_id(id) == block_num, reversible_blocks_exception,
+                   "Wrong block was read from block log.", ("returned", block_header::num_from_id(id))("expected", block_num));
+      }
+      return id;
+   }
+
+   block_log::block_log(const fc::path& data_dir, const block_log_retention& retention)
    :my(new detail::block_log_impl()) {
       my->block_stream.exceptions(std::fstream::failbit | std::fstream::badbit);
       my->index_stream.exceptions(std::fstream::failbit | std::fstream::badbit);
+      my->retention = retention;
       open(data_dir);
    }
 
@@ -77,6 +818,7 @@ namespace eosio { namespace chain {
 
    block_log::~block_log() {
       if (my) {
+         my->stop_archiver();
          flush();
          my.reset();
       }
@@ -92,6 +834,10 @@ namespace eosio { namespace chain {
          fc::create_directories(data_dir);
       my->block_file = data_dir / "blocks.log";
       my->index_file = data_dir / "blocks.index";
+      my->retained_dir = my->retention.retained_dir.is_relative() ? data_dir / my->retention.retained_dir
+                                                                  : my->retention.retained_dir;
+      my->recover_rotation();
+      my->load_strides();
 
       //ilog("Opening block log at ${path}", ("path", my->block_file.generic_string()));
       my->block_stream.open(my->block_file.generic_string().c_str(), LOG_WRITE);
@@ -116,6 +862,9 @@ namespace eosio { namespace chain {
        *  - If they are the same, do nothing.
        *  - If the index file head is not in the log file, delete the index and replay.
        *  - If the index file head is in the log, but not up to date, replay from index head.
+       *
+       * A log that was just started over after a rotation has a header but no block yet, its head is
+       * the last block of the newest retained file.
        */
       auto log_size = fc::file_size(my->block_file);
       auto index_size = fc::file_size(my->index_file);
@@ -124,18 +873,22 @@ namespace eosio { namespace chain {
          ilog("Log is nonempty");
          my->check_block_read();
          my->block_stream.seekg( 0 );
-         uint32_t version = 0;
-         my->block_stream.read( (char*)&version, sizeof(version) );
-         EOS_ASSERT( version > 0, block_log_exception, "Block log was not setup properly with genesis information." );
-         EOS_ASSERT( version == block_log::supported_version, block_log_unsupported_version,
-                    "Unsupported version of block log. Block log version is ${version} while code supports version ${supported}",
-                    ("version", version)("supported", block_log::supported_version) );
+         auto header = detail::read_header( my->block_stream );
+         my->first_block_num = header.first_block_num;
+         my->genesis = header.genesis;
+         my->first_block_pos = my->block_stream.tellg();
 
          my->genesis_written_to_block_log = true; // Assume it was constructed properly.
          my->head = read_head();
-         my->head_id = my->head->id();
+         if (my->head)
+            my->head_id = my->head->id();
 
-         if (index_size) {
+         if (log_size == my->first_block_pos) {
+            if (index_size) {
+               ilog("Log has no block yet, recreate index");
+               construct_index();
+            }
+         } else if (index_size) {
             my->check_block_read();
             my->check_index_read();
 
@@ -166,21 +919,28 @@ namespace eosio { namespace chain {
          my->index_stream.open(my->index_file.generic_string().c_str(), LOG_WRITE);
          my->index_write = true;
       }
+
+      my->log_advanced(my->first_block_num, my->head ? my->head->block_num() : 0, log_size);
+      if (!my->get_strides()->empty())
+         my->start_retention();
    }
 
    uint64_t block_log::append(const signed_block_ptr& b) {
       try {
          EOS_ASSERT( my->genesis_written_to_block_log, block_log_append_fail, "Cannot append to block log until the genesis is first written" );
 
+         if (my->retention.stride && my->head && b->block_num() >= uint64_t(my->first_block_num) + my->retention.stride)
+            my->rotate();
+
          my->check_block_write();
          my->check_index_write();
 
          uint64_t pos = my->block_stream.tellp();
-         EOS_ASSERT(my->index_stream.tellp() == sizeof(uint64_t) * (b->block_num() - 1),
+         EOS_ASSERT(my->index_stream.tellp() == sizeof(uint64_t) * (b->block_num() - my->first_block_num),
                    block_log_append_fail,
                    "Append to index file occuring at wrong position.",
                    ("position", (uint64_t) my->index_stream.tellp())
-                   ("expected", (b->block_num() - 1) * sizeof(uint64_t)));
+                   ("expected", (b->block_num() - my->first_block_num) * sizeof(uint64_t)));
          auto data = fc::raw::pack(*b);
          my->block_stream.write(data.data(), data.size());
          my->block_stream.write((char*)&pos, sizeof(pos));
@@ -189,18 +949,30 @@ namespace eosio { namespace chain {
          my->head_id = b->id();
 
          flush();
+         my->log_advanced(my->first_block_num, b->block_num(), pos + data.size() + sizeof(pos));
 
          return pos;
       }
       FC_LOG_AND_RETHROW()
    }
 
+   void block_log::wait_for_retention() {
+      my->wait_for_retention();
+   }
+
    void block_log::flush() {
       my->block_stream.flush();
       my->index_stream.flush();
    }
 
    uint64_t block_log::reset_to_genesis( const genesis_state& gs, const signed_block_ptr& genesis_block ) {
+      return reset( gs, genesis_block );
+   }
+
+   uint64_t block_log::reset( const genesis_state& gs, const signed_block_ptr& first_block ) {
+      EOS_ASSERT( my->get_strides()->empty(), block_log_exception,
+                  "Cannot reset a block log that still has retained files in ${d}", ("d", my->retained_dir) );
+      const uint32_t first_num = first_block->block_num();
       if( my->block_stream.is_open() )
          my->block_stream.close();
       if( my->index_stream.is_open() )
@@ -208,6 +980,8 @@ namespace eosio { namespace chain {
 
       fc::remove_all( my->block_file );
       fc::remove_all( my->index_file );
+      my->head.reset();
+      my->log_advanced( first_num, first_num - 1, 0 );
 
       my->block_stream.open(my->block_file.generic_string().c_str(), LOG_WRITE);
       my->index_stream.open(my->index_file.generic_string().c_str(), LOG_WRITE);
@@ -217,18 +991,23 @@ namespace eosio { namespace chain {
       auto data = fc::raw::pack( gs );
       uint32_t version = 0; // version of 0 is invalid; it indicates that the genesis was not properly written to the block log
       my->block_stream.write( (char*)&version, sizeof(version) );
+      if( first_num > 1 )
+         my->block_stream.write( (char*)&first_num, sizeof(first_num) );
       my->block_stream.write( data.data(), data.size() );
       my->genesis_written_to_block_log = true;
+      my->genesis = gs;
+      my->first_block_num = first_num;
+      my->first_block_pos = my->block_stream.tellp();
 
-      auto ret = append( genesis_block );
+      auto ret = append( first_block );
 
       auto pos = my->block_stream.tellp();
 
       my->block_stream.close();
       my->block_stream.open(my->block_file.generic_string().c_str(), std::ios::in | std::ios::out | std::ios::binary ); // Bypass append-only writing just once
 
-      static_assert( block_log::supported_version > 0, "a version number of zero is not supported" );
-      version = block_log::supported_version;
+      static_assert( genesis_log_version > 0, "a version number of zero is not supported" );
+      version = first_num > 1 ? stride_log_version : genesis_log_version;
       my->block_stream.seekp( 0 );
       my->block_stream.write( (char*)&version, sizeof(version) ); // Finally write actual version to disk.
       my->block_stream.seekp( pos );
@@ -253,26 +1032,33 @@ namespace eosio { namespace chain {
 
    signed_block_ptr block_log::read_block_by_num(uint32_t block_num)const {
       try {
-         signed_block_ptr b;
-         uint64_t pos = get_block_pos(block_num);
-         if (pos != npos) {
-            b = read_block(pos).first;
-            EOS_ASSERT(b->block_num() == block_num, reversible_blocks_exception,
-                      "Wrong block was read from block log.", ("returned", b->block_num())("expected", block_num));
-         }
-         return b;
+         return get_reader()->read_block_by_num(block_num);
+      } FC_LOG_AND_RETHROW()
+   }
+
+   block_id_type block_log::read_block_id_by_num(uint32_t block_num)const {
+      try {
+         return get_reader()->read_block_id_by_num(block_num);
+      } FC_LOG_AND_RETHROW()
+   }
+
+   vector<char> block_log::read_serialized_block_by_num(uint32_t block_num)const {
+      try {
+         return get_reader()->read_serialized_block_by_num(block_num);
       } FC_LOG_AND_RETHROW()
    }
 
    uint64_t block_log::get_block_pos(uint32_t block_num) const {
-      my->check_index_read();
+      return get_reader()->get_block_pos(block_num);
+   }
 
-      if (!(my->head && block_num <= block_header::num_from_id(my->head_id) && block_num > 0))
-         return npos;
-      my->index_stream.seekg(sizeof(uint64_t) * (block_num - 1));
-      uint64_t pos;
-      my->index_stream.read((char*)&pos, sizeof(pos));
-      return pos;
+   std::shared_ptr<const block_log_reader> block_log::get_reader()const {
+      std::lock_guard<std::mutex> g(my->reader_mutex);
+      if (!my->reader) {
+         my->reader.reset(new block_log_reader(my->block_file, my->index_file, my->reader_first_num, my->reader_head_num,
+                                               my->reader_log_size, my->strides));
+      }
+      return my->reader;
    }
 
    signed_block_ptr block_log::read_head()const {
@@ -280,10 +1066,19 @@ namespace eosio { namespace chain {
 
       uint64_t pos;
 
-      // Check that the file is not empty
+      // Check that the file has a block after its header
       my->block_stream.seekg(0, std::ios::end);
-      if (my->block_stream.tellg() <= sizeof(pos))
-         return {};
+      if (my->block_stream.tellg() <= std::max<uint64_t>(sizeof(pos), my->first_block_pos)) {
+         auto strides = my->get_strides();
+         if (strides->empty())
+            return {};
+         // started over after a rotation, the head is the last block moved out
+         const auto& last = strides->back();
+         auto data = last->read_serialized_block(last->last_block_num);
+         if (data.empty())
+            return {};
+         return std::make_shared<signed_block>(fc::raw::unpack<signed_block>(data));
+      }
 
       my->block_stream.seekg(-sizeof(pos), std::ios::end);
       my->block_stream.read((char*)&pos, sizeof(pos));
@@ -297,31 +1092,12 @@ namespace eosio { namespace chain {
    void block_log::construct_index() {
       ilog("Reconstructing Block Log Index...");
       my->index_stream.close();
-      fc::remove_all(my->index_file);
+      detail::construct_index(my->block_file, my->index_file);
       my->index_stream.open(my->index_file.generic_string().c_str(), LOG_WRITE);
       my->index_write = true;
-
-      uint64_t end_pos;
-      my->check_block_read();
-
-      my->block_stream.seekg(-sizeof( uint64_t), std::ios::end);
-      my->block_stream.read((char*)&end_pos, sizeof(end_pos));
-      signed_block tmp;
-
-      uint64_t pos = 4; // Skip version which should have already been checked.
-      my->block_stream.seekg(pos);
-
-      genesis_state gs;
-      fc::raw::unpack(my->block_stream, gs);
-
-      while( pos < end_pos ) {
-         fc::raw::unpack(my->block_stream, tmp);
-         my->block_stream.read((char*)&pos, sizeof(pos));
-         my->index_stream.write((char*)&pos, sizeof(pos));
-      }
    } // construct_index
 
-   fc::path block_log::repair_log( const fc::path& data_dir, uint32_t truncate_at_block ) {
+   fc::path block_log::repair_log( const fc::path& data_dir, uint32_t truncate_at_block, const fc::path& retained_dir ) {
       ilog("Recovering Block Log...");
       EOS_ASSERT( fc::is_directory(data_dir) && fc::is_regular_file(data_dir / "blocks.log"), block_log_not_found,
                  "Block log not found in '${blocks_dir}'", ("blocks_dir", data_dir)          );
@@ -346,120 +1122,119 @@ namespace eosio { namespace chain {
 
       fc::create_directories(blocks_dir);
       auto block_log_path = blocks_dir / "blocks.log";
+      auto block_index_path = blocks_dir / "blocks.index";
+      auto old_block_log_path = backup_dir / "blocks.log";
+      auto old_block_index_path = backup_dir / "blocks.index";
 
       ilog( "Reconstructing '${new_block_log}' from backed up block log", ("new_block_log", block_log_path) );
 
       std::fstream  old_block_stream;
-      std::fstream  new_block_stream;
-
-      old_block_stream.open( (backup_dir / "blocks.log").generic_string().c_str(), LOG_READ );
-      new_block_stream.open( block_log_path.generic_string().c_str(), LOG_WRITE );
-
-      old_block_stream.seekg( 0, std::ios::end );
-      uint64_t end_pos = old_block_stream.tellg();
-      old_block_stream.seekg( 0 );
-
-      uint32_t version = 0;
-      old_block_stream.read( (char*)&version, sizeof(version) );
-      EOS_ASSERT( version > 0, block_log_exception, "Block log was not setup properly with genesis information." );
-      EOS_ASSERT( version == block_log::supported_version, block_log_unsupported_version,
-                 "Unsupported version of block log. Block log version is ${version} while code supports version ${supported}",
-                 ("version", version)("supported", block_log::supported_version) );
-
-      genesis_state gs;
-      fc::raw::unpack(old_block_stream, gs);
-
-      auto data = fc::raw::pack( gs );
-      new_block_stream.write( (char*)&version, sizeof(version) );
-      new_block_stream.write( data.data(), data.size() );
-
-      std::exception_ptr     except_ptr;
-      vector<char>           incomplete_block_data;
-      optional<signed_block> bad_block;
-      uint32_t               block_num = 0;
-
-      block_id_type previous;
-
-      uint64_t pos = old_block_stream.tellg();
-      while( pos < end_pos ) {
-         signed_block tmp;
+      old_block_stream.open( old_block_log_path.generic_string().c_str(), LOG_READ );
+
+      uint64_t end_pos = fc::file_size( old_block_log_path );
+      auto header = detail::read_header( old_block_stream );
+      uint64_t first_pos = old_block_stream.tellg();
+
+      using namespace boost::interprocess;
+      optional<file_mapping>  old_log_mapping;
+      mapped_region           old_log;
+      if( end_pos > first_pos ) {
+         old_log_mapping.emplace( old_block_log_path.generic_string().c_str(), read_only );
+         old_log = mapped_region( *old_log_mapping, read_only );
+      }
 
-         try {
-            fc::raw::unpack(old_block_stream, tmp);
-         } catch( ... ) {
-            except_ptr = std::current_exception();
-            incomplete_block_data.resize( end_pos - pos );
-            old_block_stream.read( incomplete_block_data.data(), incomplete_block_data.size() );
-            break;
+      // find the blocks without unpacking them if the log ends with a complete block, and otherwise trust
+      // the old index as far as the positions after the blocks agree with it, unpacking only the rest
+      uint64_t    scan_end = end_pos;
+      std::string error;
+      if( end_pos <= first_pos || !detail::write_index_backward( old_log, first_pos, block_index_path ) ) {
+         std::fstream index_stream;
+         index_stream.open( block_index_path.generic_string().c_str(), LOG_WRITE );
+         auto data = static_cast<const char*>( old_log.get_address() );
+         uint64_t pos = first_pos;
+         if( end_pos > first_pos && fc::exists( old_block_index_path ) && fc::file_size( old_block_index_path ) >= sizeof(uint64_t) ) {
+            std::fstream old_index_stream;
+            old_index_stream.open( old_block_index_path.generic_string().c_str(), LOG_READ );
+            uint64_t next = 0;
+            old_index_stream.read( (char*)&next, sizeof(next) );
+            while( next == pos && old_index_stream.read( (char*)&next, sizeof(next) ) ) {
+               if( next <= pos + sizeof(uint64_t) || next > end_pos || detail::read_position( data, next - sizeof(uint64_t) ) != pos )
+                  break;
+               index_stream.write( (char*)&pos, sizeof(pos) );
+               pos = next;
+            }
+            ilog( "Trusting the first ${n} blocks of the old index", ("n", (uint64_t(index_stream.tellp()) / sizeof(uint64_t))) );
          }
+         scan_end = detail::write_index_forward( old_block_stream, pos, end_pos, index_stream, error );
+      }
 
-         auto id = tmp.id();
-         if( block_header::num_from_id(previous) + 1 != block_header::num_from_id(id) ) {
-            elog( "Block ${num} (${id}) skips blocks. Previous block in block log is block ${prev_num} (${previous})",
-                  ("num", block_header::num_from_id(id))("id", id)
-                  ("prev_num", block_header::num_from_id(previous))("previous", previous) );
-         }
-         if( previous != tmp.previous ) {
-            elog( "Block ${num} (${id}) does not link back to previous block. "
-                  "Expected previous: ${expected}. Actual previous: ${actual}.",
-                  ("num", block_header::num_from_id(id))("id", id)("expected", previous)("actual", tmp.previous) );
-         }
-         previous = id;
+      uint64_t count = fc::file_size( block_index_path ) / sizeof(uint64_t);
+      uint64_t good = 0;
+      if( count > 0 ) {
+         mapped_region scanned_log( *old_log_mapping, read_only, 0, scan_end );
+         file_mapping index_mapping( block_index_path.generic_string().c_str(), read_only );
+         mapped_region index( index_mapping, read_only );
+         good = detail::verify_blocks( scanned_log, index, header.first_block_num, old_block_log_path );
+      }
+      bool truncated = false;
+      if( truncate_at_block >= header.first_block_num && truncate_at_block - header.first_block_num + 1 < good ) {
+         good = truncate_at_block - header.first_block_num + 1;
+         truncated = true;
+      }
 
-         uint64_t tmp_pos = std::numeric_limits<uint64_t>::max();
-         if( (static_cast<uint64_t>(old_block_stream.tellg()) + sizeof(pos)) <= end_pos ) {
-            old_block_stream.read( reinterpret_cast<char*>(&tmp_pos), sizeof(tmp_pos) );
-         }
-         if( pos != tmp_pos ) {
-            bad_block = tmp;
-            break;
+      // the blocks that are kept did not change, so they are copied as they are
+      uint64_t good_end = first_pos;
+      if( good > 0 ) {
+         std::fstream index_stream;
+         index_stream.open( block_index_path.generic_string().c_str(), LOG_READ );
+         if( good < count ) {
+            index_stream.seekg( good * sizeof(uint64_t) );
+            index_stream.read( (char*)&good_end, sizeof(good_end) );
+         } else {
+            good_end = scan_end;
          }
-
-         auto data = fc::raw::pack(tmp);
+      }
+      fc::resize_file( block_index_path, good * sizeof(uint64_t) );
+      {
+         std::fstream new_block_stream;
+         new_block_stream.open( block_log_path.generic_string().c_str(), LOG_WRITE );
+         auto data = fc::raw::pack( header.genesis );
+         new_block_stream.write( (char*)&header.version, sizeof(header.version) );
+         if( header.version >= stride_log_version )
+            new_block_stream.write( (char*)&header.first_block_num, sizeof(header.first_block_num) );
          new_block_stream.write( data.data(), data.size() );
-         new_block_stream.write( reinterpret_cast<char*>(&pos), sizeof(pos) );
-         block_num = tmp.block_num();
-         pos = new_block_stream.tellp();
-         if( block_num == truncate_at_block )
-            break;
+         if( good_end > first_pos )
+            new_block_stream.write( static_cast<const char*>( old_log.get_address() ) + first_pos, good_end - first_pos );
       }
 
-      if( bad_block.valid() ) {
-         ilog( "Recovered only up to block number ${num}. Last block in block log was not properly committed:\n${last_block}",
-               ("num", block_num)("last_block", *bad_block) );
-      } else if( except_ptr ) {
-         std::string error_msg;
-
-         try {
-            std::rethrow_exception(except_ptr);
-         } catch( const fc::exception& e ) {
-            error_msg = e.what();
-         } catch( const std::exception& e ) {
-            error_msg = e.what();
-         } catch( ... ) {
-            error_msg = "unrecognized exception";
-         }
-
+      uint32_t block_num = good > 0 ? header.first_block_num + good - 1 : header.first_block_num - 1;
+      if( truncated ) {
+         ilog( "Stopped recovery of block log early at specified block number: ${stop}.", ("stop", truncate_at_block) );
+      } else if( good_end < end_pos ) {
          ilog( "Recovered only up to block number ${num}. "
-               "The block ${next_num} could not be deserialized from the block log due to error:\n${error_msg}",
-               ("num", block_num)("next_num", block_num+1)("error_msg", error_msg) );
+               "The block ${next_num} could not be read from the block log${error}",
+               ("num", block_num)("next_num", block_num+1)("error", error.empty() ? std::string(".") : " due to error:\n" + error) );
 
          auto tail_path = blocks_dir / std::string("blocks-bad-tail-").append( now ).append(".log");
-         if( !fc::exists(tail_path) && incomplete_block_data.size() > 0 ) {
+         if( !fc::exists(tail_path) ) {
             std::fstream tail_stream;
             tail_stream.open( tail_path.generic_string().c_str(), LOG_WRITE );
-            tail_stream.write( incomplete_block_data.data(), incomplete_block_data.size() );
+            tail_stream.write( static_cast<const char*>( old_log.get_address() ) + good_end, end_pos - good_end );
 
             ilog( "Data at tail end of block log which should contain the (incomplete) serialization of block ${num} "
                   "has been written out to '${tail_path}'.",
                   ("num", block_num+1)("tail_path", tail_path) );
          }
-      } else if( block_num == truncate_at_block && pos < end_pos ) {
-         ilog( "Stopped recovery of block log early at specified block number: ${stop}.", ("stop", truncate_at_block) );
       } else {
          ilog( "Existing block log was undamaged. Recovered all irreversible blocks up to block number ${num}.", ("num", block_num) );
       }
 
+      if( retained_dir.is_relative() && fc::is_directory( backup_dir / retained_dir ) ) {
+         fc::create_directories( (blocks_dir / retained_dir).parent_path() );
+         fc::rename( backup_dir / retained_dir, blocks_dir / retained_dir );
+         ilog( "Moved retained block files back to '${dir}'", ("dir", blocks_dir / retained_dir) );
+      }
+
       return backup_dir;
    }
 
@@ -470,16 +1245,7 @@ namespace eosio { namespace chain {
       std::fstream  block_stream;
       block_stream.open( (data_dir / "blocks.log").generic_string().c_str(), LOG_READ );
 
-      uint32_t version = 0;
-      block_stream.read( (char*)&version, sizeof(version) );
-      EOS_ASSERT( version > 0, block_log_exception, "Block log was not setup properly with genesis information." );
-      EOS_ASSERT( version == block_log::supported_version, block_log_unsupported_version,
-                 "Unsupported version of block log. Block log version is ${version} while code supports version ${supported}",
-                 ("version", version)("supported", block_log::supported_version) );
-
-      genesis_state gs;
-      fc::raw::unpack(block_stream, gs);
-      return gs;
+      return detail::read_header( block_stream ).genesis;
    }
 
 } } /// eosio::chain
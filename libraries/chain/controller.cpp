@@ -2,6 +2,7 @@
 #include <eosio/chain/transaction_context.hpp>
 
 #include <eosio/chain/block_log.hpp>
+#include <eosio/chain/snapshot.hpp>
 #include <eosio/chain/fork_database.hpp>
 #include <eosio/chain/exceptions.hpp>
 
@@ -20,6 +21,15 @@
 #include <fc/io/json.hpp>
 #include <fc/scoped_exit.hpp>
 
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
+
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
 #include <eosio/chain/eosio_contract.hpp>
 
 namespace eosio { namespace chain {
@@ -87,6 +97,7 @@ struct pending_state {
 
    optional<block_id_type>            _producer_block_id;
 
+   bool                               _committed = false; ///< the state is final, accepted_block is being emitted
 
    void push() {
       _db_session.push();
@@ -106,12 +117,22 @@ struct controller_impl {
    authorization_manager          authorization;
    controller::config             conf;
    chain_id_type                  chain_id;
+   abi_serializer_cache           abi_cache;
+   signature_recovery_cache       sig_cache;
    bool                           replaying= false;
    optional<fc::time_point>       replay_head_time;
    db_read_mode                   read_mode = db_read_mode::SPECULATIVE;
    bool                           in_trx_requiring_checks = false; ///< if true, checks that are normally skipped on replay (e.g. auth checks) cannot be skipped
    optional<fc::microseconds>     subjective_cpu_leeway;
 
+   using prepared_transactions = vector<std::shared_future<transaction_metadata_ptr>>; ///< packed receipts of a block, in order
+
+   std::unique_ptr<boost::asio::io_context>                                                   thread_pool;
+   std::unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>>  thread_pool_work;
+   vector<std::thread>                                                                        thread_pool_threads;
+   std::mutex                                                                                 prepared_mtx;
+   map<block_id_type, prepared_transactions>                                                  prepared_blocks; ///< guarded by prepared_mtx
+
    typedef pair<scope_name,action_name>                   handler_key;
    map< account_name, map<handler_key, apply_handler> >   apply_handlers;
 
@@ -153,7 +174,8 @@ struct controller_impl {
     reversible_blocks( cfg.blocks_dir/config::reversible_blocks_dir_name,
         cfg.read_only ? database::read_only : database::read_write,
         cfg.reversible_cache_size ),
-    blog( cfg.blocks_dir ),
+    blog( cfg.blocks_dir, block_log_retention{ cfg.blocks_log_stride, cfg.max_retained_block_files,
+                                               cfg.max_archived_block_files, cfg.blocks_retained_dir } ),
     fork_db( cfg.state_dir ),
     wasmif( cfg.wasm_runtime ),
     resource_limits( db ),
@@ -268,7 +290,25 @@ struct controller_impl {
             ilog( "existing block log, attempting to replay ${n} blocks", ("n",end->block_num()) );
 
             auto start = fc::time_point::now();
-            while( auto next = blog.read_block_by_num( head->block_num + 1 ) ) {
+            // signatures are only checked on replay with force_all_checks, recover them a few blocks ahead then
+            std::deque<signed_block_ptr> ahead;
+            uint32_t ahead_num = head->block_num + 1;
+            auto read_next = [&]() -> signed_block_ptr {
+               while( !self.skip_auth_check() && thread_pool && ahead.size() < conf.thread_pool_size * 4u ) {
+                  auto b = blog.read_block_by_num( ahead_num );
+                  if( !b )
+                     break;
+                  ++ahead_num;
+                  prepare_block( b );
+                  ahead.push_back( b );
+               }
+               if( ahead.empty() )
+                  return blog.read_block_by_num( head->block_num + 1 );
+               auto b = ahead.front();
+               ahead.pop_front();
+               return b;
+            };
+            while( auto next = read_next() ) {
                self.push_block( next, controller::block_status::irreversible );
                if( next->block_num() % 100 == 0 ) {
                   std::cerr << std::setw(10) << next->block_num() << " of " << end->block_num() <<"\r";
@@ -328,6 +368,12 @@ struct controller_impl {
    }
 
    ~controller_impl() {
+      if( thread_pool ) {
+         thread_pool_work.reset();
+         thread_pool->stop();
+         for( auto& t : thread_pool_threads )
+            t.join();
+      }
       pending.reset();
 
       db.flush();
@@ -358,6 +404,29 @@ struct controller_impl {
       resource_limits.add_indices();
    }
 
+   /**
+    *  Fills the empty state database from the snapshot in the config and makes its block the head, the
+    *  root of the fork database and the first block of a new block log.
+    */
+   void read_snapshot() {
+      EOS_ASSERT( !fork_db.head(), snapshot_exception, "Cannot start from a snapshot with an existing fork database" );
+      EOS_ASSERT( db.revision() == 0 && db.get_index<account_index>().indices().empty(), snapshot_exception,
+                  "Cannot start from a snapshot with an existing state database" );
+      EOS_ASSERT( !blog.read_head(), snapshot_exception, "Cannot start from a snapshot with an existing block log" );
+
+      auto h = snapshot::read( conf.snapshot, db, std::max(1u, std::thread::hardware_concurrency()) );
+      EOS_ASSERT( h.genesis.compute_chain_id() == chain_id, snapshot_validation_exception,
+                  "Snapshot is of chain ${s}, not of chain ${c}", ("s", h.genesis.compute_chain_id())("c", chain_id) );
+
+      head = std::make_shared<block_state>( std::move( h.head ) );
+      head->validated = true;
+      head->in_current_chain = true;
+      fork_db.set( head );
+      db.set_revision( head->block_num );
+      blog.reset( conf.genesis, head->block );
+      ilog( "Starting from snapshot of block ${n} (${id})", ("n", head->block_num)("id", head->id) );
+   }
+
    void clear_all_undo() {
       // Rewind the database to the last irreversible block
       db.with_write_lock([&] {
@@ -491,6 +560,7 @@ struct controller_impl {
             });
          }
 
+         pending->_committed = true;
          emit( self.accepted_block, pending->_pending_block_state );
          emit( self.accepted_block_with_action_digests,
             std::make_shared<block_state_with_action_digests>(pending->_pending_block_state, pending->_action_digests) );
@@ -806,7 +876,7 @@ struct controller_impl {
             if( !self.skip_auth_check() && !trx->implicit ) {
                authorization.check_authorization(
                        trx->trx.actions,
-                       trx->recover_keys( chain_id ),
+                       trx->recover_keys( chain_id, sig_cache ),
                        {},
                        trx_context.delay,
                        [](){}
@@ -956,6 +1026,60 @@ struct controller_impl {
       static_cast<signed_block_header&>(*p->block) = p->header;
    } /// sign_block
 
+   void start_thread_pool() {
+      if( conf.thread_pool_size == 0 )
+         return;
+      thread_pool.reset( new boost::asio::io_context );
+      thread_pool_work.reset( new boost::asio::executor_work_guard<boost::asio::io_context::executor_type>( thread_pool->get_executor() ));
+      for( uint16_t i = 0; i < conf.thread_pool_size; ++i )
+         thread_pool_threads.emplace_back( [ioc = thread_pool.get()] { ioc->run(); } );
+   }
+
+   void prepare_block( const signed_block_ptr& b ) {
+      if( !thread_pool || !b || b->transactions.empty() )
+         return;
+      auto id = b->id();
+      std::lock_guard<std::mutex> g( prepared_mtx );
+      if( prepared_blocks.size() >= config::max_prepared_blocks || prepared_blocks.count( id ))
+         return; // recovered on apply instead
+      auto& trxs = prepared_blocks[id];
+      for( const auto& receipt : b->transactions ) {
+         if( !receipt.trx.contains<packed_transaction>() )
+            continue;
+         auto task = std::make_shared<std::packaged_task<transaction_metadata_ptr()>>(
+            [b, &pt = receipt.trx.get<packed_transaction>(), cid = chain_id, cache = &sig_cache]() {
+               auto mtrx = std::make_shared<transaction_metadata>( pt );
+               try {
+                  mtrx->recover_keys( cid, *cache );
+               } catch( ... ) {} // recovered again, and reported, when applied
+               return mtrx;
+            });
+         trxs.emplace_back( task->get_future().share() );
+         boost::asio::post( *thread_pool, [task] { (*task)(); } );
+      }
+   }
+
+   prepared_transactions take_prepared( const signed_block_ptr& b ) {
+      prepared_transactions result;
+      if( !thread_pool )
+         return result;
+      auto num = b->block_num();
+      std::lock_guard<std::mutex> g( prepared_mtx );
+      auto itr = prepared_blocks.find( b->id() );
+      if( itr != prepared_blocks.end() ) {
+         result = std::move( itr->second );
+         prepared_blocks.erase( itr );
+      }
+      // never applied, e.g. blocks of a losing fork
+      for( itr = prepared_blocks.begin(); itr != prepared_blocks.end(); ) {
+         if( block_header::num_from_id( itr->first ) <= num )
+            itr = prepared_blocks.erase( itr );
+         else
+            ++itr;
+      }
+      return result;
+   }
+
    void apply_block( const signed_block_ptr& b, controller::block_status s ) { try {
       try {
          EOS_ASSERT( b->block_extensions.size() == 0, block_validate_exception, "no supported extensions" );
@@ -963,11 +1087,25 @@ struct controller_impl {
 
          transaction_trace_ptr trace;
 
+         auto prepared = take_prepared( b );
+         size_t packed_index = 0;
+
          for( const auto& receipt : b->transactions ) {
             auto num_pending_receipts = pending->_pending_block_state->block->transactions.size();
             if( receipt.trx.contains<packed_transaction>() ) {
                auto& pt = receipt.trx.get<packed_transaction>();
-               auto mtrx = std::make_shared<transaction_metadata>(pt);
+               transaction_metadata_ptr mtrx;
+               if( packed_index < prepared.size() ) {
+                  try {
+                     mtrx = prepared[packed_index].get();
+                  } catch( ... ) {} // failed to unpack, reported by the attempt below
+                  // prepared from another copy of this block id, its transactions may not be the ones applied
+                  if( mtrx && mtrx->signed_id != digest_type::hash( pt ))
+                     mtrx.reset();
+               }
+               ++packed_index;
+               if( !mtrx )
+                  mtrx = std::make_shared<transaction_metadata>(pt);
                trace = push_transaction( mtrx, fc::time_point::maximum(), receipt.cpu_usage_us, true );
             } else if( receipt.trx.contains<transaction_id_type>() ) {
                trace = push_scheduled_transaction( receipt.trx.get<transaction_id_type>(), fc::time_point::maximum(), receipt.cpu_usage_us, true );
@@ -1379,8 +1517,12 @@ controller::~controller() {
 void controller::startup() {
 
    // ilog( "${c}", ("c",fc::json::to_pretty_string(cfg)) );
+   my->start_thread_pool();
    my->add_indices();
 
+   if( my->conf.snapshot != fc::path() )
+      my->read_snapshot();
+
    my->head = my->fork_db.head();
    if( !my->head ) {
       elog( "No head block in fork db, perhaps we need to replay" );
@@ -1417,6 +1559,10 @@ void controller::abort_block() {
    my->abort_block();
 }
 
+void controller::prepare_block( const signed_block_ptr& b ) {
+   my->prepare_block( b );
+}
+
 void controller::push_block( const signed_block_ptr& b, block_status s ) {
    validate_db_available_size();
    validate_reversible_available_size();
@@ -1566,6 +1712,26 @@ signed_block_ptr controller::fetch_block_by_number( uint32_t block_num )const  {
    return my->blog.read_block_by_num(block_num);
 } FC_CAPTURE_AND_RETHROW( (block_num) ) }
 
+vector<char> controller::fetch_serialized_block_by_number( uint32_t block_num )const  { try {
+   auto blk_state = my->fork_db.get_block_in_current_chain_by_num( block_num );
+   if( blk_state ) {
+      return fc::raw::pack( *blk_state->block );
+   }
+
+   return my->blog.read_serialized_block_by_num(block_num);
+} FC_CAPTURE_AND_RETHROW( (block_num) ) }
+
+std::shared_ptr<const block_log_reader> controller::get_block_log_reader()const {
+   return my->blog.get_reader();
+}
+
+void controller::write_snapshot( const fc::path& file )const {
+   EOS_ASSERT( !my->pending || my->pending->_committed, snapshot_exception,
+               "Cannot write a snapshot while a block is being applied" );
+   const auto& at = my->pending ? my->pending->_pending_block_state : my->head;
+   snapshot::write( file, my->db, my->conf.genesis, *at, std::max(1u, std::thread::hardware_concurrency()) );
+}
+
 block_state_ptr controller::fetch_block_state_by_id( block_id_type id )const {
    auto state = my->fork_db.get_block(id);
    return state;
@@ -1582,12 +1748,12 @@ block_id_type controller::get_block_id_for_num( uint32_t block_num )const { try
       return blk_state->id;
    }
 
-   auto signed_blk = my->blog.read_block_by_num(block_num);
+   auto id = my->blog.read_block_id_by_num(block_num);
 
-   EOS_ASSERT( BOOST_LIKELY( signed_blk != nullptr ), unknown_block_exception,
+   EOS_ASSERT( BOOST_LIKELY( id != block_id_type() ), unknown_block_exception,
                "Could not find block: ${block}", ("block", block_num) );
 
-   return signed_blk->id();
+   return id;
 } FC_CAPTURE_AND_RETHROW( (block_num) ) }
 
 void controller::pop_block() {
@@ -1727,6 +1893,20 @@ wasm_interface& controller::get_wasm_interface() {
    return my->wasmif;
 }
 
+std::shared_ptr<const abi_serializer> controller::get_cached_abi_serializer( account_name n, const fc::microseconds& max_serialization_time )const {
+   const auto& a = get_account( n );
+   const auto& seq = my->db.get<account_sequence_object, by_name>( n );
+   return my->abi_cache.get( n, seq.abi_sequence, a.abi.data(), a.abi.size(), max_serialization_time );
+}
+
+abi_serializer_cache::stats_type controller::get_abi_serializer_cache_stats()const {
+   return my->abi_cache.stats();
+}
+
+signature_recovery_cache::stats_type controller::get_signature_recovery_cache_stats()const {
+   return my->sig_cache.stats();
+}
+
 const account_object& controller::get_account( account_name name )const
 { try {
    return my->db.get<account_object, by_name>(name);
@@ -7,8 +7,12 @@
 #include <boost/multi_index/mem_fun.hpp>
 #include <boost/multi_index/composite_key.hpp>
 #include <fc/io/fstream.hpp>
+#include <fc/crypto/city.hpp>
 #include <fstream>
 
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
 namespace eosio { namespace chain {
    using boost::multi_index_container;
    using namespace boost::multi_index;
@@ -42,21 +46,118 @@ namespace eosio { namespace chain {
    > fork_multi_index_type;
 
 
+   /**
+    * The journal starts with its version, followed by one record per call that changed the fork database:
+    * the size of the record, a city hash of it, the kind of call and its packed arguments. Records are
+    * replayed through the same calls on startup, up to the first one that was not completely written.
+    */
+   static const uint32_t journal_version = 1;
+
+   enum class journal_op : uint8_t {
+      set                   = 0,
+      add                   = 1,
+      remove                = 2,
+      set_validity          = 3,
+      mark_in_current_chain = 4,
+      prune                 = 5,
+      add_confirmation      = 6,
+      set_head              = 7  ///< only written by compaction
+   };
+
+   static const uint64_t journal_record_header_size = sizeof(uint32_t) + sizeof(uint64_t);
+
+   static void pack_args( vector<char>& ) {}
+
+   template<typename T, typename... Rest>
+   static void pack_args( vector<char>& data, const T& arg, const Rest&... rest ) {
+      auto packed = fc::raw::pack( arg );
+      data.insert( data.end(), packed.begin(), packed.end() );
+      pack_args( data, rest... );
+   }
+
+   template<typename... Args>
+   static uint64_t write_record( std::ostream& out, journal_op op, const Args&... args ) {
+      vector<char> data( 1, char(op) );
+      pack_args( data, args... );
+      uint32_t size = data.size();
+      uint64_t checksum = fc::city_hash64( data.data(), data.size() );
+      out.write( (char*)&size, sizeof(size) );
+      out.write( (char*)&checksum, sizeof(checksum) );
+      out.write( data.data(), data.size() );
+      return journal_record_header_size + size;
+   }
+
    struct fork_database_impl {
       fork_multi_index_type index;
       block_state_ptr       head;
       fc::path              datadir;
+
+      fc::path              journal_file;
+      std::ofstream         journal;
+      uint64_t              journal_size = 0;
+      uint64_t              compacted_size = 0; ///< of the journal right after it was last compacted
+      uint32_t              depth = 0;          ///< of nested fork_database calls, only the outermost one is journaled
+      bool                  replaying = false;
+
+      /// appended as soon as the call is done, so a killed node loses at most the call it was in
+      template<typename... Args>
+      void append( journal_op op, const Args&... args ) {
+         if( replaying || !journal.is_open() )
+            return;
+         journal_size += write_record( journal, op, args... );
+         journal.flush();
+      }
+
+      void open_journal() {
+         journal.exceptions( std::ofstream::failbit | std::ofstream::badbit );
+         journal.open( journal_file.generic_string().c_str(), std::ios::out | std::ios::binary | std::ios::app );
+         journal_size = fc::file_size( journal_file );
+      }
+
+      /// rewrites the journal as one record per block state, dropping the history of those that were pruned
+      void compact() {
+         auto tmp_file = journal_file.generic_string() + ".tmp";
+         {
+            std::ofstream out;
+            out.exceptions( std::ofstream::failbit | std::ofstream::badbit );
+            out.open( tmp_file.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+            out.write( (char*)&journal_version, sizeof(journal_version) );
+            for( const auto& s : index.get<by_block_num>() )
+               write_record( out, journal_op::set, *s );
+            if( head )
+               write_record( out, journal_op::set_head, head->id );
+         }
+         if( journal.is_open() )
+            journal.close();
+         fc::rename( tmp_file, journal_file );
+         open_journal();
+         compacted_size = journal_size;
+      }
+
+      bool should_compact()const {
+         return journal_size > std::max( 2 * compacted_size, config::forkdb_min_compact_size );
+      }
+   };
+
+   /// a call made by another fork_database call, which journals the effect of both
+   struct nested_call {
+      explicit nested_call( fork_database_impl& my ):my(my), outermost(my.depth++ == 0) {}
+      ~nested_call() { --my.depth; }
+
+      fork_database_impl& my;
+      const bool          outermost;
    };
 
 
    fork_database::fork_database( const fc::path& data_dir ):my( new fork_database_impl() ) {
       my->datadir = data_dir;
+      my->journal_file = data_dir / config::forkdb_journal_filename;
 
       if (!fc::is_directory(my->datadir))
          fc::create_directories(my->datadir);
 
       auto fork_db_dat = my->datadir / config::forkdb_filename;
-      if( fc::exists( fork_db_dat ) ) {
+      if( fc::exists( fork_db_dat ) ) { // written at shutdown by versions without a journal
          string content;
          fc::read_file_contents( fork_db_dat, content );
 
@@ -72,24 +173,136 @@ namespace eosio { namespace chain {
 
          my->head = get_block( head_id );
 
+         my->compact();
          fc::remove( fork_db_dat );
+      } else if( fc::exists( my->journal_file ) && replay_journal() ) {
+         my->open_journal();
+         my->compacted_size = my->journal_size;
+      } else {
+         my->compact();
       }
    }
 
+   bool fork_database::replay_journal() {
+      using namespace boost::interprocess;
+      uint64_t size = fc::file_size( my->journal_file );
+      if( size < sizeof(journal_version) )
+         return false;
+
+      uint64_t good = sizeof(journal_version);
+      {
+         file_mapping  journal_mapping( my->journal_file.generic_string().c_str(), read_only );
+         mapped_region journal( journal_mapping, read_only );
+         auto data = static_cast<const char*>( journal.get_address() );
+
+         uint32_t version;
+         memcpy( &version, data, sizeof(version) );
+         EOS_ASSERT( version == journal_version, fork_database_exception,
+                     "Unsupported version of fork database journal. Journal version is ${version} while code supports version ${supported}",
+                     ("version", version)("supported", journal_version) );
+
+         my->replaying = true;
+         while( good + journal_record_header_size <= size ) {
+            uint32_t record_size;
+            uint64_t checksum;
+            memcpy( &record_size, data + good, sizeof(record_size) );
+            memcpy( &checksum, data + good + sizeof(record_size), sizeof(checksum) );
+            const char* record = data + good + journal_record_header_size;
+            if( record_size == 0 || record_size > size - good - journal_record_header_size ||
+                fc::city_hash64( record, record_size ) != checksum )
+               break;
+
+            try {
+               fc::datastream<const char*> ds( record, record_size );
+               uint8_t op;
+               fc::raw::unpack( ds, op );
+               replay_record( op, ds );
+            } catch( const fc::exception& e ) {
+               wlog( "Cannot replay fork database journal past ${pos}: ${e}", ("pos", good)("e", e.to_detail_string()) );
+               break;
+            }
+            good += journal_record_header_size + record_size;
+         }
+         my->replaying = false;
+      }
+
+      if( good < size ) {
+         wlog( "Dropping the last ${n} bytes of ${f}, they were not completely written",
+               ("n", size - good)("f", my->journal_file.generic_string()) );
+         fc::resize_file( my->journal_file, good );
+      }
+      return true;
+   }
+
+   void fork_database::replay_record( uint8_t op, fc::datastream<const char*>& ds ) {
+      auto unpack_state = [&]() {
+         auto s = std::make_shared<block_state>();
+         fc::raw::unpack( ds, *s );
+         return s;
+      };
+      auto unpack_block = [&]() {
+         block_id_type id;
+         fc::raw::unpack( ds, id );
+         auto b = get_block( id );
+         EOS_ASSERT( b, fork_db_block_not_found, "block ${id} does not exist", ("id", id) );
+         return b;
+      };
+
+      switch( journal_op(op) ) {
+         case journal_op::set:
+            set( unpack_state() );
+            break;
+         case journal_op::add:
+            add( unpack_state() );
+            break;
+         case journal_op::remove: {
+            block_id_type id;
+            fc::raw::unpack( ds, id );
+            remove( id );
+            break;
+         }
+         case journal_op::set_validity: {
+            auto b = unpack_block();
+            bool valid;
+            fc::raw::unpack( ds, valid );
+            set_validity( b, valid );
+            break;
+         }
+         case journal_op::mark_in_current_chain: {
+            auto b = unpack_block();
+            bool in_current_chain;
+            fc::raw::unpack( ds, in_current_chain );
+            mark_in_current_chain( b, in_current_chain );
+            break;
+         }
+         case journal_op::prune:
+            prune( unpack_block() );
+            break;
+         case journal_op::add_confirmation: {
+            header_confirmation c;
+            fc::raw::unpack( ds, c );
+            add( c );
+            break;
+         }
+         case journal_op::set_head:
+            my->head = unpack_block();
+            break;
+         default:
+            EOS_THROW( fork_database_exception, "unknown fork database journal record ${op}", ("op", op) );
+      }
+   }
+
+   void fork_database::compact() {
+      my->compact();
+   }
+
    void fork_database::close() {
       if( my->index.size() == 0 ) return;
 
-      auto fork_db_dat = my->datadir / config::forkdb_filename;
-      std::ofstream out( fork_db_dat.generic_string().c_str(), std::ios::out | std::ios::binary | std::ofstream::trunc );
-      uint32_t num_blocks_in_fork_db = my->index.size();
-      fc::raw::pack( out, unsigned_int{num_blocks_in_fork_db} );
-      for( const auto& s : my->index ) {
-         fc::raw::pack( out, *s );
-      }
-      if( my->head )
-         fc::raw::pack( out, my->head->id );
-      else
-         fc::raw::pack( out, block_id_type() );
+      // every change is in the journal already, and the pruning below is left out of it so that the
+      // head block is still there after a restart
+      if( my->journal.is_open() )
+         my->journal.close();
 
       /// we don't normally indicate the head block as irreversible
       /// we cannot normally prune the lib if it is the head block because
@@ -109,6 +322,7 @@ namespace eosio { namespace chain {
    }
 
    void fork_database::set( block_state_ptr s ) {
+      nested_call call( *my );
       auto result = my->index.insert( s );
       EOS_ASSERT( s->id == s->header.id(), fork_database_exception, 
                   "block state id (${id}) is different from block state header id (${hid})", ("id", string(s->id))("hid", string(s->header.id())) );
@@ -121,9 +335,12 @@ namespace eosio { namespace chain {
       } else if( my->head->block_num < s->block_num ) {
          my->head =  s;
       }
+      if( call.outermost )
+         my->append( journal_op::set, *s );
    }
 
    block_state_ptr fork_database::add( block_state_ptr n ) {
+      nested_call call( *my );
       auto inserted = my->index.insert(n);
       EOS_ASSERT( inserted.second, fork_database_exception, "duplicate block added?" );
 
@@ -132,10 +349,16 @@ namespace eosio { namespace chain {
       auto lib    = my->head->dpos_irreversible_blocknum;
       auto oldest = *my->index.get<by_block_num>().begin();
 
-      if( oldest->block_num < lib ) {
+      bool pruned = oldest->block_num < lib;
+      if( pruned ) {
          prune( oldest );
       }
 
+      if( call.outermost ) {
+         my->append( journal_op::add, *n );
+         if( pruned && !my->replaying && my->should_compact() )
+            my->compact();
+      }
       return n;
    }
 
@@ -202,6 +425,7 @@ namespace eosio { namespace chain {
 
    /// remove all of the invalid forks built of this id including this id
    void fork_database::remove( const block_id_type& id ) {
+      nested_call call( *my );
       vector<block_id_type> remove_queue{id};
 
       for( uint32_t i = 0; i < remove_queue.size(); ++i ) {
@@ -218,20 +442,26 @@ namespace eosio { namespace chain {
       }
       //wdump((my->index.size()));
       my->head = *my->index.get<by_lib_block_num>().begin();
+      if( call.outermost )
+         my->append( journal_op::remove, id );
    }
 
    void fork_database::set_validity( const block_state_ptr& h, bool valid ) {
+      nested_call call( *my );
       if( !valid ) {
          remove( h->id );
       } else {
          /// remove older than irreversible and mark block as valid
          h->validated = true;
       }
+      if( call.outermost )
+         my->append( journal_op::set_validity, h->id, valid );
    }
 
    void fork_database::mark_in_current_chain( const block_state_ptr& h, bool in_current_chain ) {
       if( h->in_current_chain == in_current_chain )
          return;
+      nested_call call( *my );
 
       auto& by_id_idx = my->index.get<by_block_id>();
       auto itr = by_id_idx.find( h->id );
@@ -240,10 +470,14 @@ namespace eosio { namespace chain {
       by_id_idx.modify( itr, [&]( auto& bsp ) { // Need to modify this way rather than directly so that Boost MultiIndex can re-sort
          bsp->in_current_chain = in_current_chain;
       });
+      if( call.outermost )
+         my->append( journal_op::mark_in_current_chain, h->id, in_current_chain );
    }
 
    void fork_database::prune( const block_state_ptr& h ) {
+      nested_call call( *my );
       auto num = h->block_num;
+      auto pruned_id = h->id; // h may be the last reference to the block state
 
       auto& by_bn = my->index.get<by_block_num>();
       auto bni = by_bn.begin();
@@ -266,6 +500,8 @@ namespace eosio { namespace chain {
          auto id = (*itr_to_remove)->id;
          remove( id );
       }
+      if( call.outermost )
+         my->append( journal_op::prune, pruned_id );
    }
 
    block_state_ptr   fork_database::get_block(const block_id_type& id)const {
@@ -289,6 +525,7 @@ namespace eosio { namespace chain {
    }
 
    void fork_database::add( const header_confirmation& c ) {
+      nested_call call( *my );
       auto b = get_block( c.block_id );
       EOS_ASSERT( b, fork_db_block_not_found, "unable to find block id ${id}", ("id",c.block_id));
       b->add_confirmation( c );
@@ -297,6 +534,8 @@ namespace eosio { namespace chain {
          b->confirmations.size() >= ((b->active_schedule.producers.size() * 2) / 3 + 1) ) {
          set_bft_irreversible( c.block_id );
       }
+      if( call.outermost )
+         my->append( journal_op::add_confirmation, c );
    }
 
    /**
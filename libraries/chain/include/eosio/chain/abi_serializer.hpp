@@ -287,7 +287,7 @@ namespace impl {
          mvo("authorization", act.authorization);
 
          auto abi = resolver(act.account);
-         if (abi.valid()) {
+         if (abi) { // optional or pointer to a cached serializer
             auto type = abi->get_action_type(act.name);
             if (!type.empty()) {
                try {
@@ -463,7 +463,7 @@ namespace impl {
                valid_empty_data = act.data.empty();
             } else if ( data.is_object() ) {
                auto abi = resolver(act.account);
-               if (abi.valid()) {
+               if (abi) {
                   auto type = abi->get_action_type(act.name);
                   if (!type.empty()) {
                      act.data = std::move( abi->_variant_to_binary( type, data, recursion_depth, deadline, max_serialization_time ));
@@ -0,0 +1,57 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+#include <eosio/chain/abi_serializer.hpp>
+
+#include <mutex>
+#include <unordered_map>
+
+namespace eosio { namespace chain {
+
+   /**
+    *  Validated abi_serializers shared by every reader of contract ABIs on the node.
+    *
+    *  An entry is keyed by account and remembers the abi_sequence and the raw ABI it was built from, so the
+    *  `setabi` that bumps the sequence, or a fork switch that undoes one, makes the next lookup rebuild it.
+    *  The least recently used entries are dropped past `max_entries`. Safe to use from several threads.
+    */
+   class abi_serializer_cache {
+      public:
+         explicit abi_serializer_cache( size_t max_entries = 1024 ) : max_entries(max_entries) {}
+
+         /// null if the account has no abi, throws if it does not validate
+         std::shared_ptr<const abi_serializer> get( account_name account, uint64_t abi_sequence,
+                                                    const char* abi, size_t abi_size,
+                                                    const fc::microseconds& max_serialization_time );
+         void clear();
+
+         struct stats_type {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t entries = 0;
+         };
+         stats_type stats()const;
+
+      private:
+         struct entry {
+            uint64_t                              abi_sequence = 0;
+            vector<char>                          abi;
+            std::shared_ptr<const abi_serializer> serializer;
+            uint64_t                              last_used = 0;
+         };
+
+         void evict_least_recently_used();
+
+         const size_t                           max_entries;
+         mutable std::mutex                     mtx;
+         std::unordered_map<uint64_t, entry>    entries; ///< by account name value
+         uint64_t                               use_count = 0;
+         uint64_t                               hits = 0;
+         uint64_t                               misses = 0;
+   };
+
+} }  /// eosio::chain
+
+FC_REFLECT( eosio::chain::abi_serializer_cache::stats_type, (hits)(misses)(entries) )
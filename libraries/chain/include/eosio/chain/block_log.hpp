@@ -7,9 +7,15 @@
 #include <eosio/chain/block.hpp>
 #include <eosio/chain/genesis_state.hpp>
 
+#include <boost/interprocess/mapped_region.hpp>
+
 namespace eosio { namespace chain {
 
-   namespace detail { class block_log_impl; }
+   namespace detail {
+      class block_log_impl;
+      class block_stride;
+      using stride_list = vector<std::shared_ptr<const block_stride>>;
+   }
 
    /* The block log is an external append only log of the blocks. Blocks should only be written
     * to the log after they irreverisble as the log is append only. The log is a doubly linked
@@ -34,17 +40,82 @@ namespace eosio { namespace chain {
     *
     * The main file is the only file that needs to persist. The index file can be reconstructed during a
     * linear scan of the main file.
+    *
+    * With a stride configured, blocks.log holds at most that many blocks. When it is full it is moved to
+    * the retained directory as blocks-<first>-<last>.log with its index, and blocks.log starts over at the
+    * next block. Files after the first one are version 2, whose header records the number of their first
+    * block; index entries count from that block instead of block 1. The oldest retained files are
+    * compressed into blocks-<first>-<last>.zlog, one zlib stream per block, or removed, as the retention
+    * allows.
+    */
+
+   /// how the block log is split into files and how long closed files are kept
+   struct block_log_retention {
+      uint32_t stride = 0;                ///< blocks per file, 0 keeps a single ever growing blocks.log
+      uint32_t max_retained_files = std::numeric_limits<uint32_t>::max(); ///< closed files kept as they are
+      uint32_t max_archived_files = 0;    ///< closed files past those kept compressed, older ones are removed
+      fc::path retained_dir = "retained"; ///< relative to the blocks directory unless absolute
+   };
+
+   /**
+    * Read only view of the block log as of the head it was taken at. The log and index files are memory
+    * mapped, so reading a block neither copies the file nor moves a shared stream, and any number of
+    * threads may use the same reader at once. Blocks appended later are not seen; block_log::get_reader
+    * hands out a newer reader once the log has grown. Retained files are mapped on first use.
     */
+   class block_log_reader {
+      public:
+         uint32_t head_block_num()const { return head_num; }
+         /// oldest block that was not removed by the retention
+         uint32_t first_block_num()const;
+
+         /**
+          * Return offset of block in blocks.log, or block_log::npos if the reader does not cover it or it
+          * was moved to a retained file.
+          */
+         uint64_t get_block_pos(uint32_t block_num)const;
+
+         /**
+          * Return the block as it is packed in the log, pointing into the mapped file, or an empty range
+          * if the reader does not cover it or it is only kept compressed. The bytes remain valid as long as
+          * the reader does.
+          */
+         std::pair<const char*, size_t> get_serialized_block(uint32_t block_num)const;
+
+         /// like get_serialized_block but also unpacks compressed blocks, into a copy
+         vector<char>     read_serialized_block_by_num(uint32_t block_num)const;
+         signed_block_ptr read_block_by_num(uint32_t block_num)const;
+         block_id_type    read_block_id_by_num(uint32_t block_num)const;
+
+      private:
+         friend class block_log;
+
+         block_log_reader(const fc::path& block_file, const fc::path& index_file, uint32_t first_num, uint32_t head_num,
+                          uint64_t log_size, std::shared_ptr<const detail::stride_list> strides);
+         const detail::block_stride* find_stride(uint32_t block_num)const;
+         /// the block in place, or unpacked into `archived` if it is only kept compressed
+         std::pair<const char*, size_t> get_serialized_block(uint32_t block_num, vector<char>& archived)const;
+
+         uint32_t                             first_num = 1; ///< first block of blocks.log
+         uint32_t                             head_num = 0;
+         boost::interprocess::mapped_region   blocks;
+         boost::interprocess::mapped_region   index;
+         std::shared_ptr<const detail::stride_list> strides; ///< closed files, oldest first
+   };
 
    class block_log {
       public:
-         block_log(const fc::path& data_dir);
+         block_log(const fc::path& data_dir, const block_log_retention& retention = block_log_retention());
          block_log(block_log&& other);
          ~block_log();
 
          uint64_t append(const signed_block_ptr& b);
          void flush();
+         /// blocks until the retention of the files closed so far was applied, which otherwise runs in the background
+         void wait_for_retention();
          uint64_t reset_to_genesis( const genesis_state& gs, const signed_block_ptr& genesis_block );
+         /// starts the log over at `first_block`, which need not be block 1, as a node started from a snapshot does
+         uint64_t reset( const genesis_state& gs, const signed_block_ptr& first_block );
 
          std::pair<signed_block_ptr, uint64_t> read_block(uint64_t file_pos)const;
          signed_block_ptr read_block_by_num(uint32_t block_num)const;
@@ -52,10 +123,29 @@ namespace eosio { namespace chain {
             return read_block_by_num(block_header::num_from_id(id));
          }
 
+         /**
+          * Return the id of the block, or an empty id if it does not exist.
+          * Only the block header is deserialized.
+          */
+         block_id_type read_block_id_by_num(uint32_t block_num)const;
+
+         /**
+          * Return the block as it is packed in the log, or an empty vector if it does not exist.
+          * Nothing is deserialized.
+          */
+         vector<char> read_serialized_block_by_num(uint32_t block_num)const;
+
          /**
           * Return offset of block in file, or block_log::npos if it does not exist.
           */
          uint64_t get_block_pos(uint32_t block_num) const;
+
+         /**
+          * Reader of every block appended so far. Unlike the rest of block_log, this may be called from any
+          * thread, and so may the by number reads above, which go through the current reader.
+          */
+         std::shared_ptr<const block_log_reader> get_reader()const;
+
          signed_block_ptr        read_head()const;
          const signed_block_ptr& head()const;
 
@@ -63,7 +153,9 @@ namespace eosio { namespace chain {
 
          static const uint32_t supported_version;
 
-         static fc::path repair_log( const fc::path& data_dir, uint32_t truncate_at_block = 0 );
+         /// rebuilds blocks.log, retained files are moved back into the new blocks directory untouched
+         static fc::path repair_log( const fc::path& data_dir, uint32_t truncate_at_block = 0,
+                                     const fc::path& retained_dir = block_log_retention().retained_dir );
 
          static genesis_state extract_genesis_state( const fc::path& data_dir );
 
@@ -19,8 +19,13 @@ const static auto default_reversible_guard_size = 2*1024*1024ll;/// 1MB * 340 bl
 
 const static auto default_state_dir_name     = "state";
 const static auto forkdb_filename            = "forkdb.dat";
+const static auto forkdb_journal_filename    = "forkdb.log";
+const static uint64_t forkdb_min_compact_size = 16*1024*1024ll; ///< the fork database journal is not compacted before
 const static auto default_state_size            = 1*1024*1024*1024ll;
 const static auto default_state_guard_size      =    128*1024*1024ll;
+const static uint16_t default_controller_thread_pool_size = 2;
+const static uint32_t max_prepared_blocks = 256; ///< blocks whose signatures are recovered ahead of being applied
+const static uint32_t default_sig_cache_size = 50000; ///< transactions whose recovered keys are remembered
 
 
 const static uint64_t system_account_name    = N(eosio);
@@ -5,6 +5,8 @@
 #include <boost/signals2/signal.hpp>
 
 #include <eosio/chain/abi_serializer.hpp>
+#include <eosio/chain/abi_serializer_cache.hpp>
+#include <eosio/chain/signature_recovery_cache.hpp>
 #include <eosio/chain/account_object.hpp>
 
 namespace chainbase {
@@ -32,6 +34,7 @@ namespace eosio { namespace chain {
    using apply_handler = std::function<void(apply_context&)>;
 
    class fork_database;
+   class block_log_reader;
 
    enum class db_read_mode {
       SPECULATIVE,
@@ -56,7 +59,12 @@ namespace eosio { namespace chain {
             flat_set< pair<account_name, action_name> > action_blacklist;
             flat_set<public_key_type> key_blacklist;
             path                     blocks_dir             =  chain::config::default_blocks_dir_name;
+            uint32_t                 blocks_log_stride      =  0; ///< 0 keeps every block in blocks.log
+            uint32_t                 max_retained_block_files = std::numeric_limits<uint32_t>::max();
+            uint32_t                 max_archived_block_files = 0;
+            path                     blocks_retained_dir    =  "retained"; ///< relative to blocks_dir unless absolute
             path                     state_dir              =  chain::config::default_state_dir_name;
+            path                     snapshot; ///< the state to start from instead of genesis, empty for none
             uint64_t                 state_size             =  chain::config::default_state_size;
             uint64_t                 state_guard_size       =  chain::config::default_state_guard_size;
             uint64_t                 reversible_cache_size  =  chain::config::default_reversible_cache_size;
@@ -65,6 +73,7 @@ namespace eosio { namespace chain {
             bool                     force_all_checks       =  false;
             bool                     disable_replay_opts    =  false;
             bool                     contracts_console      =  false;
+            uint16_t                 thread_pool_size       =  chain::config::default_controller_thread_pool_size; ///< 0 recovers signatures on apply only
 
             genesis_state            genesis;
             wasm_interface::vm_type  wasm_runtime = chain::config::default_wasm_runtime;
@@ -136,6 +145,12 @@ namespace eosio { namespace chain {
 
          void push_block( const signed_block_ptr& b, block_status s = block_status::complete );
 
+         /**
+          *  Starts recovering the signing keys of the transactions in `b` on the thread pool, so that
+          *  push_block only has to execute them. May be called from any thread, as soon as a block is received.
+          */
+         void prepare_block( const signed_block_ptr& b );
+
          /**
           * Call this method when a producer confirmation is received, this might update
           * the last bft irreversible block and/or cause a switch of forks
@@ -192,6 +207,16 @@ namespace eosio { namespace chain {
          block_id_type last_irreversible_block_id() const;
 
          signed_block_ptr fetch_block_by_number( uint32_t block_num )const;
+         /// packed signed_block, read from the block log without unpacking when it is there, empty if unknown
+         vector<char>     fetch_serialized_block_by_number( uint32_t block_num )const;
+         /// the irreversible blocks in the block log, unlike the fetches above usable from any thread
+         std::shared_ptr<const block_log_reader> get_block_log_reader()const;
+
+         /**
+          * Writes the state as of the head block to `file`, or as of the block being accepted when called from
+          * accepted_block. Not allowed while transactions are applied to a pending block.
+          */
+         void write_snapshot( const fc::path& file )const;
          signed_block_ptr fetch_block_by_id( block_id_type id )const;
 
          block_state_ptr fetch_block_state_by_number( uint32_t block_num )const;
@@ -257,13 +282,16 @@ namespace eosio { namespace chain {
          wasm_interface& get_wasm_interface();
 
 
+         /// built once per abi_sequence of the account and shared by every caller, null if it has no abi
+         std::shared_ptr<const abi_serializer> get_cached_abi_serializer( account_name n, const fc::microseconds& max_serialization_time )const;
+         abi_serializer_cache::stats_type get_abi_serializer_cache_stats()const;
+         signature_recovery_cache::stats_type get_signature_recovery_cache_stats()const;
+
          optional<abi_serializer> get_abi_serializer( account_name n, const fc::microseconds& max_serialization_time )const {
             if( n.good() ) {
                try {
-                  const auto& a = get_account( n );
-                  abi_def abi;
-                  if( abi_serializer::to_abi( a.abi, abi ))
-                     return abi_serializer( abi, max_serialization_time );
+                  if( auto abis = get_cached_abi_serializer( n, max_serialization_time ))
+                     return *abis;
                } FC_CAPTURE_AND_LOG((n))
             }
             return optional<abi_serializer>();
@@ -273,7 +301,14 @@ namespace eosio { namespace chain {
          fc::variant to_variant_with_abi( const T& obj, const fc::microseconds& max_serialization_time ) {
             fc::variant pretty_output;
             abi_serializer::to_variant( obj, pretty_output,
-                                        [&]( account_name n ){ return get_abi_serializer( n, max_serialization_time ); },
+                                        [&]( account_name n ) -> std::shared_ptr<const abi_serializer> {
+                                           if( n.good() ) {
+                                              try {
+                                                 return get_cached_abi_serializer( n, max_serialization_time );
+                                              } FC_CAPTURE_AND_LOG((n))
+                                           }
+                                           return nullptr;
+                                        },
                                         max_serialization_time);
             return pretty_output;
          }
@@ -292,13 +327,19 @@ FC_REFLECT( eosio::chain::controller::config,
             (contract_whitelist)
             (contract_blacklist)
             (blocks_dir)
+            (blocks_log_stride)
+            (max_retained_block_files)
+            (max_archived_block_files)
+            (blocks_retained_dir)
             (state_dir)
+            (snapshot)
             (state_size)
             (reversible_cache_size)
             (read_only)
             (force_all_checks)
             (disable_replay_opts)
             (contracts_console)
+            (thread_pool_size)
             (genesis)
             (wasm_runtime)
             (resource_greylist)
@@ -95,6 +95,7 @@ namespace eosio { namespace chain {
     *   |- resource_limit_exception
     *   |- mongo_db_exception
     *   |- contract_api_exception
+    *   |- snapshot_exception
     */
 
     FC_DECLARE_DERIVED_EXCEPTION( chain_type_exception, chain_exception,
@@ -504,4 +505,11 @@ namespace eosio { namespace chain {
                                     3230002, "Database API Exception" )
       FC_DECLARE_DERIVED_EXCEPTION( arithmetic_exception,   contract_api_exception,
                                     3230003, "Arithmetic Exception" )
+
+   FC_DECLARE_DERIVED_EXCEPTION( snapshot_exception,    chain_exception,
+                                 3240000, "Snapshot exception" )
+      FC_DECLARE_DERIVED_EXCEPTION( snapshot_unsupported_version, snapshot_exception,
+                                    3240001, "Unsupported version of snapshot" )
+      FC_DECLARE_DERIVED_EXCEPTION( snapshot_validation_exception, snapshot_exception,
+                                    3240002, "Snapshot validation exception" )
 } } // eosio::chain
@@ -18,6 +18,11 @@ namespace eosio { namespace chain {
     * database tracks the longest chain and the last irreversible block number. All
     * blocks older than the last irreversible block are freed after emitting the
     * irreversible signal.
+    *
+    * Every change is appended to a journal in the state directory as soon as it is made, and the journal
+    * is replayed on startup, so the fork database survives a node that was killed. Once the journal has
+    * grown to twice its size after the last compaction, it is rewritten from the block states that were
+    * not pruned since.
     */
    class fork_database {
       public:
@@ -27,6 +32,9 @@ namespace eosio { namespace chain {
 
          void close();
 
+         /// rewrites the journal as the current block states only
+         void compact();
+
          block_state_ptr  get_block(const block_id_type& id)const;
          block_state_ptr  get_block_in_current_chain_by_num( uint32_t n )const;
 //         vector<block_state_ptr>    get_blocks_by_number(uint32_t n)const;
@@ -72,6 +80,10 @@ namespace eosio { namespace chain {
 
       private:
          void set_bft_irreversible( block_id_type id );
+         /// false if there is no journal to replay
+         bool replay_journal();
+         void replay_record( uint8_t op, fc::datastream<const char*>& ds );
+
          unique_ptr<fork_database_impl> my;
    };
 
@@ -0,0 +1,55 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+#include <eosio/chain/types.hpp>
+#include <eosio/chain/chain_id_type.hpp>
+#include <eosio/chain/config.hpp>
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace eosio { namespace chain {
+
+   /**
+    *  Keys recovered from the signatures of transactions, so that a transaction seen again, e.g. retried after a
+    *  fork switch or validated in a block after it was received on its own, is not recovered a second time.
+    *
+    *  Keyed by the digest of the packed transaction including its signatures, since the transaction id does not
+    *  cover them. Bounded, the least recently used entries are dropped first. Safe to use from several threads.
+    */
+   class signature_recovery_cache {
+      public:
+         explicit signature_recovery_cache( size_t max_entries = config::default_sig_cache_size ) : max_entries(max_entries) {}
+
+         optional<flat_set<public_key_type>> find( const digest_type& signed_id, const chain_id_type& chain_id );
+         void insert( const digest_type& signed_id, const chain_id_type& chain_id, const flat_set<public_key_type>& keys );
+
+         struct stats_type {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t entries = 0;
+         };
+         stats_type stats()const;
+
+      private:
+         struct entry {
+            digest_type               signed_id;
+            chain_id_type             chain_id;
+            flat_set<public_key_type> keys;
+         };
+         using lru_list = std::list<entry>; ///< most recently used first
+
+         const size_t                                               max_entries;
+         mutable std::mutex                                         mtx;
+         lru_list                                                   lru;
+         std::unordered_map<digest_type, lru_list::iterator>        index;
+         uint64_t                                                   hits = 0;
+         uint64_t                                                   misses = 0;
+   };
+
+} }  /// eosio::chain
+
+FC_REFLECT( eosio::chain::signature_recovery_cache::stats_type, (hits)(misses)(entries) )
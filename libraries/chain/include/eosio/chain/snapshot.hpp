@@ -0,0 +1,70 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+#include <eosio/chain/block_state.hpp>
+#include <eosio/chain/genesis_state.hpp>
+#include <chainbase/chainbase.hpp>
+#include <fc/filesystem.hpp>
+
+namespace eosio { namespace chain {
+
+   /* A snapshot is a copy of the chain state as of one block that does not depend on the build or the
+    * shared memory layout that wrote it, so a node can start from it instead of replaying the block log.
+    *
+    * +--------+---------------+-----------+-----------+-----+-----------+
+    * | Header | Section table | Section 1 | Section 2 | ... | Section N |
+    * +--------+---------------+-----------+-----------+-----+-----------+
+    *
+    * The header holds the genesis state, which gives the chain id, and the head block state with its
+    * block. Each section holds the rows of one chainbase index in id order, each row being its fields
+    * packed one after the other, and the table records where every section starts, how many rows it has
+    * and the sha256 of its bytes. Sections are written and read by separate threads, a section per index.
+    *
+    * The reversible blocks database is not part of a snapshot, a node started from one has the snapshot
+    * block as its last irreversible block and the first block of its block log.
+    */
+
+   struct snapshot_section {
+      string        name;
+      uint64_t      row_count = 0;
+      uint64_t      offset = 0;   ///< from the start of the file
+      uint64_t      size = 0;
+      fc::sha256    checksum;     ///< of the `size` bytes at `offset`
+   };
+
+   struct snapshot_header {
+      uint32_t                  magic = 0;
+      uint32_t                  version = 0;
+      genesis_state             genesis;
+      block_state               head;
+      vector<snapshot_section>  sections;
+   };
+
+   class snapshot {
+      public:
+         static const uint32_t magic_number;
+         static const uint32_t supported_version;
+
+         /**
+          * Writes `db`, whose state must be as of `head`, to `file` with up to `threads` threads. The
+          * file only appears once it is complete.
+          */
+         static void write( const fc::path& file, const chainbase::database& db, const genesis_state& genesis,
+                            const block_state& head, unsigned threads );
+
+         /// reads and checks the header alone, to learn which chain and block a snapshot is of
+         static snapshot_header read_header( const fc::path& file );
+
+         /**
+          * Checks every section of `file` and fills `db` from it with up to `threads` threads. The indices
+          * of `db` must have been added and be empty, and undo must not be enabled.
+          */
+         static snapshot_header read( const fc::path& file, chainbase::database& db, unsigned threads );
+   };
+
+} }
+
+FC_REFLECT( eosio::chain::snapshot_section, (name)(row_count)(offset)(size)(checksum) )
+FC_REFLECT( eosio::chain::snapshot_header, (magic)(version)(genesis)(head)(sections) )
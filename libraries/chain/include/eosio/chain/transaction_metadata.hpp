@@ -6,6 +6,7 @@
 #include <eosio/chain/transaction.hpp>
 #include <eosio/chain/block.hpp>
 #include <eosio/chain/trace.hpp>
+#include <eosio/chain/signature_recovery_cache.hpp>
 
 namespace eosio { namespace chain {
 
@@ -44,6 +45,19 @@ class transaction_metadata {
          return signing_keys->second;
       }
 
+      /// as above, reusing the keys of an identical transaction recovered before; `cache` is the only cache consulted
+      const flat_set<public_key_type>& recover_keys( const chain_id_type& chain_id, signature_recovery_cache& cache ) {
+         if( !signing_keys || signing_keys->first != chain_id ) {
+            auto keys = cache.find( signed_id, chain_id );
+            if( !keys ) {
+               keys = trx.get_signature_keys( chain_id, false, false );
+               cache.insert( signed_id, chain_id, *keys );
+            }
+            signing_keys = std::make_pair( chain_id, std::move( *keys ));
+         }
+         return signing_keys->second;
+      }
+
       uint32_t total_actions()const { return trx.context_free_actions.size() + trx.actions.size(); }
 };
 
@@ -0,0 +1,45 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/chain/signature_recovery_cache.hpp>
+
+namespace eosio { namespace chain {
+
+   optional<flat_set<public_key_type>> signature_recovery_cache::find( const digest_type& signed_id, const chain_id_type& chain_id ) {
+      std::lock_guard<std::mutex> g( mtx );
+      auto itr = index.find( signed_id );
+      if( itr == index.end() || itr->second->chain_id != chain_id ) {
+         ++misses;
+         return optional<flat_set<public_key_type>>();
+      }
+      lru.splice( lru.begin(), lru, itr->second );
+      ++hits;
+      return itr->second->keys;
+   }
+
+   void signature_recovery_cache::insert( const digest_type& signed_id, const chain_id_type& chain_id, const flat_set<public_key_type>& keys ) {
+      if( max_entries == 0 )
+         return;
+      std::lock_guard<std::mutex> g( mtx );
+      auto itr = index.find( signed_id );
+      if( itr != index.end() ) {
+         itr->second->chain_id = chain_id;
+         itr->second->keys = keys;
+         lru.splice( lru.begin(), lru, itr->second );
+         return;
+      }
+      lru.push_front( entry{ signed_id, chain_id, keys } );
+      index.emplace( signed_id, lru.begin() );
+      if( lru.size() > max_entries ) {
+         index.erase( lru.back().signed_id );
+         lru.pop_back();
+      }
+   }
+
+   signature_recovery_cache::stats_type signature_recovery_cache::stats()const {
+      std::lock_guard<std::mutex> g( mtx );
+      return stats_type{ hits, misses, lru.size() };
+   }
+
+} }  /// eosio::chain
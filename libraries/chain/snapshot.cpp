@@ -0,0 +1,442 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/chain/snapshot.hpp>
+#include <eosio/chain/exceptions.hpp>
+#include <eosio/chain/account_object.hpp>
+#include <eosio/chain/contract_table_objects.hpp>
+#include <eosio/chain/global_property_object.hpp>
+#include <eosio/chain/block_summary_object.hpp>
+#include <eosio/chain/transaction_object.hpp>
+#include <eosio/chain/generated_transaction_object.hpp>
+#include <eosio/chain/permission_object.hpp>
+#include <eosio/chain/permission_link_object.hpp>
+#include <eosio/chain/resource_limits.hpp>
+#include <eosio/chain/resource_limits_private.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <fc/io/raw.hpp>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/preprocessor/seq/for_each.hpp>
+
+namespace eosio { namespace chain {
+
+   const uint32_t snapshot::magic_number = 0x50414e53; ///< "SNAP" as it appears in the file
+   const uint32_t snapshot::supported_version = 1;
+
+   namespace detail {
+      using namespace resource_limits;
+
+      /* Rows are packed field by field rather than as the objects are laid out in shared memory, and the
+       * shared memory types are packed as their ordinary counterparts, so that a snapshot can be read by
+       * a build whose allocator or object layout differs from the one that wrote it.
+       */
+
+      template<typename DataStream, typename T>
+      void pack_field( DataStream& ds, const T& v ) { fc::raw::pack( ds, v ); }
+      template<typename DataStream, typename T>
+      void unpack_field( DataStream& ds, T& v ) { fc::raw::unpack( ds, v ); }
+
+      template<typename DataStream, typename T>
+      void pack_field( DataStream& ds, const chainbase::oid<T>& v ) { fc::raw::pack( ds, v._id ); }
+      template<typename DataStream, typename T>
+      void unpack_field( DataStream& ds, chainbase::oid<T>& v ) { fc::raw::unpack( ds, v._id ); }
+
+      template<typename DataStream>
+      void pack_field( DataStream& ds, const shared_string& v ) {
+         fc::raw::pack( ds, fc::unsigned_int( v.size() ) );
+         if( v.size() )
+            ds.write( v.data(), v.size() );
+      }
+      template<typename DataStream>
+      void unpack_field( DataStream& ds, shared_string& v ) {
+         fc::unsigned_int size;
+         fc::raw::unpack( ds, size );
+         v.resize( size.value );
+         if( size.value )
+            ds.read( &v[0], size.value );
+      }
+
+      template<typename DataStream>
+      void pack_field( DataStream& ds, const shared_authority& v ) { fc::raw::pack( ds, v.to_authority() ); }
+      template<typename DataStream>
+      void unpack_field( DataStream& ds, shared_authority& v ) {
+         authority a;
+         fc::raw::unpack( ds, a );
+         v = a;
+      }
+
+      template<typename DataStream>
+      void pack_field( DataStream& ds, const shared_producer_schedule_type& v ) {
+         fc::raw::pack( ds, producer_schedule_type( v ) );
+      }
+      template<typename DataStream>
+      void unpack_field( DataStream& ds, shared_producer_schedule_type& v ) {
+         producer_schedule_type s;
+         fc::raw::unpack( ds, s );
+         v = s;
+      }
+
+      /// fixed size keys, in the byte order of the node as every integer fc::raw packs
+      template<typename DataStream, typename T>
+      void pack_bytes( DataStream& ds, const T& v ) { ds.write( (const char*)&v, sizeof(v) ); }
+      template<typename DataStream, typename T>
+      void unpack_bytes( DataStream& ds, T& v ) { ds.read( (char*)&v, sizeof(v) ); }
+
+      template<typename DataStream>
+      void pack_field( DataStream& ds, const uint128_t& v ) { pack_bytes( ds, v ); }
+      template<typename DataStream>
+      void unpack_field( DataStream& ds, uint128_t& v ) { unpack_bytes( ds, v ); }
+
+      template<typename DataStream>
+      void pack_field( DataStream& ds, const key256_t& v ) { pack_bytes( ds, v[0] ); pack_bytes( ds, v[1] ); }
+      template<typename DataStream>
+      void unpack_field( DataStream& ds, key256_t& v ) { unpack_bytes( ds, v[0] ); unpack_bytes( ds, v[1] ); }
+
+      template<typename DataStream>
+      void pack_field( DataStream& ds, const float64_t& v ) { pack_bytes( ds, v.v ); }
+      template<typename DataStream>
+      void unpack_field( DataStream& ds, float64_t& v ) { unpack_bytes( ds, v.v ); }
+
+      template<typename DataStream>
+      void pack_field( DataStream& ds, const float128_t& v ) { pack_bytes( ds, v.v[0] ); pack_bytes( ds, v.v[1] ); }
+      template<typename DataStream>
+      void unpack_field( DataStream& ds, float128_t& v ) { unpack_bytes( ds, v.v[0] ); unpack_bytes( ds, v.v[1] ); }
+
+#define SNAPSHOT_PACK_FIELD( r, obj, field )   pack_field( ds, obj.field );
+#define SNAPSHOT_UNPACK_FIELD( r, obj, field ) unpack_field( ds, obj.field );
+
+/// the fields of TYPE that make up its row, types used by later rows have to come first
+#define SNAPSHOT_ROW( TYPE, FIELDS ) \
+      template<typename DataStream> \
+      void pack_field( DataStream& ds, const TYPE& o ) { BOOST_PP_SEQ_FOR_EACH( SNAPSHOT_PACK_FIELD, o, FIELDS ) } \
+      template<typename DataStream> \
+      void unpack_field( DataStream& ds, TYPE& o ) { BOOST_PP_SEQ_FOR_EACH( SNAPSHOT_UNPACK_FIELD, o, FIELDS ) }
+
+      SNAPSHOT_ROW( ratio, (numerator)(denominator) )
+      SNAPSHOT_ROW( elastic_limit_parameters, (target)(max)(periods)(max_multiplier)(contract_rate)(expand_rate) )
+      SNAPSHOT_ROW( usage_accumulator, (last_ordinal)(value_ex)(consumed) )
+
+      SNAPSHOT_ROW( account_object, (id)(name)(vm_type)(vm_version)(privileged)(last_code_update)(code_version)
+                                    (creation_date)(code)(abi) )
+      SNAPSHOT_ROW( account_sequence_object, (id)(name)(recv_sequence)(auth_sequence)(code_sequence)(abi_sequence) )
+
+      SNAPSHOT_ROW( table_id_object, (id)(code)(scope)(table)(payer)(count) )
+      SNAPSHOT_ROW( key_value_object, (id)(t_id)(primary_key)(payer)(value) )
+      SNAPSHOT_ROW( index64_object, (id)(t_id)(primary_key)(payer)(secondary_key) )
+      SNAPSHOT_ROW( index128_object, (id)(t_id)(primary_key)(payer)(secondary_key) )
+      SNAPSHOT_ROW( index256_object, (id)(t_id)(primary_key)(payer)(secondary_key) )
+      SNAPSHOT_ROW( index_double_object, (id)(t_id)(primary_key)(payer)(secondary_key) )
+      SNAPSHOT_ROW( index_long_double_object, (id)(t_id)(primary_key)(payer)(secondary_key) )
+
+      SNAPSHOT_ROW( global_property_object, (id)(proposed_schedule_block_num)(proposed_schedule)(configuration) )
+      SNAPSHOT_ROW( dynamic_global_property_object, (id)(global_action_sequence) )
+      SNAPSHOT_ROW( block_summary_object, (id)(block_id) )
+      SNAPSHOT_ROW( transaction_object, (id)(expiration)(trx_id) )
+      SNAPSHOT_ROW( generated_transaction_object, (id)(trx_id)(sender)(sender_id)(payer)(delay_until)(expiration)
+                                                  (published)(packed_trx) )
+
+      SNAPSHOT_ROW( permission_object, (id)(usage_id)(parent)(owner)(name)(last_updated)(auth) )
+      SNAPSHOT_ROW( permission_usage_object, (id)(last_used) )
+      SNAPSHOT_ROW( permission_link_object, (id)(account)(code)(message_type)(required_permission) )
+
+      SNAPSHOT_ROW( resource_limits_object, (id)(owner)(pending)(net_weight)(cpu_weight)(ram_bytes) )
+      SNAPSHOT_ROW( resource_usage_object, (id)(owner)(net_usage)(cpu_usage)(ram_usage) )
+      SNAPSHOT_ROW( resource_limits_config_object, (id)(cpu_limit_parameters)(net_limit_parameters)
+                                                   (account_cpu_usage_average_window)(account_net_usage_average_window) )
+      SNAPSHOT_ROW( resource_limits_state_object, (id)(average_block_net_usage)(average_block_cpu_usage)
+                                                  (pending_net_usage)(pending_cpu_usage)(total_net_weight)
+                                                  (total_cpu_weight)(total_ram_bytes)(virtual_net_limit)
+                                                  (virtual_cpu_limit) )
+
+#undef SNAPSHOT_ROW
+#undef SNAPSHOT_UNPACK_FIELD
+#undef SNAPSHOT_PACK_FIELD
+
+      /// the file a section is written to before the sections are put together, hashing what goes through
+      struct section_file {
+         explicit section_file( const fc::path& f )
+         :file(f), out( f.generic_string().c_str(), std::ios::out | std::ios::binary | std::ios::trunc ) {
+            EOS_ASSERT( out, snapshot_exception, "Cannot create ${f}", ("f", file) );
+         }
+
+         bool write( const char* d, size_t s ) {
+            out.write( d, s );
+            hash.write( d, s );
+            size += s;
+            return true;
+         }
+         bool put( char c ) { return write( &c, 1 ); }
+
+         fc::path              file;
+         std::ofstream         out;
+         fc::sha256::encoder   hash;
+         uint64_t              size = 0;
+      };
+
+      struct section_handler {
+         string                                                               name;
+         std::function<uint64_t( const chainbase::database& )>                row_count;
+         std::function<uint64_t( const chainbase::database&, section_file& )> write; ///< returns the rows written
+         std::function<void( chainbase::database&, fc::datastream<const char*>&, uint64_t )> read;
+      };
+
+      template<typename Index>
+      section_handler make_section( const string& name ) {
+         using object_type = typename Index::value_type;
+         section_handler h;
+         h.name = name;
+         h.row_count = []( const chainbase::database& db ) -> uint64_t {
+            return db.get_index<Index>().indices().size();
+         };
+         h.write = []( const chainbase::database& db, section_file& out ) {
+            const auto& rows = db.get_index<Index, by_id>();
+            uint64_t count = 0;
+            for( const auto& row : rows ) {
+               pack_field( out, row );
+               ++count;
+            }
+            return count;
+         };
+         h.read = []( chainbase::database& db, fc::datastream<const char*>& ds, uint64_t row_count ) {
+            for( uint64_t i = 0; i < row_count; ++i ) {
+               db.create<object_type>( [&]( object_type& row ) {
+                  unpack_field( ds, row );
+               });
+            }
+         };
+         return h;
+      }
+
+      /// every index of the state database, in the order controller_impl::add_indices adds them
+      static const vector<section_handler>& sections() {
+         static const vector<section_handler> handlers = {
+            make_section<account_index>( "account" ),
+            make_section<account_sequence_index>( "account_sequence" ),
+            make_section<table_id_multi_index>( "table_id" ),
+            make_section<key_value_index>( "key_value" ),
+            make_section<index64_index>( "index64" ),
+            make_section<index128_index>( "index128" ),
+            make_section<index256_index>( "index256" ),
+            make_section<index_double_index>( "index_double" ),
+            make_section<index_long_double_index>( "index_long_double" ),
+            make_section<global_property_multi_index>( "global_property" ),
+            make_section<dynamic_global_property_multi_index>( "dynamic_global_property" ),
+            make_section<block_summary_multi_index>( "block_summary" ),
+            make_section<transaction_multi_index>( "transaction" ),
+            make_section<generated_transaction_multi_index>( "generated_transaction" ),
+            make_section<permission_index>( "permission" ),
+            make_section<permission_usage_index>( "permission_usage" ),
+            make_section<permission_link_index>( "permission_link" ),
+            make_section<resource_limits_index>( "resource_limits" ),
+            make_section<resource_usage_index>( "resource_usage" ),
+            make_section<resource_limits_state_index>( "resource_limits_state" ),
+            make_section<resource_limits_config_index>( "resource_limits_config" )
+         };
+         return handlers;
+      }
+
+      /**
+       * Calls `work` for every entry of `order`, in that order, on up to `threads` threads. The first
+       * exception thrown is rethrown once every thread has stopped.
+       */
+      static void run_parallel( const vector<size_t>& order, unsigned threads, const std::function<void( size_t )>& work ) {
+         std::atomic<size_t>  next{0};
+         std::atomic<bool>    failed{false};
+         std::exception_ptr   error;
+         std::mutex           error_mutex;
+
+         vector<std::thread> workers;
+         for( unsigned t = 0; t < std::max(1u, threads) && t < order.size(); ++t ) {
+            workers.emplace_back( [&]() {
+               for( size_t i = next++; i < order.size() && !failed; i = next++ ) {
+                  try {
+                     work( order[i] );
+                  } catch( ... ) {
+                     std::lock_guard<std::mutex> g( error_mutex );
+                     if( !error )
+                        error = std::current_exception();
+                     failed = true;
+                  }
+               }
+            });
+         }
+         for( auto& w : workers )
+            w.join();
+         if( error )
+            std::rethrow_exception( error );
+      }
+
+      static fc::sha256 hash_bytes( const char* data, uint64_t size ) {
+         fc::sha256::encoder e;
+         const uint64_t step = 1u << 30; // the encoder takes 32 bit lengths
+         for( uint64_t pos = 0; pos < size; pos += step )
+            e.write( data + pos, std::min(step, size - pos) );
+         return e.result();
+      }
+
+      static void check_header( const snapshot_header& h, const fc::path& file ) {
+         EOS_ASSERT( h.magic == snapshot::magic_number, snapshot_validation_exception,
+                     "${f} is not a snapshot", ("f", file) );
+         EOS_ASSERT( h.version > 0 && h.version <= snapshot::supported_version, snapshot_unsupported_version,
+                     "Unsupported version of snapshot. Snapshot version is ${version} while code supports version ${supported}",
+                     ("version", h.version)("supported", snapshot::supported_version) );
+         EOS_ASSERT( h.head.block && h.head.block->id() == h.head.id, snapshot_validation_exception,
+                     "Head block of ${f} does not match its block state", ("f", file) );
+      }
+   }
+
+   void snapshot::write( const fc::path& file, const chainbase::database& db, const genesis_state& genesis,
+                         const block_state& head, unsigned threads ) {
+      const auto& handlers = detail::sections();
+      vector<snapshot_section> sections( handlers.size() );
+      vector<fc::path> parts( handlers.size() );
+      for( size_t i = 0; i < handlers.size(); ++i )
+         parts[i] = file.generic_string() + "." + handlers[i].name + ".tmp";
+
+      auto remove_parts = [&]() {
+         for( const auto& p : parts )
+            fc::remove( p );
+      };
+
+      auto start = fc::time_point::now();
+      try {
+         vector<size_t> order( handlers.size() );
+         for( size_t i = 0; i < order.size(); ++i )
+            order[i] = i;
+         // the biggest indices take longest, start on them first
+         vector<uint64_t> rows( handlers.size() );
+         for( size_t i = 0; i < rows.size(); ++i )
+            rows[i] = handlers[i].row_count( db );
+         std::stable_sort( order.begin(), order.end(), [&]( size_t a, size_t b ) { return rows[a] > rows[b]; } );
+
+         detail::run_parallel( order, threads, [&]( size_t i ) {
+            detail::section_file out( parts[i] );
+            auto& s = sections[i];
+            s.name = handlers[i].name;
+            s.row_count = handlers[i].write( db, out );
+            out.out.close();
+            EOS_ASSERT( !out.out.fail(), snapshot_exception, "Cannot write ${f}", ("f", parts[i]) );
+            s.size = out.size;
+            s.checksum = out.hash.result();
+         });
+
+         snapshot_header h;
+         h.magic = magic_number;
+         h.version = supported_version;
+         h.genesis = genesis;
+         h.head = head;
+         h.sections = sections;
+         // offsets are fixed size, so the header is as long with them as without
+         uint64_t offset = fc::raw::pack_size( h );
+         for( auto& s : h.sections ) {
+            s.offset = offset;
+            offset += s.size;
+         }
+
+         fc::path tmp = file.generic_string() + ".tmp";
+         {
+            std::ofstream out( tmp.generic_string().c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+            EOS_ASSERT( out, snapshot_exception, "Cannot create ${f}", ("f", tmp) );
+            auto data = fc::raw::pack( h );
+            out.write( data.data(), data.size() );
+            for( const auto& p : parts ) {
+               std::ifstream in( p.generic_string().c_str(), std::ios::in | std::ios::binary );
+               if( in.peek() != std::ifstream::traits_type::eof() )
+                  out << in.rdbuf();
+            }
+            out.close();
+            EOS_ASSERT( !out.fail() && uint64_t(fc::file_size( tmp )) == offset, snapshot_exception,
+                        "Cannot write ${f}", ("f", tmp) );
+         }
+         remove_parts();
+         fc::rename( tmp, file );
+      } catch( ... ) {
+         remove_parts();
+         throw;
+      }
+
+      ilog( "Wrote snapshot of block ${n} to ${f} in ${ms} ms",
+            ("n", head.block_num)("f", file)("ms", (fc::time_point::now() - start).count() / 1000) );
+   }
+
+   snapshot_header snapshot::read_header( const fc::path& file ) {
+      std::ifstream in( file.generic_string().c_str(), std::ios::in | std::ios::binary );
+      EOS_ASSERT( in, snapshot_exception, "Cannot open ${f}", ("f", file) );
+      snapshot_header h;
+      fc::raw::unpack( in, h.magic );
+      EOS_ASSERT( in && h.magic == magic_number, snapshot_validation_exception, "${f} is not a snapshot", ("f", file) );
+      fc::raw::unpack( in, h.version );
+      fc::raw::unpack( in, h.genesis );
+      fc::raw::unpack( in, h.head );
+      fc::raw::unpack( in, h.sections );
+      detail::check_header( h, file );
+      return h;
+   }
+
+   snapshot_header snapshot::read( const fc::path& file, chainbase::database& db, unsigned threads ) {
+      namespace bip = boost::interprocess;
+      auto start = fc::time_point::now();
+
+      auto h = read_header( file );
+      const uint64_t file_size = fc::file_size( file );
+      bip::mapped_region region;
+      if( file_size ) {
+         bip::file_mapping mapping( file.generic_string().c_str(), bip::read_only );
+         region = bip::mapped_region( mapping, bip::read_only );
+      }
+      auto base = static_cast<const char*>( region.get_address() );
+
+      const auto& handlers = detail::sections();
+      vector<size_t> found( handlers.size(), h.sections.size() );
+      for( size_t i = 0; i < h.sections.size(); ++i ) {
+         const auto& s = h.sections[i];
+         auto itr = std::find_if( handlers.begin(), handlers.end(), [&]( const auto& handler ) { return handler.name == s.name; } );
+         EOS_ASSERT( itr != handlers.end(), snapshot_validation_exception, "Unknown section ${s} in ${f}", ("s", s.name)("f", file) );
+         auto& f = found[itr - handlers.begin()];
+         EOS_ASSERT( f == h.sections.size(), snapshot_validation_exception, "Section ${s} repeated in ${f}", ("s", s.name)("f", file) );
+         EOS_ASSERT( s.offset <= file_size && s.size <= file_size - s.offset, snapshot_validation_exception,
+                     "Section ${s} runs past the end of ${f}", ("s", s.name)("f", file) );
+         f = i;
+      }
+      for( size_t i = 0; i < handlers.size(); ++i )
+         EOS_ASSERT( found[i] < h.sections.size(), snapshot_validation_exception,
+                     "Section ${s} is missing from ${f}", ("s", handlers[i].name)("f", file) );
+
+      vector<size_t> order( handlers.size() );
+      for( size_t i = 0; i < order.size(); ++i )
+         order[i] = i;
+      std::stable_sort( order.begin(), order.end(), [&]( size_t a, size_t b ) {
+         return h.sections[found[a]].size > h.sections[found[b]].size;
+      });
+
+      // nothing goes into the database until every section is known to be intact
+      detail::run_parallel( order, threads, [&]( size_t i ) {
+         const auto& s = h.sections[found[i]];
+         EOS_ASSERT( detail::hash_bytes( base + s.offset, s.size ) == s.checksum, snapshot_validation_exception,
+                     "Section ${s} of ${f} does not match its checksum", ("s", s.name)("f", file) );
+      });
+
+      // each section fills its own index, the segment manager serializes the allocations they make
+      detail::run_parallel( order, threads, [&]( size_t i ) {
+         const auto& s = h.sections[found[i]];
+         fc::datastream<const char*> ds( base + s.offset, s.size );
+         handlers[i].read( db, ds, s.row_count );
+         EOS_ASSERT( ds.remaining() == 0, snapshot_validation_exception,
+                     "Section ${s} of ${f} has ${n} bytes past its rows", ("s", s.name)("f", file)("n", ds.remaining()) );
+      });
+
+      ilog( "Read snapshot of block ${n} from ${f} in ${ms} ms",
+            ("n", h.head.block_num)("f", file)("ms", (fc::time_point::now() - start).count() / 1000) );
+      return h;
+   }
+
+} } /// eosio::chain
@@ -6,6 +6,7 @@
 #include <fc/bitutil.hpp>
 #include <fc/smart_ref_impl.hpp>
 #include <algorithm>
+#include <mutex>
 
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/multi_index_container.hpp>
@@ -88,21 +89,28 @@ flat_set<public_key_type> transaction::get_signature_keys( const vector<signatur
 
    constexpr size_t recovery_cache_size = 1000;
    static recovery_cache_type recovery_cache;
+   static std::mutex recovery_cache_mutex; ///< transactions are also recovered on the controller's thread pool
    const digest_type digest = sig_digest(chain_id, cfd);
+   const transaction_id_type trx_id = use_cache ? id() : transaction_id_type();
 
    flat_set<public_key_type> recovered_pub_keys;
    for(const signature_type& sig : signatures) {
       public_key_type recov;
+      bool cached = false;
       if( use_cache ) {
+         std::lock_guard<std::mutex> g( recovery_cache_mutex );
          recovery_cache_type::index<by_sig>::type::iterator it = recovery_cache.get<by_sig>().find( sig );
-         if( it == recovery_cache.get<by_sig>().end() || it->trx_id != id()) {
-            recov = public_key_type( sig, digest );
-            recovery_cache.emplace_back(cached_pub_key{id(), recov, sig} ); //could fail on dup signatures; not a problem
-         } else {
+         if( it != recovery_cache.get<by_sig>().end() && it->trx_id == trx_id ) {
             recov = it->pub_key;
+            cached = true;
+         }
+      }
+      if( !cached ) {
+         recov = public_key_type( sig, digest ); // outside the lock, so that threads recover in parallel
+         if( use_cache ) {
+            std::lock_guard<std::mutex> g( recovery_cache_mutex );
+            recovery_cache.emplace_back(cached_pub_key{trx_id, recov, sig} ); //could fail on dup signatures; not a problem
          }
-      } else {
-         recov = public_key_type( sig, digest );
       }
       bool successful_insertion = false;
       std::tie(std::ignore, successful_insertion) = recovered_pub_keys.insert(recov);
@@ -113,6 +121,7 @@ flat_set<public_key_type> transaction::get_signature_keys( const vector<signatur
    }
 
    if( use_cache ) {
+      std::lock_guard<std::mutex> g( recovery_cache_mutex );
       while ( recovery_cache.size() > recovery_cache_size )
          recovery_cache.erase( recovery_cache.begin() );
    }
@@ -201,7 +201,8 @@ namespace chainbase {
 
          /**
           * Construct a new element in the multi_index_container.
-          * Set the ID to the next available ID, then increment _next_id and fire off on_create().
+          * Set the ID to the next available ID, then move _next_id past the ID the object ended up with and
+          * fire off on_create().
           */
          template<typename Constructor>
          const value_type& emplace( Constructor&& c ) {
@@ -218,7 +219,11 @@ namespace chainbase {
                BOOST_THROW_EXCEPTION( std::logic_error("could not insert object, most likely a uniqueness constraint was violated") );
             }
 
-            ++_next_id;
+            // the constructor may give the object an id of its own, as restoring a snapshot does
+            if( !(insert_result.first->id < _next_id) ) {
+               _next_id = insert_result.first->id;
+               ++_next_id;
+            }
             on_create( *insert_result.first );
             return *insert_result.first;
          }
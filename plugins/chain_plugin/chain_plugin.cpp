@@ -5,6 +5,7 @@
 #include <eosio/chain_plugin/chain_plugin.hpp>
 #include <eosio/chain/fork_database.hpp>
 #include <eosio/chain/block_log.hpp>
+#include <eosio/chain/snapshot.hpp>
 #include <eosio/chain/exceptions.hpp>
 #include <eosio/chain/authorization_manager.hpp>
 #include <eosio/chain/producer_object.hpp>
@@ -156,6 +157,8 @@ public:
    {}
 
    bfs::path                        blocks_dir;
+   bfs::path                        snapshots_dir;
+   std::set<uint32_t>               snapshot_blocks; ///< a snapshot is written when each of these is accepted
    bool                             readonly = false;
    flat_map<uint32_t,block_id_type> loaded_checkpoints;
 
@@ -168,6 +171,8 @@ public:
    fc::optional<vm_type>            wasm_runtime;
    fc::microseconds                 abi_serializer_max_time_ms;
 
+   void write_snapshot( const block_state_ptr& blk );
+
 
    // retained references to channels for easy publication
    channels::pre_accepted_block::channel_type&     pre_accepted_block_channel;
@@ -205,6 +210,16 @@ public:
 
 };
 
+void chain_plugin_impl::write_snapshot( const block_state_ptr& blk ) {
+   try {
+      if( !fc::is_directory( snapshots_dir ))
+         fc::create_directories( snapshots_dir );
+      // a block may be accepted again on another fork, the id keeps their snapshots apart
+      auto file = snapshots_dir / ("snapshot-" + std::to_string( blk->block_num ) + "-" + blk->id.str() + ".bin");
+      chain->write_snapshot( file );
+   } FC_LOG_AND_DROP()
+}
+
 chain_plugin::chain_plugin()
 :my(new chain_plugin_impl()) {
 }
@@ -216,6 +231,18 @@ void chain_plugin::set_program_options(options_description& cli, options_descrip
    cfg.add_options()
          ("blocks-dir", bpo::value<bfs::path>()->default_value("blocks"),
           "the location of the blocks directory (absolute path or relative to application data dir)")
+         ("blocks-log-stride", bpo::value<uint32_t>()->default_value(0),
+          "split the block log into files of this many blocks, moving full ones to the blocks-retained-dir (0 keeps a single blocks.log)")
+         ("max-retained-block-files", bpo::value<uint32_t>()->default_value(std::numeric_limits<uint32_t>::max()),
+          "the number of newest full block log files kept uncompressed, older ones are compressed or removed")
+         ("max-archived-block-files", bpo::value<uint32_t>()->default_value(0),
+          "the number of block log files kept compressed beyond max-retained-block-files, older ones are removed")
+         ("blocks-retained-dir", bpo::value<bfs::path>()->default_value("retained"),
+          "the location of the full block log files (absolute path or relative to blocks dir), must be on the same file system as blocks-dir")
+         ("snapshots-dir", bpo::value<bfs::path>()->default_value("snapshots"),
+          "the location of the snapshots directory (absolute path or relative to application data dir)")
+         ("snapshot-at-block", bpo::value<vector<uint32_t>>()->composing(),
+          "Write a snapshot of the chain state to the snapshots-dir when this block is accepted (may specify multiple times)")
          ("checkpoint", bpo::value<vector<string>>()->composing(), "Pairs of [BLOCK_NUM,BLOCK_ID] that should be enforced as checkpoints.")
          ("wasm-runtime", bpo::value<eosio::chain::wasm_interface::vm_type>()->value_name("wavm/binaryen"), "Override default WASM runtime")
          ("abi-serializer-max-time-ms", bpo::value<uint32_t>()->default_value(config::default_abi_serializer_max_time_ms),
@@ -224,6 +251,8 @@ void chain_plugin::set_program_options(options_description& cli, options_descrip
          ("chain-state-db-guard-size-mb", bpo::value<uint64_t>()->default_value(config::default_state_guard_size / (1024  * 1024)), "Safely shut down node when free space remaining in the chain state database drops below this size (in MiB).")
          ("reversible-blocks-db-size-mb", bpo::value<uint64_t>()->default_value(config::default_reversible_cache_size / (1024  * 1024)), "Maximum size (in MiB) of the reversible blocks database")
          ("reversible-blocks-db-guard-size-mb", bpo::value<uint64_t>()->default_value(config::default_reversible_guard_size / (1024  * 1024)), "Safely shut down node when free space remaining in the reverseible blocks database drops below this size (in MiB).")
+         ("chain-threads", bpo::value<uint16_t>()->default_value(config::default_controller_thread_pool_size),
+          "Number of worker threads recovering transaction signatures of received blocks ahead of applying them, 0 to recover them on apply")
          ("contracts-console", bpo::bool_switch()->default_value(false),
           "print contract's output to console")
          ("actor-whitelist", boost::program_options::value<vector<string>>()->composing()->multitoken(),
@@ -264,6 +293,8 @@ void chain_plugin::set_program_options(options_description& cli, options_descrip
    cli.add_options()
          ("genesis-json", bpo::value<bfs::path>(), "File to read Genesis State from")
          ("genesis-timestamp", bpo::value<string>(), "override the initial timestamp in the Genesis State file")
+         ("snapshot", bpo::value<bfs::path>(),
+          "File to read the chain state from instead of replaying the blockchain, clears the chain state database and requires that there is no block log")
          ("print-genesis-json", bpo::bool_switch()->default_value(false),
           "extract genesis_state from blocks.log as JSON, print to console, and exit")
          ("extract-genesis-json", bpo::value<bfs::path>(),
@@ -363,6 +394,19 @@ void chain_plugin::plugin_initialize(const variables_map& options) {
             my->blocks_dir = bld;
       }
 
+      if( options.count( "snapshots-dir" )) {
+         auto sd = options.at( "snapshots-dir" ).as<bfs::path>();
+         if( sd.is_relative())
+            my->snapshots_dir = app().data_dir() / sd;
+         else
+            my->snapshots_dir = sd;
+      }
+
+      if( options.count( "snapshot-at-block" )) {
+         const auto& blocks = options.at( "snapshot-at-block" ).as<vector<uint32_t>>();
+         my->snapshot_blocks.insert( blocks.begin(), blocks.end());
+      }
+
       if( options.count("checkpoint") ) {
          auto cps = options.at("checkpoint").as<vector<string>>();
          my->loaded_checkpoints.reserve(cps.size());
@@ -388,9 +432,15 @@ void chain_plugin::plugin_initialize(const variables_map& options) {
          my->abi_serializer_max_time_ms = fc::microseconds(options.at("abi-serializer-max-time-ms").as<uint32_t>() * 1000);
 
       my->chain_config->blocks_dir = my->blocks_dir;
+      my->chain_config->blocks_log_stride = options.at( "blocks-log-stride" ).as<uint32_t>();
+      my->chain_config->max_retained_block_files = options.at( "max-retained-block-files" ).as<uint32_t>();
+      my->chain_config->max_archived_block_files = options.at( "max-archived-block-files" ).as<uint32_t>();
+      my->chain_config->blocks_retained_dir = options.at( "blocks-retained-dir" ).as<bfs::path>();
       my->chain_config->state_dir = app().data_dir() / config::default_state_dir_name;
       my->chain_config->read_only = my->readonly;
 
+      my->chain_config->thread_pool_size = options.at( "chain-threads" ).as<uint16_t>();
+
       if( options.count( "chain-state-db-size-mb" ))
          my->chain_config->state_size = options.at( "chain-state-db-size-mb" ).as<uint64_t>() * 1024 * 1024;
 
@@ -463,7 +513,8 @@ void chain_plugin::plugin_initialize(const variables_map& options) {
       } else if( options.at( "hard-replay-blockchain" ).as<bool>()) {
          ilog( "Hard replay requested: deleting state database" );
          fc::remove_all( my->chain_config->state_dir );
-         auto backup_dir = block_log::repair_log( my->blocks_dir, options.at( "truncate-at-block" ).as<uint32_t>());
+         auto backup_dir = block_log::repair_log( my->blocks_dir, options.at( "truncate-at-block" ).as<uint32_t>(),
+                                                 my->chain_config->blocks_retained_dir );
          if( fc::exists( backup_dir / config::reversible_blocks_dir_name ) ||
              options.at( "fix-reversible-blocks" ).as<bool>()) {
             // Do not try to recover reversible blocks if the directory does not exist, unless the option was explicitly provided.
@@ -518,7 +569,33 @@ void chain_plugin::plugin_initialize(const variables_map& options) {
          wlog("The --import-reversible-blocks option should be used by itself.");
       }
 
-      if( options.count( "genesis-json" )) {
+      if( options.count( "snapshot" )) {
+         EOS_ASSERT( !options.count( "genesis-json" ) && !options.count( "genesis-timestamp" ),
+                     plugin_config_exception,
+                     "--snapshot cannot be used with --genesis-json or --genesis-timestamp, the snapshot holds the genesis state." );
+         EOS_ASSERT( !fc::exists( my->blocks_dir / "blocks.log" ),
+                     plugin_config_exception,
+                     "A snapshot can only be used without a block log, remove it or use --delete-all-blocks." );
+
+         auto snapshot_file = options.at( "snapshot" ).as<bfs::path>();
+         if( snapshot_file.is_relative()) {
+            snapshot_file = bfs::current_path() / snapshot_file;
+         }
+
+         EOS_ASSERT( fc::is_regular_file( snapshot_file ),
+                     plugin_config_exception,
+                    "Specified snapshot file '${snapshot}' does not exist.",
+                    ("snapshot", snapshot_file.generic_string()));
+
+         auto header = snapshot::read_header( snapshot_file );
+         my->chain_config->genesis = header.genesis;
+         my->chain_config->snapshot = snapshot_file;
+
+         ilog( "Deleting state database to start from snapshot of block ${n} in '${snapshot}'",
+               ("n", header.head.block_num)("snapshot", snapshot_file.generic_string()));
+         fc::remove_all( my->chain_config->state_dir );
+         fc::remove_all( my->chain_config->blocks_dir / config::reversible_blocks_dir_name );
+      } else if( options.count( "genesis-json" )) {
          EOS_ASSERT( !fc::exists( my->blocks_dir / "blocks.log" ),
                      plugin_config_exception,
                     "Genesis state can only be set on a fresh blockchain." );
@@ -610,6 +687,8 @@ void chain_plugin::plugin_initialize(const variables_map& options) {
             } );
 
       my->accepted_block_connection = my->chain->accepted_block.connect( [this]( const block_state_ptr& blk ) {
+         if( my->snapshot_blocks.count( blk->block_num ))
+            my->write_snapshot( blk );
          my->accepted_block_channel.publish( blk );
       } );
 
@@ -958,6 +1037,7 @@ read_only::get_info_results read_only::get_info(const read_only::get_info_params
       //std::bitset<64>(db.get_dynamic_global_properties().recent_slots_filled).to_string(),
       //__builtin_popcountll(db.get_dynamic_global_properties().recent_slots_filled) / 64.0,
       app().version_string(),
+      db.get_signature_recovery_cache_stats(),
    };
 }
 
@@ -1188,7 +1268,7 @@ static fc::variant get_global_row( const database& db, const abi_def& abi, const
 read_only::get_producers_result read_only::get_producers( const read_only::get_producers_params& p ) const {
    const abi_def abi = eosio::chain_apis::get_abi(db, config::system_account_name);
    const auto table_type = get_table_type(abi, N(producers));
-   const abi_serializer abis{ abi, abi_serializer_max_time };
+   const auto abis = db.get_cached_abi_serializer( config::system_account_name, abi_serializer_max_time );
    EOS_ASSERT(table_type == KEYi64, chain::contract_table_query_exception, "Invalid table type ${type} for table producers", ("type",table_type));
 
    const auto& d = db.db();
@@ -1227,12 +1307,12 @@ read_only::get_producers_result read_only::get_producers( const read_only::get_p
       }
       copy_inline_row(*kv_index.find(boost::make_tuple(table_id->id, it->primary_key)), data);
       if (p.json)
-         result.rows.emplace_back(abis.binary_to_variant(abis.get_table_type(N(producers)), data, abi_serializer_max_time));
+         result.rows.emplace_back(abis->binary_to_variant(abis->get_table_type(N(producers)), data, abi_serializer_max_time));
       else
          result.rows.emplace_back(fc::variant(data));
    }
 
-   result.total_producer_vote_weight = get_global_row(d, abi, abis, abi_serializer_max_time)["total_producer_vote_weight"].as_double();
+   result.total_producer_vote_weight = get_global_row(d, abi, *abis, abi_serializer_max_time)["total_producer_vote_weight"].as_double();
    return result;
 }
 
@@ -1250,16 +1330,13 @@ read_only::get_producer_schedule_result read_only::get_producer_schedule( const
 template<typename Api>
 struct resolver_factory {
    static auto make(const Api* api, const fc::microseconds& max_serialization_time) {
-      return [api, max_serialization_time](const account_name &name) -> optional<abi_serializer> {
+      return [api, max_serialization_time](const account_name &name) -> std::shared_ptr<const abi_serializer> {
          const auto* accnt = api->db.db().template find<account_object, by_name>(name);
          if (accnt != nullptr) {
-            abi_def abi;
-            if (abi_serializer::to_abi(accnt->abi, abi)) {
-               return abi_serializer(abi, max_serialization_time);
-            }
+            return api->db.get_cached_abi_serializer(name, max_serialization_time);
          }
 
-         return optional<abi_serializer>();
+         return nullptr;
       };
    }
 };
@@ -1562,11 +1639,7 @@ read_only::get_account_results read_only::get_account( const get_account_params&
       ++perm;
    }
 
-   const auto& code_account = db.db().get<account_object,by_name>( config::system_account_name );
-
-   abi_def abi;
-   if( abi_serializer::to_abi(code_account.abi, abi) ) {
-      abi_serializer abis( abi, abi_serializer_max_time );
+   if( auto abis = db.get_cached_abi_serializer( config::system_account_name, abi_serializer_max_time ) ) {
 
       const auto token_code = N(eosio.token);
 
@@ -1592,7 +1665,7 @@ read_only::get_account_results read_only::get_account( const get_account_params&
          if ( it != idx.end() ) {
             vector<char> data;
             copy_inline_row(*it, data);
-            result.total_resources = abis.binary_to_variant( "user_resources", data, abi_serializer_max_time );
+            result.total_resources = abis->binary_to_variant( "user_resources", data, abi_serializer_max_time );
          }
       }
 
@@ -1603,7 +1676,7 @@ read_only::get_account_results read_only::get_account( const get_account_params&
          if ( it != idx.end() ) {
             vector<char> data;
             copy_inline_row(*it, data);
-            result.self_delegated_bandwidth = abis.binary_to_variant( "delegated_bandwidth", data, abi_serializer_max_time );
+            result.self_delegated_bandwidth = abis->binary_to_variant( "delegated_bandwidth", data, abi_serializer_max_time );
          }
       }
 
@@ -1614,7 +1687,7 @@ read_only::get_account_results read_only::get_account( const get_account_params&
          if ( it != idx.end() ) {
             vector<char> data;
             copy_inline_row(*it, data);
-            result.refund_request = abis.binary_to_variant( "refund_request", data, abi_serializer_max_time );
+            result.refund_request = abis->binary_to_variant( "refund_request", data, abi_serializer_max_time );
          }
       }
 
@@ -1625,7 +1698,7 @@ read_only::get_account_results read_only::get_account( const get_account_params&
          if ( it != idx.end() ) {
             vector<char> data;
             copy_inline_row(*it, data);
-            result.voter_info = abis.binary_to_variant( "voter_info", data, abi_serializer_max_time );
+            result.voter_info = abis->binary_to_variant( "voter_info", data, abi_serializer_max_time );
          }
       }
    }
@@ -1645,16 +1718,14 @@ read_only::abi_json_to_bin_result read_only::abi_json_to_bin( const read_only::a
    const auto code_account = db.db().find<account_object,by_name>( params.code );
    EOS_ASSERT(code_account != nullptr, contract_query_exception, "Contract can't be found ${contract}", ("contract", params.code));
 
-   abi_def abi;
-   if( abi_serializer::to_abi(code_account->abi, abi) ) {
-      abi_serializer abis( abi, abi_serializer_max_time );
-      auto action_type = abis.get_action_type(params.action);
+   if( auto abis = db.get_cached_abi_serializer( params.code, abi_serializer_max_time ) ) {
+      auto action_type = abis->get_action_type(params.action);
       EOS_ASSERT(!action_type.empty(), action_validate_exception, "Unknown action ${action} in contract ${contract}", ("action", params.action)("contract", params.code));
       try {
-         result.binargs = abis.variant_to_binary(action_type, params.args, abi_serializer_max_time);
+         result.binargs = abis->variant_to_binary(action_type, params.args, abi_serializer_max_time);
       } EOS_RETHROW_EXCEPTIONS(chain::invalid_action_args_exception,
                                 "'${args}' is invalid args for action '${action}' code '${code}'. expected '${proto}'",
-                                ("args", params.args)("action", params.action)("code", params.code)("proto", action_abi_to_variant(abi, action_type)))
+                                ("args", params.args)("action", params.action)("code", params.code)("proto", action_abi_to_variant(eosio::chain_apis::get_abi(db, params.code), action_type)))
    } else {
       EOS_ASSERT(false, abi_not_found_exception, "No ABI found for ${contract}", ("contract", params.code));
    }
@@ -1664,11 +1735,8 @@ read_only::abi_json_to_bin_result read_only::abi_json_to_bin( const read_only::a
 
 read_only::abi_bin_to_json_result read_only::abi_bin_to_json( const read_only::abi_bin_to_json_params& params )const {
    abi_bin_to_json_result result;
-   const auto& code_account = db.db().get<account_object,by_name>( params.code );
-   abi_def abi;
-   if( abi_serializer::to_abi(code_account.abi, abi) ) {
-      abi_serializer abis( abi, abi_serializer_max_time );
-      result.args = abis.binary_to_variant( abis.get_action_type( params.action ), params.binargs, abi_serializer_max_time );
+   if( auto abis = db.get_cached_abi_serializer( params.code, abi_serializer_max_time ) ) {
+      result.args = abis->binary_to_variant( abis->get_action_type( params.action ), params.binargs, abi_serializer_max_time );
    } else {
       EOS_ASSERT(false, abi_not_found_exception, "No ABI found for ${contract}", ("contract", params.code));
    }
@@ -2,8 +2,10 @@
 
 #include <appbase/application.hpp>
 #include <eosio/chain_plugin/chain_plugin.hpp>
+#include <eosio/eoc_relay_plugin/eoc_relay_plugin.hpp>
 
 #include "icp_relay.hpp"
+#include "table.hpp"
 
 namespace eoc_icp {
 
@@ -35,94 +37,80 @@ packet_receipt_request sequence::make_genproof_request(uint64_t start_packet_seq
    return req;
 }
 
+packet_receipt_range_request sequence::make_genproof_range_request(uint64_t start_packet_seq, uint64_t start_receipt_seq) {
+   packet_receipt_range_request req;
+   if (last_incoming_packet_seq + 1 < start_packet_seq) {
+      req.first_packet_seq = last_incoming_packet_seq + 1;
+      req.end_packet_seq = start_packet_seq;
+   }
+   if (last_incoming_receipt_seq + 1 < start_receipt_seq) {
+      req.first_receipt_seq = last_incoming_receipt_seq + 1;
+      req.end_receipt_seq = start_receipt_seq;
+   }
+   return req;
+}
+
 head_ptr read_only::get_head() const {
-   auto& chain = app().get_plugin<chain_plugin>();
-   auto ro_api = chain.get_read_only_api();
+   auto& controller = app().get_plugin<chain_plugin>().chain();
+   auto& cache = relay_->tables_cache_;
+   if (not cache.valid_for(controller)) cache.reset(controller);
+   if (cache.head) return std::make_shared<head>(*cache.head);
 
-   chain_apis::read_only::get_table_rows_params p;
-   p.json = true;
-   p.code = relay_->local_contract_;
-   p.scope = relay_->local_contract_.to_string();
-   p.table = "blockstate";
-   p.limit = 1;
-   p.key_type = "i128";
-   p.index_position = "5"; // libblocknum
-   auto blockstates = ro_api.get_table_rows(p);
-   if (blockstates.rows.empty()) return nullptr;
+   contract_tables tables(controller, relay_->local_contract_);
+   auto blockstate = tables.get_blockstate();
+   if (not blockstate) return nullptr;
 
-   auto& row = blockstates.rows.front();
    std::shared_ptr<head> h = std::make_shared<head>();
-   h->head_block_num = static_cast<uint32_t>(row["block_num"].as_uint64());
-   h->head_block_id = block_id_type(row["id"].as_string());
-   h->last_irreversible_block_num = static_cast<uint32_t>(std::max(row["dpos_irreversible_blocknum"].as_uint64(), row["bft_irreversible_blocknum"].as_uint64()));
+   h->head_block_num = blockstate->block_num;
+   h->head_block_id = blockstate->id;
+   h->last_irreversible_block_num = std::max(blockstate->dpos_irreversible_blocknum, blockstate->bft_irreversible_blocknum);
 
+   auto lib_id = tables.get_block_id(h->last_irreversible_block_num);
+   if (lib_id) h->last_irreversible_block_id = *lib_id;
 
-   p.table = "block";
-   p.key_type = "i64";
-   p.index_position = "4"; // blocknum
-   p.lower_bound = std::to_string(h->last_irreversible_block_num);
-   p.limit = 1;
-   auto blocks = ro_api.get_table_rows(p); // TODO: is this right?
-   if (not blocks.rows.empty() and blocks.rows.front()["block_num"].as_uint64() == h->last_irreversible_block_num) {
-      h->last_irreversible_block_id = block_id_type(blocks.rows.front()["id"].as_string());
-   }
-
+   cache.head = std::make_shared<head>(*h);
    return h;
 }
 
 sequence_ptr read_only::get_sequence(bool includes_min) const {
-   auto& chain = app().get_plugin<chain_plugin>();
-   auto ro_api = chain.get_read_only_api();
+   auto& controller = app().get_plugin<chain_plugin>().chain();
+   auto& cache = relay_->tables_cache_;
+   if (not cache.valid_for(controller)) cache.reset(controller);
+   auto& cached = includes_min ? cache.sequence_with_min : cache.sequence;
+   if (cached) return std::make_shared<sequence>(*cached);
 
-   chain_apis::read_only::get_table_rows_params p;
-   p.json = true;
-   p.code = relay_->local_contract_;
-   p.scope = relay_->local_contract_.to_string();
-   p.table = "peer";
-   p.limit = 1;
-   p.key_type = "";
-   p.index_position = "";
-   auto peer = ro_api.get_table_rows(p);
-   if (peer.rows.empty()) return nullptr;
+   contract_tables tables(controller, relay_->local_contract_);
+   auto peer = tables.get_peer();
+   if (not peer) return nullptr;
 
    auto s = std::make_shared<sequence>();
-
-   auto& row = peer.rows.front();
-   s->last_outgoing_packet_seq = row["last_outgoing_packet_seq"].as_uint64();
-   s->last_incoming_packet_seq = row["last_incoming_packet_seq"].as_uint64();
-   s->last_outgoing_receipt_seq = row["last_outgoing_receipt_seq"].as_uint64();
-   s->last_incoming_receipt_seq = row["last_incoming_receipt_seq"].as_uint64();
-   s->last_finalised_outgoing_receipt_seq = row["last_finalised_outgoing_receipt_seq"].as_uint64();
-   s->last_incoming_packet_block_num = row["last_incoming_packet_block_num"].as_uint64();
-   s->last_incoming_receipt_block_num = row["last_incoming_receipt_block_num"].as_uint64();
-   s->last_incoming_receiptend_block_num = row["last_incoming_receiptend_block_num"].as_uint64();
+   s->last_outgoing_packet_seq = peer->last_outgoing_packet_seq;
+   s->last_incoming_packet_seq = peer->last_incoming_packet_seq;
+   s->last_outgoing_receipt_seq = peer->last_outgoing_receipt_seq;
+   s->last_incoming_receipt_seq = peer->last_incoming_receipt_seq;
+   s->last_finalised_outgoing_receipt_seq = peer->last_finalised_outgoing_receipt_seq;
+   s->last_incoming_packet_block_num = peer->last_incoming_packet_block_num;
+   s->last_incoming_receipt_block_num = peer->last_incoming_receipt_block_num;
+   s->last_incoming_receiptend_block_num = peer->last_incoming_receiptend_block_num;
 
    if (includes_min) {
-      p.table = "packets";
-      auto packets = ro_api.get_table_rows(p);
-      if (not packets.rows.empty()) {
-         auto& row = packets.rows.front();
-         s->min_packet_seq = row["seq"].as_uint64();
-      }
-      p.table = "receipts";
-      auto receipts = ro_api.get_table_rows(p);
-      if (not receipts.rows.empty()) {
-         auto& row = receipts.rows.front();
-         s->min_receipt_seq = row["seq"].as_uint64();
-      }
-      p.table = "block";
-      p.key_type = "i64";
-      p.index_position = "4"; // blocknum
-      auto blocks = ro_api.get_table_rows(p);
-      if (not blocks.rows.empty()) {
-         auto& row = blocks.rows.front();
-         s->min_block_num = row["block_num"].as_uint64();
-      }
+      auto min_packet_seq = tables.get_min_packet_seq();
+      if (min_packet_seq) s->min_packet_seq = *min_packet_seq;
+      auto min_receipt_seq = tables.get_min_receipt_seq();
+      if (min_receipt_seq) s->min_receipt_seq = *min_receipt_seq;
+      auto min_block_num = tables.get_min_block_num();
+      if (min_block_num) s->min_block_num = *min_block_num;
    }
 
+   cached = std::make_shared<sequence>(*s);
    return s;
 }
 
+bool read_only::has_block(const block_id_type& id) const {
+   auto& controller = app().get_plugin<chain_plugin>().chain();
+   return contract_tables(controller, relay_->local_contract_).has_block(id);
+}
+
 read_only::get_block_results read_only::get_block(const get_block_params& params) {
    auto& chain = app().get_plugin<chain_plugin>();
    auto ro_api = chain.get_read_only_api();
@@ -196,9 +184,65 @@ read_only::get_info_results read_only::get_info(const get_info_params&) const {
       info.current_packets = static_cast<uint32_t>(row["current_packets"].as_uint64());
    }
 
+   info.relayed_actions = relay_->relayed_actions_.total;
+   info.relayed_actions_per_sec = relay_->relayed_actions_.per_second;
+
    return info;
 }
 
+read_only::get_connections_results read_only::get_connections(const get_connections_params&) const {
+   get_connections_results result;
+   result.reserve(relay_->connections.size());
+   for (const auto& c : relay_->connections) {
+      connection_status status;
+      status.peer = c->peer_name();
+      status.connected = c->connected();
+      status.protocol_version = c->protocol_version;
+      status.queued_bytes = c->queued_bytes.load();
+      status.queued_messages = c->queued_messages.load();
+      status.queued_bytes_high_water = c->queued_bytes_high_water.load();
+      status.dropped_notices = c->dropped_notices.load();
+      status.bytes_sent = c->bytes_sent.load();
+      status.messages_sent = c->messages_sent.load();
+      status.bytes_received = c->bytes_received.load();
+      status.messages_received = c->messages_received.load();
+      result.push_back(std::move(status));
+   }
+   return result;
+}
+
+read_only::metrics_results read_only::metrics(const metrics_params& params) const {
+   metrics_results result;
+   result.send_transactions = relay_->send_transactions_.size();
+   result.recv_transactions = relay_->recv_transactions_.size();
+   result.blocks_with_action_digests = relay_->block_with_action_digests_.size();
+   result.pending_headers = relay_->pending_headers_.size();
+
+   auto& m = relay_->packet_metrics_;
+   result.genproof_requests_sent = m.genproof_requests_sent;
+   result.genproof_requests_received = m.genproof_requests_received;
+   result.relayed_actions = relay_->relayed_actions_.total;
+   result.relayed_actions_per_sec = relay_->relayed_actions_.per_second;
+
+   for (auto s: {packet_metrics::applied, packet_metrics::irreversible, packet_metrics::received, packet_metrics::ready}) {
+      auto next = static_cast<packet_metrics::stage>(s + 1);
+      result.stage_latencies.push_back(stage_latency{packet_metrics::stage_name(s), packet_metrics::stage_name(next), m.stage_latency(s).summarize()});
+   }
+   result.incoming_latency = m.incoming_latency().summarize();
+
+   for (auto& t: m.recent(std::min<uint32_t>(params.packet_traces, packet_metrics::MAX_TRACES))) {
+      packet_trace pt{t.seq, t.outgoing};
+      for (size_t s = 0; s < t.stages.size(); ++s) {
+         if (t.stages[s] != fc::time_point()) pt.stages.emplace_back(packet_metrics::stage_name(static_cast<packet_metrics::stage>(s)), t.stages[s]);
+      }
+      result.packet_traces.push_back(move(pt));
+   }
+
+   result.connections = get_connections(get_connections_params{});
+   result.difchain_blocks = app().get_plugin<eosio::eoc_relay_plugin>().get_dif_chain_cache_stats();
+   return result;
+}
+
 read_write::open_channel_results read_write::open_channel(const open_channel_params& params) {
    auto& chain = app().get_plugin<chain_plugin>();
    auto& controller = chain.chain();
@@ -237,7 +281,7 @@ read_write::open_channel_results read_write::open_channel(const open_channel_par
 
    auto n = block_header::num_from_id(b->id);
    auto head_num = controller.head_block_num();
-   EOS_ASSERT(n + 24 <= head_num and n + 500 >= head_num, invalid_http_request, "Improper block number: ${n}", ("n", n)); // Reduce possibility of block rollback and block state prune. TODO: 24, 500 configurable?
+   EOS_ASSERT(n + 24 <= head_num and n + relay_->policy_.block_state_retention >= head_num, invalid_http_request, "Improper block number: ${n}", ("n", n)); // Reduce possibility of block rollback and block state prune. TODO: 24 configurable?
 
    relay_->open_channel(*b);
 
@@ -4,6 +4,9 @@
 
 #include <eosio/chain/types.hpp>
 
+#include "metrics.hpp"
+#include <eosio/eoc_relay_plugin/foreign_block_cache.hpp>
+
 namespace eoc_icp {
 
 using namespace std;
@@ -31,6 +34,7 @@ struct head {
 using head_ptr = std::shared_ptr<head>;
 
 struct packet_receipt_request;
+struct packet_receipt_range_request;
 
 struct sequence {
    uint64_t last_outgoing_packet_seq = 0;
@@ -53,6 +57,8 @@ struct sequence {
    }
 
    packet_receipt_request make_genproof_request(uint64_t start_packet_seq, uint64_t start_receipt_seq);
+   // the whole gap in front of `start_packet_seq` and `start_receipt_seq`
+   packet_receipt_range_request make_genproof_range_request(uint64_t start_packet_seq, uint64_t start_receipt_seq);
 };
 
 using sequence_ptr = std::shared_ptr<sequence>;
@@ -65,6 +71,8 @@ public:
 
    sequence_ptr get_sequence(bool includes_min = false) const;
 
+   bool has_block(const block_id_type& id) const;
+
    struct get_block_params {
       block_id_type id;
    };
@@ -96,9 +104,63 @@ public:
 
       uint32_t max_packets = 0;
       uint32_t current_packets = 0;
+
+      uint64_t relayed_actions = 0;
+      double relayed_actions_per_sec = 0;
    };
    get_info_results get_info(const get_info_params&) const;
 
+   using get_connections_params = empty;
+   struct connection_status {
+      string peer;
+      bool connected = false;
+      uint16_t protocol_version = 0;
+      uint64_t queued_bytes = 0;
+      uint64_t queued_messages = 0;
+      uint64_t queued_bytes_high_water = 0; // since the connection was opened
+      uint64_t dropped_notices = 0; // superseded by a newer notice before being sent
+      uint64_t bytes_sent = 0;
+      uint64_t messages_sent = 0;
+      uint64_t bytes_received = 0;
+      uint64_t messages_received = 0;
+   };
+   using get_connections_results = vector<connection_status>;
+   get_connections_results get_connections(const get_connections_params&) const;
+
+   struct metrics_params {
+      uint32_t packet_traces = 0; // number of most recent packets per direction to include
+   };
+   struct stage_latency {
+      string from;
+      string to;
+      latency_histogram::summary latency;
+   };
+   struct packet_trace {
+      uint64_t seq = 0;
+      bool outgoing = false;
+      vector<std::pair<string, fc::time_point>> stages; // reached so far
+   };
+   struct metrics_results {
+      uint64_t send_transactions = 0;
+      uint64_t recv_transactions = 0;
+      uint64_t blocks_with_action_digests = 0;
+      uint64_t pending_headers = 0;
+
+      uint64_t genproof_requests_sent = 0;
+      uint64_t genproof_requests_received = 0;
+
+      uint64_t relayed_actions = 0;
+      double relayed_actions_per_sec = 0;
+
+      vector<stage_latency> stage_latencies;
+      latency_histogram::summary incoming_latency; // received -> delivered
+      vector<packet_trace> packet_traces;
+
+      get_connections_results connections;
+      eosio::foreign_block_cache::stats_type difchain_blocks;
+   };
+   metrics_results metrics(const metrics_params&) const;
+
 private:
    relay_ptr relay_;
 };
@@ -129,5 +191,14 @@ FC_REFLECT(eoc_icp::read_only::get_info_results, (icp_version)(local_chain_id)(p
                                              (head_block_num)(head_block_id)(last_irreversible_block_num)(last_irreversible_block_id)
                                              (max_blocks)(current_blocks)(last_outgoing_packet_seq)(last_incoming_packet_seq)
                                              (last_outgoing_receipt_seq)(last_incoming_receipt_seq)
-                                             (max_packets)(current_packets))
+                                             (max_packets)(current_packets)(relayed_actions)(relayed_actions_per_sec))
+FC_REFLECT(eoc_icp::read_only::connection_status, (peer)(connected)(protocol_version)(queued_bytes)(queued_messages)
+                                               (queued_bytes_high_water)(dropped_notices)(bytes_sent)(messages_sent)
+                                               (bytes_received)(messages_received))
+FC_REFLECT(eoc_icp::read_only::metrics_params, (packet_traces))
+FC_REFLECT(eoc_icp::read_only::stage_latency, (from)(to)(latency))
+FC_REFLECT(eoc_icp::read_only::packet_trace, (seq)(outgoing)(stages))
+FC_REFLECT(eoc_icp::read_only::metrics_results, (send_transactions)(recv_transactions)(blocks_with_action_digests)(pending_headers)
+                                             (genproof_requests_sent)(genproof_requests_received)(relayed_actions)(relayed_actions_per_sec)
+                                             (stage_latencies)(incoming_latency)(packet_traces)(connections)(difchain_blocks))
 FC_REFLECT(eoc_icp::read_write::open_channel_params, (seed_block_num_or_id))
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cmath>
+
 #include <eosio/chain/controller.hpp>
 
 namespace eoc_icp {
@@ -7,12 +9,67 @@ namespace eoc_icp {
 using namespace eosio;
 using namespace eosio::chain;
 
-// TODO: configurable
+// defaults of `shipping_policy`
 constexpr uint32_t MAX_CACHED_BLOCKS = 50; // 1000
 constexpr uint32_t MIN_CACHED_BLOCKS = 10; // 100
 constexpr uint32_t DUMMY_ICP_SECONDS = 10; // 3600
 // constexpr uint32_t MAX_CLEANUP_SEQUENCES = 3;
 constexpr uint32_t MAX_CLEANUP_NUM = 3;
+constexpr uint32_t BLOCK_STATE_RETENTION = 500;
+constexpr uint32_t BLOCK_ID_RING_SIZE = 1 << 16; // 4MB, about 9 hours of blocks
+
+/**
+ * Decides how far the peer may lag behind before a block header is shipped to it.
+ *
+ * In adaptive mode the idle interval (no packets waiting) follows the measured cost of verifying a shipment,
+ * `addblocks_cpu_us / addblocks_cpu_target_us`, and is never shorter than the number of blocks the peer took to
+ * catch up with the previous shipment. The cpu of `addblocks` on the local chain stands in for the peer contract's,
+ * both run the same contract. The interval stays within [min_cached_blocks, max_cached_blocks], so packet latency
+ * remains bounded.
+ */
+struct shipping_policy {
+   uint32_t max_cached_blocks = MAX_CACHED_BLOCKS; // ship once the peer lags this many blocks
+   uint32_t min_cached_blocks = MIN_CACHED_BLOCKS; // ship once the peer lags this many blocks and packets are waiting
+   uint32_t dummy_seconds = DUMMY_ICP_SECONDS; // push a dummy transaction after this long without outgoing packets
+   uint32_t max_cleanup_num = MAX_CLEANUP_NUM;
+   uint32_t block_state_retention = BLOCK_STATE_RETENTION; // block states kept for `open_channel`
+
+   bool adaptive = false;
+   uint32_t addblocks_cpu_target_us = 0; // per shipped block, 0 ignores the cpu cost
+
+   double addblocks_cpu_us = 0; // moving average
+   double catch_up_blocks = 0; // moving average of the blocks between a shipment and the peer head reaching it
+   uint32_t shipped_block_num = 0; // oldest shipment not yet reached by the peer head
+
+   uint32_t busy_interval() const { return min_cached_blocks; }
+
+   uint32_t idle_interval() const {
+      if (not adaptive) return max_cached_blocks;
+
+      double interval = catch_up_blocks;
+      if (addblocks_cpu_target_us > 0) interval = std::max(interval, addblocks_cpu_us / addblocks_cpu_target_us);
+      return std::min(max_cached_blocks, std::max(min_cached_blocks, uint32_t(std::ceil(interval))));
+   }
+
+   void on_shipped(uint32_t block_num) {
+      if (shipped_block_num == 0) shipped_block_num = block_num;
+   }
+
+   void on_peer_head(uint32_t peer_head_num, uint32_t local_head_num) {
+      if (shipped_block_num == 0 or peer_head_num < shipped_block_num) return;
+      average(catch_up_blocks, local_head_num > shipped_block_num ? local_head_num - shipped_block_num : 0);
+      shipped_block_num = 0;
+   }
+
+   void on_addblocks(uint32_t cpu_us) {
+      average(addblocks_cpu_us, cpu_us);
+   }
+
+private:
+   static void average(double& avg, double sample) {
+      avg = avg == 0 ? sample : avg * 0.8 + sample * 0.2;
+   }
+};
 
 struct by_id;
 struct by_num;
@@ -25,6 +82,40 @@ typedef boost::multi_index_container<block_header_state,
    >
 > block_state_index;
 
+/**
+ * Fixed-size ring of recently accepted block ids, addressed by block number.
+ * Each slot also keeps the previous id, so a path read from the ring can be checked to link back from a given block.
+ */
+class block_id_ring {
+public:
+   explicit block_id_ring(uint32_t capacity = BLOCK_ID_RING_SIZE) : entries_(capacity) {}
+
+   void add(const block_id_type& id, const block_id_type& previous) {
+      auto& e = entries_[block_header::num_from_id(id) % entries_.size()];
+      e.id = id;
+      e.previous = previous;
+   }
+
+   // Fill `ids[num - first]` for every `num` in [first, last], walking back from `previous` (the id of block `last`).
+   // Returns the lowest block number that could not be resolved from the ring, or 0 if all were.
+   uint32_t fill(uint32_t first, uint32_t last, block_id_type previous, vector<block_id_type>& ids) const {
+      for (uint32_t num = last; num >= first and num > 0; --num) {
+         auto& e = entries_[num % entries_.size()];
+         if (e.id != previous) return num;
+         ids[num - first] = e.id;
+         previous = e.previous;
+      }
+      return 0;
+   }
+
+private:
+   struct entry {
+      block_id_type id;
+      block_id_type previous;
+   };
+   vector<entry> entries_;
+};
+
 struct send_transaction_internal {
    action_name peer_action;
    action action;
@@ -65,6 +156,29 @@ typedef boost::multi_index_container<block_with_action_digests,
    >
 > block_with_action_digests_index;
 
+// Counts actions applied by the relay and the rate over the last completed window.
+struct action_rate {
+   static constexpr int64_t WINDOW_SECONDS = 10;
+
+   uint64_t total = 0;
+   double per_second = 0;
+
+   fc::time_point window_start = fc::time_point::now();
+   uint64_t window_count = 0;
+
+   // returns true when a window has just completed
+   bool add(uint64_t n, fc::time_point now = fc::time_point::now()) {
+      total += n;
+      window_count += n;
+      auto elapsed = now - window_start;
+      if (elapsed < fc::seconds(WINDOW_SECONDS)) return false;
+      per_second = double(window_count) * 1000000 / elapsed.count();
+      window_start = now;
+      window_count = 0;
+      return true;
+   }
+};
+
 struct recv_transaction {
    uint32_t block_num;
    block_id_type block_id;
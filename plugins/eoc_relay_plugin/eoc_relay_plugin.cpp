@@ -6,6 +6,7 @@
 #include <eosio/chain/types.hpp>
 #include <eosio/chain/controller.hpp>
 #include <eosio/chain/exceptions.hpp>
+#include <eosio/chain/authorization_manager.hpp>
 #include <eosio/chain/block.hpp>
 #include <eosio/net_plugin/protocol.hpp>
 
@@ -55,6 +56,11 @@ namespace eosio {
    constexpr auto     def_send_buffer_size = 1024*1024*def_send_buffer_size_mb;
    constexpr auto     def_max_clients = 25; // 0 for unlimited clients
    constexpr auto     def_max_nodes_per_host = 1;
+   constexpr auto     def_relay_threads = 1;
+   constexpr auto     max_relay_threads = 8;
+   constexpr auto     def_max_write_queue_mb = 16;
+   constexpr auto     def_max_batch_actions = 1;
+   constexpr auto     def_action_cpu_us = 2000;
    constexpr auto     def_conn_retry_wait = 30;
    constexpr auto     def_txn_expire_wait = std::chrono::seconds(3);
    constexpr auto     def_resp_expected_wait = std::chrono::seconds(5);
@@ -92,6 +98,9 @@ namespace eosio {
 
     vector<string> tx_permission;
 
+    const string wallet_sign_digest = eosio::client::http::wallet_func_base + "/sign_digest";
+    const fc::microseconds required_keys_lifetime = fc::minutes(10);
+
     const fc::string icp_logger_name("icp_relay");
      fc::logger icp_logger;
    std::string icp_peer_log_format;
@@ -136,27 +145,9 @@ namespace eosio {
                   const std::string& path) { return call( url, path, fc::variant() ); }
 
 
-   auto abi_serializer_resolver = [](const name& account) -> optional<abi_serializer> {
-   static unordered_map<account_name, optional<abi_serializer> > abi_cache;
-   auto it = abi_cache.find( account );
-   if ( it == abi_cache.end() ) {
-      eosio::chain_apis::read_only::get_abi_params abi_param;
-      abi_param.account_name= account;
-      eosio::chain_apis::read_only readonlydata = app().get_plugin<chain_plugin>().get_read_only_api();
-      eosio::chain_apis::read_only::get_abi_results  abi_results=readonlydata.get_abi( abi_param );
-      optional<abi_serializer> abis;
-      if( abi_results.abi.valid() ) {
-         abis.emplace( *abi_results.abi, abi_serializer_max_time );
-      } else {
-         std::cerr << "ABI for contract " << account.to_string() << " not found. Action data will be shown in hex only." << std::endl;
-      }
-      abi_cache.emplace( account, abis );
-
-      return abis;
-   }
-
-   return it->second;
-    };
+   auto abi_serializer_resolver = [](const name& account) -> std::shared_ptr<const abi_serializer> {
+      return app().get_plugin<chain_plugin>().chain().get_cached_abi_serializer( account, abi_serializer_max_time );
+   };
 
     
 
@@ -166,13 +157,27 @@ namespace eosio {
       eoc_relay_plugin::eoc_relay_plugin(){context = eosio::client::http::create_http_context();
       m_nblockno=1;
       m_nnodeid=1;}
-      eoc_relay_plugin::~eoc_relay_plugin(){}
+      eoc_relay_plugin::~eoc_relay_plugin(){ stop_signing_threads(); }
 
       void eoc_relay_plugin::set_program_options(options_description&, options_description& cfg) {
             cfg.add_options()
           ("icp-relay-endpoint", bpo::value<string>()->default_value("0.0.0.0:8899"), "The endpoint upon which to listen for incoming connections")
           ("icp-relay-address", bpo::value<string>()->default_value("localhost:8899"), "The localhost addr")
-       ("icp-relay-threads", bpo::value<uint32_t>(), "The number of threads to use to process network messages")
+       ("icp-relay-threads", bpo::value<uint32_t>()->default_value(def_relay_threads), "The number of threads to use to process network messages")
+       ("icp-relay-max-write-queue-mb", bpo::value<uint32_t>()->default_value(def_max_write_queue_mb), "Maximum size in megabytes of messages queued for a single peer before the connection is closed, 0 for no limit")
+       ("icp-relay-max-batch-actions", bpo::value<uint32_t>()->default_value(def_max_batch_actions), "Maximum number of inbound packet/receipt actions packed into one transaction, 1 to push each on its own")
+       ("icp-relay-action-cpu-us", bpo::value<uint32_t>()->default_value(def_action_cpu_us), "Estimated cpu usage in microseconds of one inbound action, batches are sized to fit max_transaction_cpu_usage, 0 to ignore the cpu budget")
+       ("icp-relay-state-dir", bpo::value<bfs::path>()->default_value("icp-relay"), "The location of the relay state journal (absolute path or relative to application data dir)")
+       ("icp-relay-max-cached-blocks", bpo::value<uint32_t>()->default_value(eoc_icp::MAX_CACHED_BLOCKS), "Ship a block header once the peer lags this many blocks")
+       ("icp-relay-min-cached-blocks", bpo::value<uint32_t>()->default_value(eoc_icp::MIN_CACHED_BLOCKS), "Ship a block header once the peer lags this many blocks and outgoing packets are waiting")
+       ("icp-relay-adaptive-shipping", bpo::bool_switch()->default_value(false), "Size the shipping interval between icp-relay-min-cached-blocks and icp-relay-max-cached-blocks from the measured peer lag and addblocks cpu usage")
+       ("icp-relay-addblocks-cpu-target-us", bpo::value<uint32_t>()->default_value(0), "With adaptive shipping, the addblocks cpu usage in microseconds to aim for per shipped block, 0 to only follow the peer lag")
+       ("icp-relay-dummy-seconds", bpo::value<uint32_t>()->default_value(eoc_icp::DUMMY_ICP_SECONDS), "Push a dummy icp transaction after this many seconds without outgoing packets")
+       ("icp-relay-cleanup-num", bpo::value<uint32_t>()->default_value(eoc_icp::MAX_CLEANUP_NUM), "Maximum number of packets, receipts and blocks removed by one cleanup transaction")
+       ("icp-relay-block-state-retention", bpo::value<uint32_t>()->default_value(eoc_icp::BLOCK_STATE_RETENTION), "Number of recent block states kept to seed open_channel")
+       ("icp-relay-max-addblocks-per-transaction", bpo::value<uint32_t>()->default_value(1), "Maximum number of linked inbound block headers pushed as addblocks actions of one transaction")
+       ("icp-relay-max-genproof-range", bpo::value<uint32_t>()->default_value(256), "Maximum number of packets, and of receipts, proved again for one range request of a peer")
+       ("icp-relay-genproof-retry-seconds", bpo::value<uint32_t>()->default_value(60), "Seconds to wait for the proofs of a requested packet or receipt range before requesting it again")
        ("icp-relay-connect", bpo::value<vector<string>>()->composing(), "Remote endpoint of other node to connect to (may specify multiple times)")
        ("icp-relay-peer-chain-id", bpo::value<string>(), "The chain id of icp peer")
        ("icp-relay-peer-contract", bpo::value<string>()->default_value("cochainioicp"), "The peer icp contract account name")
@@ -247,7 +252,16 @@ namespace eosio {
 
          relay_->use_socket_read_watermark = options.at( "use-socket-read-watermark" ).as<bool>();
 
-         relay_->resolver = std::make_shared<tcp::resolver>( std::ref( app().get_io_service()));
+         relay_->num_threads_ = options.at( "icp-relay-threads" ).as<uint32_t>();
+         if( relay_->num_threads_ == 0 ) relay_->num_threads_ = 1;
+         if( relay_->num_threads_ > max_relay_threads ) {
+            relay_->num_threads_ = max_relay_threads;
+            ilog( "icp-relay-threads ${t} exceeds limit, setting to ${m}", ("t", options.at( "icp-relay-threads" ).as<uint32_t>())("m", max_relay_threads) );
+         }
+         relay_->max_write_queue_bytes = uint64_t(options.at( "icp-relay-max-write-queue-mb" ).as<uint32_t>()) * 1024 * 1024;
+         relay_->ioc_ = std::make_unique<boost::asio::io_context>( relay_->num_threads_ );
+
+         relay_->resolver = std::make_shared<tcp::resolver>( std::ref( *relay_->ioc_ ));
          
          if( options.count( "icp-relay-endpoint" )) {
             relay_->p2p_address = options.at( "icp-relay-endpoint" ).as<string>();
@@ -257,7 +271,7 @@ namespace eosio {
             tcp::resolver::query query( tcp::v4(), host.c_str(), port.c_str());
             // Note: need to add support for IPv6 too?
             relay_->listen_endpoint = *relay_->resolver->resolve( query );
-            relay_->acceptor.reset( new tcp::acceptor( app().get_io_service()));
+            relay_->acceptor.reset( new tcp::acceptor( *relay_->ioc_ ));
             
          } else {
             if( relay_->listen_endpoint.address().to_v4() == address_v4::any()) {
@@ -310,6 +324,26 @@ namespace eosio {
                   relay_->peer_contract_ = account_name(options.at("icp-relay-peer-contract").as<string>());
                   relay_->peer_chain_id_ = chain_id_type(options.at("icp-relay-peer-chain-id").as<string>());
                   relay_->signer_ = get_account_permissions(vector<string>{options.at("icp-relay-signer").as<string>()});
+                  relay_->max_batch_actions_ = options.at("icp-relay-max-batch-actions").as<uint32_t>();
+                  relay_->max_headers_per_transaction_ = std::max(options.at("icp-relay-max-addblocks-per-transaction").as<uint32_t>(), 1u);
+                  relay_->max_genproof_range_ = std::max(options.at("icp-relay-max-genproof-range").as<uint32_t>(), 1u);
+                  relay_->genproof_retry_interval_ = fc::seconds(options.at("icp-relay-genproof-retry-seconds").as<uint32_t>());
+
+                  auto& policy = relay_->policy_;
+                  policy.max_cached_blocks = options.at("icp-relay-max-cached-blocks").as<uint32_t>();
+                  policy.min_cached_blocks = options.at("icp-relay-min-cached-blocks").as<uint32_t>();
+                  EOS_ASSERT(policy.min_cached_blocks <= policy.max_cached_blocks, plugin_config_exception,
+                             "icp-relay-min-cached-blocks must not exceed icp-relay-max-cached-blocks");
+                  policy.adaptive = options.at("icp-relay-adaptive-shipping").as<bool>();
+                  policy.addblocks_cpu_target_us = options.at("icp-relay-addblocks-cpu-target-us").as<uint32_t>();
+                  policy.dummy_seconds = options.at("icp-relay-dummy-seconds").as<uint32_t>();
+                  policy.max_cleanup_num = options.at("icp-relay-cleanup-num").as<uint32_t>();
+                  policy.block_state_retention = options.at("icp-relay-block-state-retention").as<uint32_t>();
+
+                  auto state_dir = options.at("icp-relay-state-dir").as<bfs::path>();
+                  relay_->state_dir_ = state_dir.is_relative() ? app().data_dir() / state_dir : state_dir;
+                  m_dif_chain_blocks.set_spill_dir(relay_->state_dir_);
+                  relay_->action_cpu_estimate_us_ = options.at("icp-relay-action-cpu-us").as<uint32_t>();
                    if( options.count( "agent-name" )) {
                      relay_->user_agent_name = options.at( "agent-name" ).as<string>();
                     }
@@ -409,6 +443,8 @@ namespace eosio {
 
             relay_->acceptor.reset(nullptr);
          }
+         relay_->stop();
+         stop_signing_threads();
          ilog( "exit shutdown" );
         }
       FC_CAPTURE_AND_RETHROW()
@@ -455,45 +491,26 @@ namespace eosio {
 
    void eoc_relay_plugin::recv_dif_chainmsg(const difchain_message &msg)
    {
-       // ilog("begin recvDifChainMsg-------------------------");
-         ilog( "message network_version is ${network_version}", ("network_version", msg.network_version));
-         ilog( "message chainid is ${chainid}",("chainid",msg.chain_id));
-         ilog( "message blocknum is ${blocknum}",("blocknum",msg.signedblock.block_num()));
-        // ilog("message blockid is ${blockid}",("blockid",msg.signedblock.id()));
-        // ilog("message blockadder is ${blockadder}",("blockadder",msg.blockadder));
-        uint32_t blocknum = msg.signedblock.block_num();
-        blockcontainer::index<indexblocknum>::type& indexOfBlock = m_container.get<indexblocknum>();
-        auto iterfind = indexOfBlock.find(blocknum);
-        //find block num
-        if(iterfind != indexOfBlock.end())
-        {
-            ilog( "blocknum  ${blocknum} has exist",("blocknum",blocknum));
-            return;
-        }
-        //indexofblock empty
-        if(indexOfBlock.empty())
-        {
-            signed_blockplus blockplus;
-            blockplus.m_nNum = blocknum;
-            blockplus.m_block = msg.signedblock;
-            m_container.insert(blockplus);
-            ilog( "insert blocknum ${blocknum} success ",("blocknum",blocknum));
-            return;
-        }
-        auto iterMax = indexOfBlock.end();
-        iterMax--;
-        //current block is smaller than the max block in multi_index container
-        if(iterMax->m_nNum > blocknum)
-        {
-            ilog( "blocknum  ${blocknum} smaller than latest",("blocknum",blocknum));
-            return;
-        }  
-        signed_blockplus blockplus;
-        blockplus.m_nNum = blocknum;
-        blockplus.m_block = msg.signedblock;
-        m_container.insert(blockplus);
-        ilog( "insert blocknum ${blocknum} success ",("blocknum",blocknum));
-       // ilog("recvDifChainMsg success-------------------------");
+        dlog( "message network_version is ${network_version}", ("network_version", msg.network_version));
+        recv_dif_chain_block(msg.chain_id, msg.signedblock);
+   }
+
+   void eoc_relay_plugin::recv_dif_chain_block(const chain_id_type& chain_id, const signed_block &block)
+   {
+        uint32_t blocknum = block.block_num();
+        auto result = m_dif_chain_blocks.insert(chain_id, block);
+        // peers only send blocks that are irreversible on their chain
+        m_dif_chain_blocks.set_last_irreversible(chain_id, blocknum);
+        if(result == foreign_block_cache::insert_result::inserted)
+            dlog( "insert blocknum ${blocknum} of chain ${chainid}",("blocknum",blocknum)("chainid",chain_id));
+        else
+            dlog( "blocknum ${blocknum} of chain ${chainid} not inserted, ${r}",
+                  ("blocknum",blocknum)("chainid",chain_id)("r",result == foreign_block_cache::insert_result::duplicate ? "duplicate" : "stale"));
+   }
+
+   uint32_t eoc_relay_plugin::next_dif_chain_block_num(const chain_id_type& chain_id) const
+   {
+        return m_dif_chain_blocks.last_irreversible(chain_id) + 1;
    }
 
     
@@ -654,7 +671,7 @@ namespace eosio {
         eosio::chain::bytes databytes;
         try{  
             auto abis = abi_serializer_resolver( account );
-            if(abis.valid() == false )
+            if( !abis )
                 return databytes; 
             auto action_type = abis->get_action_type( action );
             if(action_type.empty() )
@@ -675,51 +692,156 @@ namespace eosio {
         
      }
 
-    fc::variant eoc_relay_plugin::determine_required_keys(const signed_transaction& trx)
+    signature_provider_type make_key_signature_provider(const chain::private_key_type& key) {
+        return [key]( const chain::digest_type& digest ) {
+            return key.sign(digest);
+        };
+    }
+
+    signature_provider_type make_keosd_signature_provider(const string& wallet_url, const chain::public_key_type& key) {
+        return [wallet_url, key]( const chain::digest_type& digest ) {
+            fc::variants sign_args = {fc::variant(digest), fc::variant(key)};
+            return call(wallet_url, wallet_sign_digest, sign_args).as<chain::signature_type>();
+        };
+    }
+
+    void eoc_relay_plugin::add_signature_provider(const chain::public_key_type& key, signature_provider_type provider)
     {
-         const auto& public_keys = call(wallet_url, eosio::client::http::wallet_public_keys);
-            auto get_arg = fc::mutable_variant_object
-           ("transaction", (transaction)trx)
-           ("available_keys", public_keys);
-            const auto& required_keys = call(eosio::client::http::get_required_keys, get_arg);
-            return required_keys["required_keys"];
+        m_signature_providers[key] = std::move(provider);
+        m_required_keys.clear();
     }
 
-    void eoc_relay_plugin::sign_transaction(signed_transaction& trx, fc::variant& required_keys, const chain_id_type& chain_id) {
-            fc::variants sign_args = {fc::variant(trx), required_keys, fc::variant(chain_id)};
-            const auto& signed_trx = call(wallet_url, eosio::client::http::wallet_sign_trx, sign_args);
-            trx = signed_trx.as<signed_transaction>();
+    void eoc_relay_plugin::start_signing_threads()
+    {
+        if(m_sign_ioc)
+            return;
+        m_sign_ioc.reset( new boost::asio::io_context );
+        m_sign_ioc_work.reset( new boost::asio::executor_work_guard<boost::asio::io_context::executor_type>( m_sign_ioc->get_executor() ));
+        for(uint32_t i = 0; i < m_sign_thread_count; ++i)
+            m_sign_threads.emplace_back( [ioc = m_sign_ioc.get()] { ioc->run(); } );
+    }
+
+    void eoc_relay_plugin::stop_signing_threads()
+    {
+        if(!m_sign_ioc)
+            return;
+        m_sign_ioc_work.reset();
+        m_sign_ioc->stop();
+        for(auto& t : m_sign_threads)
+            t.join();
+        m_sign_threads.clear();
+        m_sign_ioc.reset();
+    }
+
+    void eoc_relay_plugin::load_keosd_keys()
+    {
+        m_keosd_keys_loading = true;
+        start_signing_threads();
+        boost::asio::post(*m_sign_ioc, [this] {
+            vector<chain::public_key_type> keys;
+            try {
+                keys = call(wallet_url, eosio::client::http::wallet_public_keys).as<vector<chain::public_key_type>>();
+            } catch(const fc::exception& e) {
+                edump((e.to_detail_string()));
+            }
+            app().get_io_service().post([this, keys] {
+                for(const auto& k : keys)
+                    add_signature_provider(k, make_keosd_signature_provider(wallet_url, k));
+                if(keys.empty())
+                    wlog("no keys to sign relay transactions with, neither local nor in keosd at ${u}", ("u", wallet_url));
+                m_keosd_keys_loading = false;
+                m_keosd_keys_loaded = true;
+                auto waiting = std::move(m_waiting_for_keys);
+                m_waiting_for_keys.clear();
+                for(auto& send : waiting)
+                    send();
+            });
+        });
+    }
+
+    flat_set<chain::public_key_type> eoc_relay_plugin::determine_required_keys(const transaction& trx)
+    {
+        const auto& auth_manager = app().get_plugin<chain_plugin>().chain().get_authorization_manager();
+        flat_set<chain::public_key_type> available_keys;
+        for(const auto& p : m_signature_providers)
+            available_keys.insert(p.first);
+
+        auto now = fc::time_point::now();
+        flat_set<chain::public_key_type> required_keys;
+        for(const auto& act : trx.actions) {
+            for(const auto& level : act.authorization) {
+                auto itr = m_required_keys.find(level);
+                if(itr == m_required_keys.end() || itr->second.expires <= now) {
+                    // keys satisfying one authorization do not depend on the action carrying it
+                    transaction probe;
+                    chain::action probe_act;
+                    probe_act.authorization.push_back(level);
+                    probe.actions.push_back(probe_act);
+                    auto keys = auth_manager.get_required_keys(probe, available_keys);
+                    // cached only once the lookup succeeded, a throw leaves nothing behind
+                    itr = m_required_keys.emplace(level, required_keys_entry()).first;
+                    itr->second = required_keys_entry{std::move(keys), now + required_keys_lifetime};
+                }
+                required_keys.insert(itr->second.keys.begin(), itr->second.keys.end());
+            }
+        }
+        return required_keys;
     }
 
 
    void eoc_relay_plugin::send_actions(std::vector<chain::action>&& actions, int32_t extra_kcpu, packed_transaction::compression_type compression  )
     {
-        try{
-            eosio::chain::packed_transaction_ptr packed_trx=std::make_shared<eosio::chain::packed_transaction>();
-        eosio::chain::plugin_interface::next_function<eosio::chain::transaction_trace_ptr> next = std::bind(&eoc_relay_plugin::transaction_next,
-         this,std::placeholders::_1);
+        if(!tx_skip_sign && (m_keosd_keys_loading || (m_signature_providers.empty() && !m_keosd_keys_loaded))) {
+            m_waiting_for_keys.emplace_back([this, actions = std::move(actions), extra_kcpu, compression]() mutable {
+                send_actions(std::move(actions), extra_kcpu, compression);
+            });
+            if(!m_keosd_keys_loading && m_waiting_for_keys.size() == 1)
+                load_keosd_keys();
+            return;
+        }
 
-        signed_transaction trx;
-        trx.actions = std::forward<decltype(actions)>(actions);
-        read_only::get_info_params infoparams;
-        eosio::chain_apis::read_only readonlydata = app().get_plugin<chain_plugin>().get_read_only_api();
-        read_only::get_info_results infores = readonlydata.get_info(infoparams);
+        try{
+        auto trx = std::make_shared<signed_transaction>();
+        trx->actions = std::forward<decltype(actions)>(actions);
+        const controller& cc = app().get_plugin<chain_plugin>().chain();
         auto   tx_expiration = fc::seconds(30);
-        trx.expiration = infores.head_block_time + tx_expiration;
-        block_id_type ref_block_id = infores.last_irreversible_block_id;
-        trx.set_reference_block(ref_block_id);
+        trx->expiration = cc.head_block_time() + tx_expiration;
+        trx->set_reference_block(cc.last_irreversible_block_id());
         uint8_t  tx_max_cpu_usage = 0;
         uint32_t tx_max_net_usage = 0;
-        trx.max_cpu_usage_ms = tx_max_cpu_usage;
-        trx.max_net_usage_words = (tx_max_net_usage + 7)/8;
+        trx->max_cpu_usage_ms = tx_max_cpu_usage;
+        trx->max_net_usage_words = (tx_max_net_usage + 7)/8;
+
+        vector<signature_provider_type> signers;
         if (!tx_skip_sign) {
-                 auto required_keys = determine_required_keys(trx);
-                 sign_transaction(trx, required_keys, infores.chain_id);
-             }
-        ilog("begin packed  -----------------------");
-        *packed_trx= packed_transaction(trx, compression);
-         ilog("packed success !!!!!!!!!!!!!!!!!!!");
-        app().get_plugin<producer_plugin>().process_transaction(packed_trx, true, next);
+            for(const auto& key : determine_required_keys(*trx))
+                signers.push_back(m_signature_providers.at(key));
+        }
+        auto digest = trx->sig_digest(cc.get_chain_id(), trx->context_free_data);
+
+        start_signing_threads();
+        boost::asio::post(*m_sign_ioc, [this, trx, signers, digest, compression] {
+            try {
+                for(const auto& sign : signers)
+                    trx->signatures.push_back(sign(digest));
+            } catch(const fc::exception& e) {
+                edump((e.to_detail_string()));
+                return;
+            }
+            auto packed_trx = std::make_shared<packed_transaction>(*trx, compression);
+            app().get_io_service().post([this, trx, packed_trx] {
+                app().get_plugin<producer_plugin>().process_transaction(packed_trx, true,
+                    [this, trx](const fc::static_variant<fc::exception_ptr, eosio::chain::transaction_trace_ptr>& result) {
+                        if(result.contains<fc::exception_ptr>()) {
+                            // the authorities may have changed since the keys were cached
+                            for(const auto& act : trx->actions)
+                                for(const auto& level : act.authorization)
+                                    m_required_keys.erase(level);
+                        }
+                        transaction_next(result);
+                    });
+            });
+        });
 
         }catch(const fc::exception& e)
         {
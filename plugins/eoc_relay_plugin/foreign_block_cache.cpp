@@ -0,0 +1,153 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/eoc_relay_plugin/foreign_block_cache.hpp>
+
+#include <fc/io/raw.hpp>
+#include <fc/log/logger.hpp>
+
+namespace eosio {
+
+   static const char* spill_file_name = "foreign_blocks.spill";
+
+   foreign_block_cache::~foreign_block_cache() {
+      if( spill_stream_.is_open() ) {
+         spill_stream_.close();
+         fc::remove( spill_file_ ); // only a cache, nothing is read back after a restart
+      }
+   }
+
+   void foreign_block_cache::set_spill_dir( const fc::path& dir ) {
+      spill_file_ = dir / spill_file_name;
+   }
+
+   foreign_block_cache::insert_result foreign_block_cache::insert( const fc::sha256& chain_id, const signed_block& block ) {
+      auto block_num = block.block_num();
+      if( block_num < eviction_point( chain_id )) {
+         ++stats_.stale;
+         return insert_result::stale;
+      }
+      auto id = block.id();
+      auto& index = entries_.get<by_id>();
+      if( index.find( boost::make_tuple( chain_id, id )) != index.end()) {
+         ++stats_.duplicates;
+         return insert_result::duplicate;
+      }
+
+      entries_.insert( entry{chain_id, block_num, id, true, std::make_shared<signed_block>( block )} );
+      ++stats_.inserted;
+      ++stats_.memory_blocks;
+      while( stats_.memory_blocks > max_memory_blocks ) {
+         spill_oldest();
+      }
+      return insert_result::inserted;
+   }
+
+   signed_block_ptr foreign_block_cache::get_block( const fc::sha256& chain_id, const block_id_type& id ) {
+      auto& index = entries_.get<by_id>();
+      auto itr = index.find( boost::make_tuple( chain_id, id ));
+      if( itr == index.end()) {
+         ++stats_.misses;
+         return signed_block_ptr();
+      }
+      return load( *itr );
+   }
+
+   signed_block_ptr foreign_block_cache::get_block( const fc::sha256& chain_id, uint32_t block_num ) {
+      auto& index = entries_.get<by_num>();
+      auto itr = index.lower_bound( boost::make_tuple( chain_id, block_num ));
+      if( itr == index.end() || itr->chain_id != chain_id || itr->block_num != block_num ) {
+         ++stats_.misses;
+         return signed_block_ptr();
+      }
+      return load( *itr );
+   }
+
+   void foreign_block_cache::set_last_irreversible( const fc::sha256& chain_id, uint32_t block_num ) {
+      auto& lib = last_irreversible_[chain_id];
+      if( block_num <= lib )
+         return;
+      lib = block_num;
+
+      auto& index = entries_.get<by_num>();
+      auto itr = index.lower_bound( boost::make_tuple( chain_id ));
+      auto end = index.lower_bound( boost::make_tuple( chain_id, eviction_point( chain_id )));
+      while( itr != end ) {
+         if( itr->in_memory )
+            --stats_.memory_blocks;
+         else
+            --stats_.spilled_blocks;
+         ++stats_.evicted;
+         itr = index.erase( itr );
+      }
+
+      if( stats_.spilled_blocks == 0 && spill_end_ > 0 ) { // every spilled block is gone, start the file over
+         spill_stream_.close();
+         spill_stream_.open( spill_file_.generic_string(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc );
+         spill_end_ = 0;
+      }
+   }
+
+   uint32_t foreign_block_cache::last_irreversible( const fc::sha256& chain_id ) const {
+      auto itr = last_irreversible_.find( chain_id );
+      return itr == last_irreversible_.end() ? 0 : itr->second;
+   }
+
+   uint32_t foreign_block_cache::eviction_point( const fc::sha256& chain_id ) const {
+      uint64_t kept_from = uint64_t(last_irreversible( chain_id )) + 1;
+      return kept_from > retained_irreversible ? kept_from - retained_irreversible : 0;
+   }
+
+   signed_block_ptr foreign_block_cache::load( const entry& e ) {
+      if( e.in_memory ) {
+         ++stats_.hits;
+         return e.block;
+      }
+      std::vector<char> data( e.spill_size );
+      spill_stream_.seekg( e.spill_pos );
+      spill_stream_.read( data.data(), data.size() );
+      FC_ASSERT( spill_stream_, "cannot read block ${n} from ${f}", ("n", e.block_num)("f", spill_file_) );
+      ++stats_.spill_hits;
+      return std::make_shared<signed_block>( fc::raw::unpack<signed_block>( data ));
+   }
+
+   void foreign_block_cache::spill_oldest() {
+      auto& index = entries_.get<by_memory>();
+      auto itr = index.lower_bound( boost::make_tuple( true ));
+      if( itr == index.end())
+         return;
+
+      if( spill_file_ == fc::path()) { // nowhere to spill to
+         index.erase( itr );
+         --stats_.memory_blocks;
+         ++stats_.evicted;
+         return;
+      }
+
+      if( !spill_stream_.is_open()) {
+         if( !fc::is_directory( spill_file_.parent_path()))
+            fc::create_directories( spill_file_.parent_path());
+         spill_stream_.open( spill_file_.generic_string(), std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc );
+         FC_ASSERT( spill_stream_.is_open(), "cannot open ${f}", ("f", spill_file_) );
+         spill_end_ = 0;
+      }
+
+      auto data = fc::raw::pack( *itr->block );
+      spill_stream_.seekp( spill_end_ );
+      spill_stream_.write( data.data(), data.size() );
+      FC_ASSERT( spill_stream_, "cannot write block ${n} to ${f}", ("n", itr->block_num)("f", spill_file_) );
+      auto pos = spill_end_;
+      spill_end_ += data.size();
+
+      index.modify( itr, [&]( entry& e ) {
+         e.in_memory = false;
+         e.block.reset();
+         e.spill_pos = pos;
+         e.spill_size = data.size();
+      });
+      --stats_.memory_blocks;
+      ++stats_.spilled_blocks;
+      ++stats_.spilled;
+   }
+}
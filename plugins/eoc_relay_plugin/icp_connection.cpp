@@ -75,13 +75,16 @@ void
 
  icp_connection::icp_connection( string endpoint )
       : 
-        socket( std::make_shared<tcp::socket>( std::ref( app().get_io_service() ))),
+        my_impl( app().find_plugin<eoc_relay_plugin>()->get_relay_pointer() ),
+        socket( std::make_shared<tcp::socket>( std::ref( my_impl->get_io_context() ))),
+        strand( my_impl->get_io_context().get_executor() ),
         node_id(),   
         sent_handshake_count(0), 
         connecting(false), 
         syncing(false),   
         protocol_version(0),
         peer_addr(endpoint),
+        endpoint_name(endpoint),
         response_expected(),       
         fork_head(),
         fork_head_num(0),
@@ -93,15 +96,21 @@ void
       initialize();
    }
 
-   icp_connection::icp_connection( socket_ptr s )
+   icp_connection::icp_connection( socket_ptr s, const tcp::endpoint& remote, const tcp::endpoint& local )
       : 
+        my_impl( app().find_plugin<eoc_relay_plugin>()->get_relay_pointer() ),
         socket( s ),
+        strand( my_impl->get_io_context().get_executor() ),
         node_id(),   
         sent_handshake_count(0), 
         connecting(false), 
         syncing(false),   
         protocol_version(0),
         peer_addr(),
+        endpoint_name(remote.address().to_string() + ":" + std::to_string(remote.port())),
+        socket_open(true),
+        remote_endpoint(remote),
+        local_endpoint(local),
         response_expected(),       
         fork_head(),
         fork_head_num(0),
@@ -116,14 +125,13 @@ void
    icp_connection::~icp_connection() {}
 
    void icp_connection::initialize() {
-      my_impl = app().find_plugin<eoc_relay_plugin>()->get_relay_pointer();
       auto *rnd = node_id.data();
       rnd[0] = 0;
       response_expected.reset(new boost::asio::steady_timer(app().get_io_service()));
    }
 
    bool icp_connection::connected() {
-      return (socket && socket->is_open() && !connecting);
+      return (socket_open && !connecting);
    }
 
    bool icp_connection::current() {
@@ -135,17 +143,16 @@ void
    }
 
    void icp_connection::flush_queues() {
-      write_queue.clear();
+      boost::asio::post(strand, [self = shared_from_this()] {
+         self->write_queue.clear();
+         self->notice_queue.clear();
+         self->queued_bytes = 0;
+         self->queued_messages = 0;
+      });
    }
 
    void icp_connection::close() {
-       if(socket) {
-         socket->close();
-      }
-      else {
-         wlog("no socket to close!");
-      }
-      flush_queues();
+      socket_open = false;
       connecting = false;
       syncing = false;
       
@@ -155,7 +162,17 @@ void
       //my_impl->sync_master->reset_lib_num(shared_from_this());
       //fc_dlog(logger, "canceling wait on ${p}", ("p",peer_name()));
       cancel_wait();
-      pending_message_buffer.reset();
+      flush_queues();
+      boost::asio::post(strand, [self = shared_from_this()] {
+         if(self->socket) {
+            boost::system::error_code ec;
+            self->socket->close(ec);
+         }
+         else {
+            wlog("no socket to close!");
+         }
+         self->pending_message_buffer.reset();
+      });
    }
 
    void icp_connection::stop_send() {
@@ -174,16 +191,34 @@ void
 
    }
 
-   void icp_connection::queue_write(std::shared_ptr<vector<char>> buff,
-                                bool trigger_send,
+   bool icp_connection::queue_write(std::shared_ptr<vector<char>> buff,
+                                bool notice,
                                 std::function<void(boost::system::error_code, std::size_t)> callback) {
-      write_queue.push_back({buff, callback});
-      if(out_queue.empty() && trigger_send)
+      if (notice) {
+         // a newer heartbeat supersedes any one still waiting
+         for (auto& m: notice_queue) {
+            queued_bytes -= m.buff->size();
+            --queued_messages;
+            ++dropped_notices;
+         }
+         notice_queue.clear();
+      } else if (my_impl->max_write_queue_bytes && queued_bytes + buff->size() > my_impl->max_write_queue_bytes) {
+         return false;
+      }
+
+      (notice ? notice_queue : write_queue).push_back({buff, callback});
+      queued_bytes += buff->size();
+      ++queued_messages;
+      if (queued_bytes > queued_bytes_high_water) queued_bytes_high_water = queued_bytes.load();
+      if(out_queue.empty())
          do_queue_write();
+      return true;
    }
 
     bool icp_connection::process_next_message(relay& impl, uint32_t message_length)
     {
+      ++messages_received;
+      bytes_received += message_length + sizeof(message_length); // and its length prefix
           try {
          // If it is a signed_block, then save the raw message for the cache
          // This must be done before we unpack the message.
@@ -202,13 +237,18 @@ void
          //    pending_message_buffer.peek(blk_buffer.data(), message_length, index);
          // }
          auto ds = pending_message_buffer.create_datastream();
-         icp_net_message msg;
-         fc::raw::unpack(ds, msg);
-         icp_msgHandler m(impl, shared_from_this() );
-         msg.visit(m);
+         auto msg = std::make_shared<icp_net_message>();
+         fc::raw::unpack(ds, *msg);
+         // unpacked on the network thread, handled on the app thread which owns the relay state
+         app().get_io_service().post([&impl, c = shared_from_this(), msg] {
+            icp_msgHandler m(impl, c);
+            msg->visit(m);
+         });
       } catch(  const fc::exception& e ) {
          edump((e.to_detail_string() ));
-         impl.close( shared_from_this() );
+         app().get_io_service().post([&impl, c = shared_from_this()] {
+            impl.close( c );
+         });
          return false;
       }
       return true;
@@ -220,7 +260,7 @@ void
    }
 
    void icp_connection::do_queue_write() {
-      if(write_queue.empty() || !out_queue.empty())
+      if((write_queue.empty() && notice_queue.empty()) || !out_queue.empty())
          return;
       icp_connection_wptr c(shared_from_this());
       if(!socket->is_open()) {
@@ -229,13 +269,17 @@ void
          return;
       }
       std::vector<boost::asio::const_buffer> bufs;
-      while (write_queue.size() > 0) {
-         auto& m = write_queue.front();
-         bufs.push_back(boost::asio::buffer(*m.buff));
-         out_queue.push_back(m);
-         write_queue.pop_front();
+      for (auto* q: {&write_queue, &notice_queue}) { // higher priority first
+         while (q->size() > 0) {
+            auto& m = q->front();
+            bufs.push_back(boost::asio::buffer(*m.buff));
+            queued_bytes -= m.buff->size();
+            --queued_messages;
+            out_queue.push_back(m);
+            q->pop_front();
+         }
       }
-      boost::asio::async_write(*socket, bufs, [c](boost::system::error_code ec, std::size_t w) {
+      boost::asio::async_write(*socket, bufs, boost::asio::bind_executor(strand, [c](boost::system::error_code ec, std::size_t w) {
             try {
                auto conn = c.lock();
                if(!conn)
@@ -244,9 +288,13 @@ void
                for (auto& m: conn->out_queue) {
                   m.callback(ec, w);
                }
+               if (!ec) {
+                  conn->bytes_sent += w;
+                  conn->messages_sent += conn->out_queue.size();
+               }
 
                if(ec) {
-                  string pname = conn ? conn->peer_name() : "no icp_connection name";
+                  string pname = conn ? conn->endpoint_name : "no icp_connection name";
                   if( ec.value() != boost::asio::error::eof) {
                      elog("Error sending to peer ${p}: ${i}", ("p",pname)("i", ec.message()));
                   }
@@ -264,20 +312,20 @@ void
             }
             catch(const std::exception &ex) {
                auto conn = c.lock();
-               string pname = conn ? conn->peer_name() : "no icp_connection name";
+               string pname = conn ? conn->endpoint_name : "no icp_connection name";
                elog("Exception in do_queue_write to ${p} ${s}", ("p",pname)("s",ex.what()));
             }
             catch(const fc::exception &ex) {
                auto conn = c.lock();
-               string pname = conn ? conn->peer_name() : "no icp_connection name";
+               string pname = conn ? conn->endpoint_name : "no icp_connection name";
                elog("Exception in do_queue_write to ${p} ${s}", ("p",pname)("s",ex.to_string()));
             }
             catch(...) {
                auto conn = c.lock();
-               string pname = conn ? conn->peer_name() : "no icp_connection name";
+               string pname = conn ? conn->endpoint_name : "no icp_connection name";
                elog("Exception in do_queue_write to ${p}", ("p",pname) );
             }
-         });
+         }));
    }
 
   void icp_connection::send_handshake( ) {
@@ -296,13 +344,7 @@ void
        enqueue(msg);
     }
   
-   void icp_connection::enqueue( const icp_net_message &m, bool trigger_send ) {
-      
-        icp_go_away_reason close_after_send = icp_no_reason;
-      if (m.contains<icp_go_away_message>()) {
-         close_after_send = m.get<icp_go_away_message>().reason;
-      }
-
+   std::shared_ptr<vector<char>> icp_connection::pack_message( const icp_net_message &m ) {
       uint32_t payload_size = fc::raw::pack_size( m );
       char * header = reinterpret_cast<char*>(&payload_size);
       size_t header_size = sizeof(payload_size);
@@ -313,21 +355,53 @@ void
       fc::datastream<char*> ds( send_buffer->data(), buffer_size);
       ds.write( header, header_size );
       fc::raw::pack( ds, m );
+      return send_buffer;
+   }
+
+   void icp_connection::enqueue( const icp_net_message &m ) {
+      icp_go_away_reason close_after_send = icp_no_reason;
+      if (m.contains<icp_go_away_message>()) {
+         close_after_send = m.get<icp_go_away_message>().reason;
+      }
+
+      // serialize on the network threads rather than the caller's
+      boost::asio::post(strand, [self = shared_from_this(), m = icp_net_message(m), close_after_send] {
+         self->enqueue_buffer(pack_message(m), is_notice(m), close_after_send);
+      });
+   }
+
+   void icp_connection::enqueue_buffer( std::shared_ptr<vector<char>> send_buffer, bool notice, icp_go_away_reason close_after_send ) {
+      if (!strand.running_in_this_thread()) {
+         boost::asio::post(strand, [self = shared_from_this(), send_buffer, notice, close_after_send] {
+            self->enqueue_buffer(send_buffer, notice, close_after_send);
+         });
+         return;
+      }
+
       icp_connection_wptr weak_this = shared_from_this();
       auto relay_temp = my_impl;
-      queue_write(send_buffer,trigger_send,
+      bool queued = queue_write(send_buffer, notice,
                   [weak_this, close_after_send,relay_temp](boost::system::error_code ec, std::size_t ) {
                      icp_connection_ptr conn = weak_this.lock();
                      if (conn) {
                         if (close_after_send != icp_no_reason) {
-                           elog ("sent a go away message: ${r}, closing connection to ${p}",("r", reason_str(close_after_send))("p", conn->peer_name()));
-                           relay_temp->close(conn);
+                           elog ("sent a go away message: ${r}, closing connection to ${p}",("r", reason_str(close_after_send))("p", conn->endpoint_name));
+                           app().get_io_service().post([relay_temp, conn] {
+                              relay_temp->close(conn);
+                           });
                            return;
                         }
                      } else {
                         fc_wlog(icp_logger, "connection expired before enqueued net_message called callback!");
                      }
-                  });    
+                  });
+      if (!queued) {
+         app().get_io_service().post([relay_temp, conn = shared_from_this()] {
+            elog("write queue of ${p} exceeds ${m} bytes, peer is too slow, closing connection",
+                 ("p", conn->peer_name())("m", relay_temp->max_write_queue_bytes));
+            relay_temp->close(conn);
+         });
+      }
    }
 
    void icp_connection::cancel_wait() {
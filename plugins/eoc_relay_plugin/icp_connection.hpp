@@ -38,11 +38,13 @@ class icp_connection : public std::enable_shared_from_this<icp_connection> {
    public:
       explicit icp_connection( string endpoint );
 
-      explicit icp_connection( socket_ptr s );
+      icp_connection( socket_ptr s, const tcp::endpoint& remote, const tcp::endpoint& local );
       ~icp_connection();
       void initialize();
 
+      relay*   my_impl;
       socket_ptr              socket;
+      boost::asio::strand<boost::asio::io_context::executor_type> strand; ///< serializes all socket and write queue access
 
       fc::message_buffer<1024*1024>    pending_message_buffer;
       fc::optional<std::size_t>        outstanding_read_bytes;
@@ -52,8 +54,22 @@ class icp_connection : public std::enable_shared_from_this<icp_connection> {
          std::shared_ptr<vector<char>> buff;
          std::function<void(boost::system::error_code, std::size_t)> callback;
       };
-      deque<queued_write>     write_queue;
+      deque<queued_write>     write_queue;  ///< headers, actions, requests and control messages
+      deque<queued_write>     notice_queue; ///< heartbeats, only the newest one is kept
       deque<queued_write>     out_queue;
+
+      /** @name Back-pressure metrics, written on the strand and read from any thread
+       *  @{
+       */
+      std::atomic<uint64_t>   queued_bytes{0};
+      std::atomic<uint32_t>   queued_messages{0};
+      std::atomic<uint64_t>   queued_bytes_high_water{0};
+      std::atomic<uint64_t>   dropped_notices{0};
+      std::atomic<uint64_t>   bytes_sent{0};
+      std::atomic<uint64_t>   messages_sent{0};
+      std::atomic<uint64_t>   bytes_received{0};
+      std::atomic<uint64_t>   messages_received{0};
+      /** @} */
       fc::sha256              node_id;
       
       int16_t                 sent_handshake_count = 0;
@@ -61,8 +77,13 @@ class icp_connection : public std::enable_shared_from_this<icp_connection> {
       bool                    syncing = false;
       uint16_t                protocol_version  = 0;
       std::string                  peer_addr;
+      const std::string       endpoint_name;       ///< fixed at creation, for logging on the strand where peer_name() would race
+      /// whether the socket is open, kept by the app thread which must not ask the socket itself since only the
+      /// strand touches it; the endpoints are those of the socket as last opened
+      bool                    socket_open = false;
+      tcp::endpoint           remote_endpoint;
+      tcp::endpoint           local_endpoint;
       std::unique_ptr<boost::asio::steady_timer> response_expected;
-      relay*   my_impl;
       block_id_type          fork_head;
       uint32_t               fork_head_num = 0;
       
@@ -89,7 +110,7 @@ class icp_connection : public std::enable_shared_from_this<icp_connection> {
     
       void stop_send();
 
-      void enqueue( const icp_net_message &msg, bool trigger_send = true );
+      void enqueue( const icp_net_message &msg );
      
       void flush_queues();
       bool enqueue_sync_block();
@@ -101,8 +122,14 @@ class icp_connection : public std::enable_shared_from_this<icp_connection> {
       void sync_timeout(boost::system::error_code ec);
       void fetch_timeout(boost::system::error_code ec);
 
-      void queue_write(std::shared_ptr<vector<char>> buff,
-                       bool trigger_send,
+      static std::shared_ptr<vector<char>> pack_message(const icp_net_message& msg);
+      static bool is_notice(const icp_net_message& msg) {
+         return msg.contains<icp_notice_message>() or msg.contains<head_notice>();
+      }
+      void enqueue_buffer(std::shared_ptr<vector<char>> send_buffer, bool notice, icp_go_away_reason close_after_send = icp_no_reason);
+
+      bool queue_write(std::shared_ptr<vector<char>> buff,
+                       bool notice,
                        std::function<void(boost::system::error_code, std::size_t)> callback);
       void do_queue_write();
       bool process_next_message(relay& impl, uint32_t message_length);
@@ -111,14 +138,11 @@ class icp_connection : public std::enable_shared_from_this<icp_connection> {
        fc::optional<fc::variant_object> _logger_variant;
       const fc::variant_object& get_logger_variant()  {
          if (!_logger_variant) {
-            boost::system::error_code ec;
-            auto rep = socket->remote_endpoint(ec);
-            string ip = ec ? "<unknown>" : rep.address().to_string();
-            string port = ec ? "<unknown>" : std::to_string(rep.port());
-
-            auto lep = socket->local_endpoint(ec);
-            string lip = ec ? "<unknown>" : lep.address().to_string();
-            string lport = ec ? "<unknown>" : std::to_string(lep.port());
+            string ip = socket_open ? remote_endpoint.address().to_string() : "<unknown>";
+            string port = socket_open ? std::to_string(remote_endpoint.port()) : "<unknown>";
+
+            string lip = socket_open ? local_endpoint.address().to_string() : "<unknown>";
+            string lport = socket_open ? std::to_string(local_endpoint.port()) : "<unknown>";
 
             _logger_variant.emplace(fc::mutable_variant_object()
                ("_name", peer_name())
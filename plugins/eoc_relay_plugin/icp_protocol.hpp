@@ -89,7 +89,9 @@ namespace eoc_icp{
    head_notice,
    block_header_with_merkle_path,
    icp_actions,
-   packet_receipt_request>;
+   packet_receipt_request,
+   block_header_with_compact_merkle_path,
+   packet_receipt_range_request>;
 
 } // namespace eosio
 
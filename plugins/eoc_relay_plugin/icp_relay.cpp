@@ -17,7 +17,9 @@ constexpr auto     icp_message_header_size = 4;
   uint16_t icp_net_version_base = 0x04b5;
      uint16_t icp_net_version_range = 106;
  uint16_t icp_proto_explicit_sync = 1;
- uint16_t icp_net_version = icp_proto_explicit_sync;
+ uint16_t icp_proto_compact_merkle_path = 2;
+ uint16_t icp_proto_genproof_range = 3;
+ uint16_t icp_net_version = icp_proto_genproof_range;
 
  #define icp_peer_dlog( PEER, FORMAT, ... ) \
   FC_MULTILINE_MACRO_BEGIN \
@@ -77,7 +79,7 @@ void relay::start_monitors( )
             start_conn_timer(std::chrono::milliseconds(1), *it); // avoid exhausting
             return;
          }
-         if( !(*it)->socket->is_open() && !(*it)->connecting) {
+         if( !(*it)->socket_open && !(*it)->connecting) {
             if( (*it)->peer_addr.length() > 0) {
                connect(*it);
             }
@@ -92,10 +94,6 @@ void relay::start_monitors( )
    }
 
 void relay::start() {
-   on_applied_transaction_handle_ = app().get_channel<channels::applied_transaction>().subscribe([this](transaction_trace_ptr t) {
-      on_applied_transaction(t);
-   });
-
    on_accepted_block_handle_ = app().get_channel<channels::accepted_block_with_action_digests>().subscribe([this](block_state_with_action_digests_ptr s) {
       on_accepted_block(s);
    });
@@ -108,7 +106,9 @@ void relay::start() {
       on_bad_block(b);
    });
 
-   ioc_ = std::make_unique<boost::asio::io_context>(num_threads_);
+   journal_.open(state_dir_, [this](const journal_record& r) { apply_journal_record(r); });
+   ilog("restored ${s} send transactions, ${b} blocks with action digests, ${r} recv transactions and ${c} block states",
+        ("s", send_transactions_.size())("b", block_with_action_digests_.size())("r", recv_transactions_.size())("c", block_states_.size()));
 
    timer_ = std::make_shared<boost::asio::deadline_timer>(app().get_io_service());
 
@@ -129,16 +129,27 @@ void relay::start() {
          start_listen_loop();
       }
 
+   ioc_work_ = std::make_unique<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>>(ioc_->get_executor());
+   socket_threads_.reserve(num_threads_);
+   for (uint32_t i = 0; i < num_threads_; ++i) {
+      socket_threads_.emplace_back([ioc = ioc_.get()] { ioc->run(); });
+   }
 }
 
 void relay::stop() {
-   
+   journal_.close();
+   ioc_work_.reset();
+   ioc_->stop();
+   for (auto& t: socket_threads_) {
+      t.join();
+   }
+   socket_threads_.clear();
 }
 
 
 
 void relay::close(icp_connection_ptr c) {
-      if( c->peer_addr.empty( ) && c->socket->is_open() ) {
+      if( c->peer_addr.empty( ) && c->socket_open ) {
          if (num_clients == 0) {
             fc_wlog( icp_logger, "num_clients already at 0");
          }
@@ -152,27 +163,73 @@ void relay::close(icp_connection_ptr c) {
 
 
 
+ void relay::bcast_icp_net_msg(const icp_net_message& msg, vector<icp_connection_ptr> conns)
+ {
+    if (conns.empty()) return;
+    boost::asio::post(*ioc_, [msg = icp_net_message(msg), conns = std::move(conns)] { // serialize once, off the app thread
+       auto buff = icp_connection::pack_message(msg);
+       auto notice = icp_connection::is_notice(msg);
+       for (const auto& c : conns) {
+          c->enqueue_buffer(buff, notice);
+       }
+    });
+ }
+
  void relay::send_icp_notice_msg(const icp_notice_message& msg)
  {
-    
-    for( const auto& c : connections )
-    {
-       c->send_icp_net_msg(msg);
-       ilog("send icp_notice_msg success");
-    }
-    
+    bcast_icp_net_msg(msg, vector<icp_connection_ptr>(connections.begin(), connections.end()));
  }
 
  void relay::send_icp_net_msg(const icp_net_message& msg)
  {
     send_icp_notice_msg(icp_notice_message{local_head_});
-    for( const auto& c : connections )
-    {
-       c->send_icp_net_msg(msg);
-    }
-       
+    bcast_icp_net_msg(msg, vector<icp_connection_ptr>(connections.begin(), connections.end()));
  }
 
+void relay::send_block_header_with_merkle_path(const block_state_ptr& s) {
+   auto from = peer_head_.head_block_num;
+   // link to the previous shipment while the peer is expected to apply it, so the peer can push both in one transaction
+   if (last_shipped_block_num_ > from and last_shipped_block_num_ < s->block_num) {
+      if (policy_.shipped_block_num != 0 and s->block_num - policy_.shipped_block_num <= policy_.max_cached_blocks) {
+         from = last_shipped_block_num_;
+      } else {
+         policy_.shipped_block_num = 0; // the peer did not catch up, start again from its head
+      }
+   }
+
+   block_header_with_merkle_path b{*s, make_merkle_path(s, from)};
+   policy_.on_shipped(s->block_num);
+   last_shipped_block_num_ = s->block_num;
+
+   vector<icp_connection_ptr> compact_conns;
+   vector<icp_connection_ptr> legacy_conns;
+   for( const auto& c : connections )
+   {
+      (c->protocol_version >= icp_proto_compact_merkle_path ? compact_conns : legacy_conns).push_back(c);
+   }
+
+   send_icp_notice_msg(icp_notice_message{local_head_});
+   if (not compact_conns.empty()) {
+      bcast_icp_net_msg(block_header_with_compact_merkle_path::compress(b), std::move(compact_conns));
+   }
+   bcast_icp_net_msg(b, std::move(legacy_conns));
+}
+
+vector<block_id_type> relay::make_merkle_path(const block_state_ptr& s, uint32_t from_block_num) const {
+   vector<block_id_type> merkle_path;
+   if (from_block_num >= s->block_num) return merkle_path;
+
+   merkle_path.resize(s->block_num - from_block_num);
+   auto missing = block_ids_.fill(from_block_num, s->block_num - 1, s->header.previous, merkle_path);
+   if (missing) { // older than the ring, or the ring holds another fork
+      auto& chain = app().get_plugin<chain_plugin>().chain();
+      for (uint32_t i = from_block_num; i <= missing; ++i) {
+         merkle_path[i - from_block_num] = chain.get_block_id_for_num(i);
+      }
+   }
+   return merkle_path;
+}
+
 void relay::update_connections_head(const head& localhead)
 {
    for( const auto& c : connections )
@@ -199,27 +256,45 @@ void relay::update_local_head(bool force) {
       local_head_ = *h;
       // wlog("head: ${h}", ("h", local_head_));
 
-      std::unordered_set<packet_receipt_request> req_set; // deduplicate
-
-      for (auto it = recv_transactions_.begin(); it != recv_transactions_.end();) {
-         if (it->block_num > local_head_.last_irreversible_block_num) break;
+      // Proofs regenerated by `genproof` arrive in later blocks than the packets after them, so push whatever
+      // has become contiguous, advancing the expected sequences locally, until a pass makes no progress.
+      auto expected = *s;
+      for (bool progress = true; progress;) {
+         progress = false;
+         for (auto it = recv_transactions_.begin(); it != recv_transactions_.end();) {
+            if (it->block_num > local_head_.last_irreversible_block_num) break;
+
+            wlog("last_incoming_packet_seq: ${lp}, last_incoming_receipt_seq: ${lr}, start_packet_seq: ${sp}, start_receipt_seq: ${sr}", ("lp", expected.last_incoming_packet_seq)("lr", expected.last_incoming_receipt_seq)("sp", it->start_packet_seq)("sr", it->start_receipt_seq));
+            if (not expected.make_genproof_request(it->start_packet_seq, it->start_receipt_seq).empty()) {
+               ++it;
+               continue;
+            }
 
-         wlog("last_incoming_packet_seq: ${lp}, last_incoming_receipt_seq: ${lr}, start_packet_seq: ${sp}, start_receipt_seq: ${sr}", ("lp", s->last_incoming_packet_seq)("lr", s->last_incoming_receipt_seq)("sp", it->start_packet_seq)("sr", it->start_receipt_seq));
-         auto req = s->make_genproof_request(it->start_packet_seq, it->start_receipt_seq);
-         if (not req.empty()) {
-            if (not req_set.count(req)) {
-               //send(req);
-               send_icp_net_msg(req);
-               req_set.insert(req);
+            auto rt = *it;
+            journal_.append(journal_erase_recv_transaction{rt.block_num, rt.block_id, rt.start_packet_seq, rt.start_receipt_seq});
+            it = recv_transactions_.erase(it);
+            for (auto& p: rt.packet_actions) {
+               if (p.first == expected.last_incoming_packet_seq + 1) ++expected.last_incoming_packet_seq;
             }
-            ++it;
-            continue;
+            for (auto& r: rt.receipt_actions) {
+               if (r.first == expected.last_incoming_receipt_seq + 1) ++expected.last_incoming_receipt_seq;
+            }
+            push_icp_actions(std::make_shared<sequence>(expected), move(rt));
+            progress = true;
          }
+      }
 
-         auto rt = *it;
-         push_icp_actions(s, move(rt));
-         it = recv_transactions_.erase(it);
+      // whatever is left waits behind a gap, which ends at the first sequence a cached transaction holds
+      uint64_t gap_packet_end = 0, gap_receipt_end = 0;
+      auto lower = [](uint64_t& end, uint64_t seq, uint64_t last) {
+         if (seq > last + 1 and (end == 0 or seq < end)) end = seq;
+      };
+      for (auto& rt: recv_transactions_) {
+         if (rt.block_num > local_head_.last_irreversible_block_num) break;
+         lower(gap_packet_end, rt.start_packet_seq, expected.last_incoming_packet_seq);
+         lower(gap_receipt_end, rt.start_receipt_seq, expected.last_incoming_receipt_seq);
       }
+      request_genproof(expected, gap_packet_end, gap_receipt_end);
 
       update_connections_head(*h);
       send_icp_notice_msg(icp_notice_message{local_head_});
@@ -227,6 +302,14 @@ void relay::update_local_head(bool force) {
 }
 
 
+static bool touches_contract(const action_trace& trace, account_name contract) {
+   if (trace.receipt.receiver == contract) return true;
+   for (auto& in: trace.inline_traces) {
+      if (touches_contract(in, contract)) return true;
+   }
+   return false;
+}
+
  icp_connection_ptr relay::find_connection( string host )const
  {
     for( const auto& c : connections )
@@ -235,10 +318,24 @@ void relay::update_local_head(bool force) {
  }
 
 void relay::on_applied_transaction(const transaction_trace_ptr& t) {
+   // every action captured below is received by the local contract, skip anything else without looking further
+   auto touches = std::any_of(t->action_traces.cbegin(), t->action_traces.cend(), [this](const action_trace& action) {
+      return touches_contract(action, local_contract_);
+   });
+   if (not touches) return;
+
+   tables_cache_.reset(); // contract tables changed
+
    //ilog("on applied transaction");
-   if (send_transactions_.find(t->id) != send_transactions_.end()) 
+   auto existing = send_transactions_.find(t->id);
+   if (existing != send_transactions_.end())
    {
       ilog("send_transactions has found");
+      if (existing->block_num != t->block_num) { // applied again in another block, keep it until that one is irreversible
+         auto st = *existing;
+         st.block_num = t->block_num;
+         journal(st);
+      }
       return; // has been handled
    }
    send_transaction st{t->id, t->block_num};
@@ -260,11 +357,15 @@ void relay::on_applied_transaction(const transaction_trace_ptr& t) {
                   if (inin.act.name == ACTION_ISPACKET) {
                      auto seq = icp_packet::get_seq(inin.act.data, st.start_packet_seq);
                      st.packet_actions[seq] = send_transaction_internal{ACTION_ONPACKET, inin.act, inin.receipt};
+                     packet_metrics_.mark(true, seq, packet_metrics::applied);
                   }
                }
             }
          }
       } else if (action.act.account == local_contract_) {
+         if (action.act.name == ACTION_ADDBLOCKS and t->receipt) {
+            policy_.on_addblocks(t->receipt->cpu_usage_us);
+         }
          if (action.act.name == ACTION_ADDBLOCKS or action.act.name == ACTION_OPENCHANNEL) {
             ilog( "on_applied_transaction ,action name is ${p}",("p", action.act.name) );
             app().get_io_service().post([this] {
@@ -285,6 +386,7 @@ void relay::on_applied_transaction(const transaction_trace_ptr& t) {
                if (in.act.name == ACTION_ISPACKET) {
                   auto seq = icp_packet::get_seq(in.act.data, st.start_packet_seq);
                   st.packet_actions[seq] = send_transaction_internal{ACTION_ONPACKET, in.act, in.receipt};
+                  packet_metrics_.mark(true, seq, packet_metrics::applied);
                } else if (in.act.name == ACTION_ISRECEIPT) {
                   auto seq = icp_receipt::get_seq(in.act.data, st.start_receipt_seq);
                   st.receipt_actions[seq] = send_transaction_internal{ACTION_ONRECEIPT, in.act, in.receipt};
@@ -314,14 +416,106 @@ void relay::on_applied_transaction(const transaction_trace_ptr& t) {
 
    if (st.empty()) return;
 
-   send_transactions_.insert(st);
+   journal(st);
 }
 
 void relay::clear_cache_block_state() {
-   block_states_.clear();
+   journal(journal_clear_block_states{});
    wlog("clear_cache_block_state");
 }
 
+struct journal_applier : public fc::visitor<void> {
+   journal_applier(send_transaction_index& send_transactions, block_with_action_digests_index& block_with_action_digests,
+                   recv_transaction_index& recv_transactions, block_state_index& block_states, uint32_t block_state_retention)
+      : send_transactions(send_transactions), block_with_action_digests(block_with_action_digests),
+        recv_transactions(recv_transactions), block_states(block_states), block_state_retention(block_state_retention) {}
+
+   void operator()(const send_transaction& st) const {
+      auto it = send_transactions.find(st.id);
+      if (it != send_transactions.end()) send_transactions.replace(it, st);
+      else send_transactions.insert(st);
+   }
+
+   void operator()(const block_with_action_digests& b) const {
+      block_with_action_digests.insert(b);
+   }
+
+   void operator()(const recv_transaction& rt) const {
+      recv_transactions.insert(rt);
+   }
+
+   void operator()(const journal_erase_recv_transaction& e) const {
+      auto range = recv_transactions.equal_range(e.block_num);
+      for (auto it = range.first; it != range.second; ++it) {
+         if (e.matches(*it)) {
+            recv_transactions.erase(it);
+            return;
+         }
+      }
+   }
+
+   void operator()(const block_header_state& b) const {
+      auto& idx = block_states.get<by_num>();
+      for (auto it = idx.begin(); it != idx.end();) {
+         if (it->block_num + block_state_retention < b.block_num) {
+            it = idx.erase(it);
+         } else {
+            break;
+         }
+      }
+      auto it = idx.find(b.block_num);
+      if (it != idx.end()) {
+         idx.erase(it);
+      }
+
+      block_states.insert(b);
+   }
+
+   void operator()(const journal_clear_block_states&) const {
+      block_states.clear();
+   }
+
+   void operator()(const journal_prune& p) const {
+      auto& idx = send_transactions.get<by_block_num>();
+      idx.erase(idx.begin(), idx.lower_bound(p.irreversible_block_num));
+
+      for (auto it = block_with_action_digests.begin(); it != block_with_action_digests.end();) {
+         if (block_header::num_from_id(it->id) < p.irreversible_block_num) {
+            it = block_with_action_digests.erase(it);
+         } else {
+            ++it;
+         }
+      }
+   }
+
+   send_transaction_index& send_transactions;
+   block_with_action_digests_index& block_with_action_digests;
+   recv_transaction_index& recv_transactions;
+   block_state_index& block_states;
+   uint32_t block_state_retention;
+};
+
+void relay::apply_journal_record(const journal_record& r) {
+   r.visit(journal_applier(send_transactions_, block_with_action_digests_, recv_transactions_, block_states_, policy_.block_state_retention));
+}
+
+void relay::journal(const journal_record& r) {
+   apply_journal_record(r);
+   journal_.append(r);
+}
+
+void relay::compact_journal() {
+   uint64_t live = send_transactions_.size() + block_with_action_digests_.size() + recv_transactions_.size() + block_states_.size();
+   if (not journal_.should_compact(live)) return;
+
+   journal_.compact([this](const std::function<void(const journal_record&)>& write) {
+      for (auto& st: send_transactions_) write(st);
+      for (auto& b: block_with_action_digests_) write(b);
+      for (auto& rt: recv_transactions_) write(rt);
+      for (auto& b: block_states_.get<by_num>()) write(b);
+   });
+}
+
  bool relay::is_valid( const icp_handshake_message &msg)
  {
      bool valid = true;
@@ -356,6 +550,7 @@ void relay::clear_cache_block_state() {
          clear_cache_block_state();
       }
       peer_head_ = msg.local_head_;
+      policy_.on_peer_head(peer_head_.head_block_num, chain_plug->chain().head_block_num());
       });
 
     // TODO: check validity
@@ -508,6 +703,7 @@ void relay::handle_message( icp_connection_ptr c, const channel_seed &s )
          clear_cache_block_state();
       }
       peer_head_ = h.head; // TODO: check validity
+      policy_.on_peer_head(peer_head_.head_block_num, chain_plug->chain().head_block_num());
    });
 
    }
@@ -528,22 +724,83 @@ void relay::handle_message( icp_connection_ptr c, const channel_seed &s )
 
     wlog("block_header_with_merkle_path: ${n1} -> ${n2}, head: ${h}", ("n1", first_num)("n2", b.block_header.block_num)("h", head->head_block_num));
 
-   if (first_num != head->head_block_num) {
+   // a header links either to the contract head or to the last one already queued
+   auto tail = pending_headers_.empty() ? inflight_header_num_ : pending_headers_.back().block_header.block_num;
+   if (first_num == head->head_block_num) {
+      if (tail != first_num) pending_headers_.clear(); // start a new run
+   } else if (tail == 0 or first_num != tail) {
       // elog("unlinkable block: has ${has}, got ${got}", ("has", head->head_block_num)("got", first_num));
       return;
    }
    // TODO: more check and workaround
 
-   auto data = fc::raw::pack(bytes_data{fc::raw::pack(b)});
+   pending_headers_.push_back(b);
+   if (pending_headers_.size() >= max_headers_per_transaction_) {
+      flush_headers();
+   } else if (pending_headers_.size() == 1) {
+      app().get_io_service().post([this, self=shared_from_this()] { // also take the headers already queued behind this one
+         flush_headers();
+      });
+   }
+   }
+
+   // Verifies the producer signatures of the pending run in parallel on the network threads, then pushes it.
+   // Only one run is in flight at a time, so runs reach the chain in order; headers arriving meanwhile form the next run.
+   void relay::flush_headers()
+   {
+      if (pending_headers_.empty() or inflight_header_num_ != 0) return;
+
+      auto run = std::make_shared<vector<block_header_with_merkle_path>>();
+      auto n = std::min<size_t>(pending_headers_.size(), std::max(max_headers_per_transaction_, 1u));
+      run->assign(std::make_move_iterator(pending_headers_.begin()), std::make_move_iterator(pending_headers_.begin() + n));
+      pending_headers_.erase(pending_headers_.begin(), pending_headers_.begin() + n);
+      inflight_header_num_ = run->back().block_header.block_num;
+
+      auto valid = std::make_shared<vector<char>>(run->size(), 0);
+      auto remaining = std::make_shared<std::atomic<size_t>>(run->size());
+      for (size_t i = 0; i < run->size(); ++i) {
+         boost::asio::post(*ioc_, [this, self=shared_from_this(), run, valid, remaining, i] {
+            auto& h = (*run)[i].block_header;
+            try {
+               (*valid)[i] = h.id == h.header.id() and h.signee() == h.block_signing_key;
+            } catch (...) {
+            }
+            if (--*remaining == 0) {
+               app().get_io_service().post([this, self, run, valid] { push_headers(run, valid); });
+            }
+         });
+      }
+   }
 
-   app().get_io_service().post([=, self=shared_from_this()] {
-      action a;
-      a.name = ACTION_ADDBLOCKS;
-      a.data = data;
-      push_transaction(vector<action>{a}, [this, self](bool success) {
+   void relay::push_headers(const std::shared_ptr<vector<block_header_with_merkle_path>>& run, const std::shared_ptr<vector<char>>& valid)
+   {
+      vector<action> actions;
+      for (size_t i = 0; i < run->size(); ++i) {
+         auto& b = (*run)[i];
+         if (not (*valid)[i]) { // the rest of the run links to this one
+            elog("block ${n} not signed by its expected producer key, dropping it and ${r} following headers",
+                 ("n", b.block_header.block_num)("r", run->size() - i - 1));
+            break;
+         }
+         action a;
+         a.name = ACTION_ADDBLOCKS;
+         a.data = fc::raw::pack(bytes_data{fc::raw::pack(b)});
+         actions.push_back(move(a));
+      }
+
+      auto done = [this, self=shared_from_this()](bool success) {
+         inflight_header_num_ = 0;
          if (success) update_local_head();
-      });
-   });
+         flush_headers();
+      };
+      if (actions.empty()) return done(false);
+
+      try {
+         push_transaction(move(actions), done);
+      } catch (...) {
+         done(false);
+         throw;
+      }
    }
    void relay::handle_message( icp_connection_ptr c, const icp_actions &ia )
    {
@@ -553,8 +810,7 @@ void relay::handle_message( icp_connection_ptr c, const channel_seed &s )
    recv_transaction rt{block_num, block_id, ia.start_packet_seq, ia.start_receipt_seq};
    ilog("received icp_actions ${b_num},${p_seq},${r_seq}",("b_num",block_num)("p_seq",ia.start_packet_seq)("r_seq",ia.start_receipt_seq));
    auto ro = get_read_only_api();
-   auto r = ro.get_block(read_only::get_block_params{block_id});
-   if (r.block.is_null()) { // not exist
+   if (not ro.has_block(block_id)) { // not exist
       auto data = fc::raw::pack(bytes_data{fc::raw::pack(ia.block_header)});
       action a;
       a.name = ACTION_ADDBLOCK;
@@ -568,6 +824,7 @@ void relay::handle_message( icp_connection_ptr c, const channel_seed &s )
       a.name = s.peer_action;
       a.data = fc::raw::pack(icp_action{fc::raw::pack(s.action), fc::raw::pack(s.action_receipt), block_id, fc::raw::pack(ia.action_digests)});
       rt.packet_actions.emplace_back(p.first, a);
+      packet_metrics_.mark(false, p.first, packet_metrics::received);
    }
    for (auto& r: ia.receipt_actions) {
       auto& s = r.second;
@@ -587,9 +844,14 @@ void relay::handle_message( icp_connection_ptr c, const channel_seed &s )
       handle_icp_actions(move(rt));
    });
    }
+   void relay::handle_message( icp_connection_ptr c, const block_header_with_compact_merkle_path &b )
+   {
+      handle_message(c, b.expand());
+   }
    void relay::handle_message( icp_connection_ptr c, const packet_receipt_request &req )
    {
        ilog("received packet_receipt_request");
+       ++packet_metrics_.genproof_requests_received;
        app().get_io_service().post([=, self=shared_from_this()] {
       action a;
       a.name = ACTION_GENPROOF;
@@ -598,6 +860,64 @@ void relay::handle_message( icp_connection_ptr c, const channel_seed &s )
    });
 
    }
+   void relay::handle_message( icp_connection_ptr c, const packet_receipt_range_request &req )
+   {
+      ilog("received packet_receipt_range_request: ${r}", ("r", req));
+      ++packet_metrics_.genproof_requests_received;
+      app().get_io_service().post([=, self=shared_from_this()] {
+         // one `genproof` per sequence, pushed as pipelined batches instead of a transaction per round trip
+         vector<action> actions;
+         auto genproof = [&actions](uint64_t packet_seq, uint64_t receipt_seq) {
+            action a;
+            a.name = ACTION_GENPROOF;
+            a.data = fc::raw::pack(packet_receipt_request{packet_seq, receipt_seq});
+            actions.push_back(move(a));
+         };
+         auto first = std::max<uint64_t>(req.first_packet_seq, 1);
+         auto end = std::min(req.end_packet_seq, first + max_genproof_range_);
+         for (auto seq = first; seq < end; ++seq) genproof(seq, 0);
+         first = std::max<uint64_t>(req.first_receipt_seq, 1);
+         end = std::min(req.end_receipt_seq, first + max_genproof_range_);
+         for (auto seq = first; seq < end; ++seq) genproof(0, seq);
+         push_action_batches(move(actions));
+      });
+   }
+
+bool relay::request_genproof(const sequence& s, uint64_t start_packet_seq, uint64_t start_receipt_seq) {
+   auto range = s.make_genproof_range_request(start_packet_seq, start_receipt_seq);
+   if (range.empty()) return false;
+
+   vector<icp_connection_ptr> range_conns;
+   vector<icp_connection_ptr> legacy_conns;
+   for (const auto& c: connections) {
+      (c->protocol_version >= icp_proto_genproof_range ? range_conns : legacy_conns).push_back(c);
+   }
+
+   send_icp_notice_msg(icp_notice_message{local_head_});
+   if (not legacy_conns.empty()) { // one packet and one receipt per request, asked again on every head change
+      bcast_icp_net_msg(s.make_genproof_request(start_packet_seq, start_receipt_seq), std::move(legacy_conns));
+      ++packet_metrics_.genproof_requests_sent;
+   }
+
+   auto now = fc::time_point::now();
+   if (now - genproof_requested_time_ < genproof_retry_interval_) {
+      // proofs for the range already requested are on their way, only ask for what lies beyond it
+      range.first_packet_seq = std::max(range.first_packet_seq, genproof_requested_packet_end_);
+      range.first_receipt_seq = std::max(range.first_receipt_seq, genproof_requested_receipt_end_);
+      if (range.empty()) return true;
+   } else {
+      genproof_requested_packet_end_ = genproof_requested_receipt_end_ = 0;
+   }
+   genproof_requested_packet_end_ = std::max(genproof_requested_packet_end_, range.end_packet_seq);
+   genproof_requested_receipt_end_ = std::max(genproof_requested_receipt_end_, range.end_receipt_seq);
+   genproof_requested_time_ = now;
+
+   if (not range_conns.empty()) {
+      bcast_icp_net_msg(range, std::move(range_conns));
+      ++packet_metrics_.genproof_requests_sent;
+   }
+   return true;
+}
 
 
 
@@ -673,20 +993,7 @@ bool relay::authenticate_peer(const icp_handshake_message& msg) const
 
 
 void relay::cache_block_state(block_state_ptr b) {
-   auto& idx = block_states_.get<by_num>();
-   for (auto it = idx.begin(); it != idx.end();) {
-      if (it->block_num + 500 < b->block_num) {
-         it = idx.erase(it);
-      } else {
-         break;
-      }
-   }
-   auto it = idx.find(b->block_num);
-   if (it != idx.end()) {
-      idx.erase(it);
-   }
-
-   block_states_.insert(static_cast<const block_header_state&>(*b));
+   journal(static_cast<const block_header_state&>(*b)); // keeps the last `block_state_retention` blocks, see journal_applier
    // wlog("cache_block_state");
 }
 
@@ -697,6 +1004,8 @@ void relay::on_accepted_block(const block_state_with_action_digests_ptr& b) {
 
    auto& s = b->block_state;
 
+   block_ids_.add(s->id, s->header.previous);
+
    if (not peer_head_.valid()) {
       cache_block_state(s);
    }
@@ -719,7 +1028,7 @@ void relay::on_accepted_block(const block_state_with_action_digests_ptr& b) {
          may_send = true;
 
          if (block_with_action_digests_.find(s->id) == block_with_action_digests_.end()) {
-            block_with_action_digests_.insert(block_with_action_digests{s->id, b->action_digests});
+            journal(block_with_action_digests{s->id, b->action_digests});
          }
 
          break;
@@ -731,21 +1040,14 @@ void relay::on_accepted_block(const block_state_with_action_digests_ptr& b) {
    if (not must_send and peer_head_.valid() and s->block_num >= peer_head_.head_block_num) {
       ilog("enter must send judge!!!");
       auto lag = s->block_num - peer_head_.head_block_num;
-      if ((may_send and lag >= MIN_CACHED_BLOCKS) or lag >= MAX_CACHED_BLOCKS) {
+      if ((may_send and lag >= policy_.busy_interval()) or lag >= policy_.idle_interval()) {
          must_send = true;
       }
    }
 
    if (must_send) {
       ilog ("must_send, ${must_send}",("must_send",must_send));
-      auto& chain = app().get_plugin<chain_plugin>();
-      vector<block_id_type> merkle_path;
-      for (uint32_t i = peer_head_.head_block_num; i < s->block_num; ++i) {
-         merkle_path.push_back(chain.chain().get_block_id_for_num(i));
-      }
-
-      //send(block_header_with_merkle_path{*s, merkle_path});
-      send_icp_net_msg(block_header_with_merkle_path{*s, merkle_path});
+      send_block_header_with_merkle_path(s);
    } else {
       send_icp_notice_msg(icp_notice_message{local_head_});
    }
@@ -757,14 +1059,17 @@ void relay::on_accepted_block(const block_state_with_action_digests_ptr& b) {
 
 void relay::on_irreversible_block(const block_state_ptr& s) {
     //ilog("on_irreversible_block");
-   vector<send_transaction> txs;
+   journal(journal_prune{s->block_num}); // everything sent for earlier blocks is done with
+   compact_journal();
+
+   vector<const send_transaction*> txs; // point into send_transactions_, which is not modified below
    for (auto& t: s->trxs) {
       auto it = send_transactions_.find(t->id);
-      if (it != send_transactions_.end()) txs.push_back(*it);
+      if (it != send_transactions_.end()) txs.push_back(&*it);
    }
 
    if (txs.empty()) {
-      if (fc::time_point::now() - last_transaction_time_ >= fc::seconds(DUMMY_ICP_SECONDS) and peer_head_.valid()) {
+      if (fc::time_point::now() - last_transaction_time_ >= fc::seconds(policy_.dummy_seconds) and peer_head_.valid()) {
          app().get_io_service().post([=] {
             action a;
             a.name = ACTION_DUMMY;
@@ -786,41 +1091,40 @@ void relay::on_irreversible_block(const block_state_ptr& s) {
     ilog ("s->block_num, ${s->block_num}, peer_head_.head_block_num, ${peer_head_.head_block_num}",
    ("s->block_num",s->block_num)("peer_head_.head_block_num",peer_head_.head_block_num));
    if (s->block_num > peer_head_.head_block_num) {
-      auto& chain = app().get_plugin<chain_plugin>();
-      vector<block_id_type> merkle_path;
-      for (uint32_t i = peer_head_.head_block_num; i < s->block_num; ++i) {
-         merkle_path.push_back(chain.chain().get_block_id_for_num(i));
-      }
-
-     // send(block_header_with_merkle_path{*s, merkle_path});
      ilog("send merkle message");
-      send_icp_net_msg(block_header_with_merkle_path{*s, merkle_path});
+      send_block_header_with_merkle_path(s);
    }
 
    icp_actions ia;
    ia.block_header = static_cast<block_header>(s->header);
    ia.action_digests = bit->action_digests;
 
-   std::map<uint64_t, send_transaction_internal> packet_actions; // key is packet seq
-   std::map<uint64_t, send_transaction_internal> receipt_actions; // key is receipt seq
-   for (auto& t: txs) {
-      packet_actions.insert(t.packet_actions.cbegin(), t.packet_actions.cend());
-      receipt_actions.insert(t.receipt_actions.cbegin(), t.receipt_actions.cend());
-      for (auto& c: t.receiptend_actions) {
+   std::map<uint64_t, const send_transaction_internal*> packet_actions; // key is packet seq
+   std::map<uint64_t, const send_transaction_internal*> receipt_actions; // key is receipt seq
+   for (auto t: txs) {
+      for (auto& p: t->packet_actions) packet_actions.emplace(p.first, &p.second);
+      for (auto& r: t->receipt_actions) receipt_actions.emplace(r.first, &r.second);
+      for (auto& c: t->receiptend_actions) {
          ia.receiptend_actions.push_back(c);
       }
-      ia.set_seq(t.start_packet_seq, t.start_receipt_seq);
+      ia.set_seq(t->start_packet_seq, t->start_receipt_seq);
    }
+   ia.packet_actions.reserve(packet_actions.size());
    for (auto& p: packet_actions) {
-      ia.packet_actions.emplace_back(p.first, p.second);
+      ia.packet_actions.emplace_back(p.first, *p.second);
+      packet_metrics_.mark(true, p.first, packet_metrics::irreversible);
    }
+   ia.receipt_actions.reserve(receipt_actions.size());
    for (auto& r: receipt_actions) {
-      ia.receipt_actions.emplace_back(r.first, r.second);
+      ia.receipt_actions.emplace_back(r.first, *r.second);
    }
 
    //send(ia);
    ilog("send icp_actions ${b_num},${p_seq},${r_seq}",("b_num",s->block_num)("p_seq",ia.start_packet_seq)("r_seq",ia.action_digests));
    send_icp_net_msg(ia);
+   for (auto& p: ia.packet_actions) {
+      packet_metrics_.mark(true, p.first, packet_metrics::sent);
+   }
 }
 
 void relay::on_bad_block(const signed_block_ptr& b) {
@@ -850,17 +1154,14 @@ chain::signature_type relay::sign_compact(const chain::public_key_type& signer,
 
 void relay::handle_icp_actions(recv_transaction&& rt) {
    if (local_head_.last_irreversible_block_num < rt.block_num) {
-      recv_transactions_.insert(move(rt)); // cache it, push later
+      journal(move(rt)); // cache it, push later
       return;
    }
 
    auto s = get_read_only_api().get_sequence();
    if (s) {
-      auto req = s->make_genproof_request(rt.start_packet_seq, rt.start_receipt_seq);
-      if (not req.empty()) {
-         //send(req);
-         send_icp_net_msg(req);
-         recv_transactions_.insert(move(rt)); // cache it, push later
+      if (request_genproof(*s, rt.start_packet_seq, rt.start_receipt_seq)) {
+         journal(move(rt)); // cache it, push later
          return;
       }
    } else {
@@ -876,23 +1177,33 @@ void relay::push_icp_actions(const sequence_ptr& s, recv_transaction&& rt) {
          push_transaction(vector<action>{rt.action_add_block});
       }
 
-      // TODO: rate limiting, cache, and retry
+      // contiguous packets, then receipts, then receiptends, packed into as few transactions as allowed
+      vector<action> actions;
+      actions.reserve(rt.packet_actions.size() + rt.receipt_actions.size() + rt.receiptend_actions.size());
       auto packet_seq = s->last_incoming_packet_seq + 1; // strictly increasing, otherwise fail
       auto receipt_seq = s->last_incoming_receipt_seq + 1; // strictly increasing, otherwise fail
+      auto first_packet_seq = packet_seq;
       for (auto& p: rt.packet_actions) {
          if (p.first != packet_seq) continue;
-         push_transaction(vector<action>{p.second});
+         actions.push_back(p.second);
+         packet_metrics_.mark(false, p.first, packet_metrics::ready);
          ++packet_seq;
       }
+      auto num_packets = packet_seq - first_packet_seq; // packets lead `actions`
       for (auto& r: rt.receipt_actions) {
          wlog("last_incoming_receipt_seq: ${lr}, receipt seq: ${rs}", ("lr", receipt_seq)("rs", r.first));
          if (r.first != receipt_seq) continue;
-         push_transaction(vector<action>{r.second});
+         actions.push_back(r.second);
          ++receipt_seq;
       }
       for (auto& a: rt.receiptend_actions) {
-         push_transaction(vector<action>{a});
+         actions.push_back(a);
       }
+      push_action_batches(move(actions), [this, first_packet_seq, num_packets](size_t first, size_t last) {
+         for (auto i = first; i < last and i < num_packets; ++i) {
+            packet_metrics_.mark(false, first_packet_seq + i, packet_metrics::delivered);
+         }
+      });
    });
 }
 
@@ -900,7 +1211,8 @@ void relay::cleanup() {
    if (not local_head_.valid()) return;
 
    ++cumulative_cleanup_count_;
-   if (cumulative_cleanup_count_ < MAX_CLEANUP_NUM) return;
+   auto max_cleanup_num = policy_.max_cleanup_num;
+   if (cumulative_cleanup_count_ < max_cleanup_num) return;
 
    auto s = get_read_only_api().get_sequence(true);
    if (not s) {
@@ -913,17 +1225,17 @@ void relay::cleanup() {
    auto cleanup_packet = (s->min_packet_seq > 0 and s->last_incoming_receipt_seq > s->min_packet_seq) ? (s->last_incoming_receipt_seq - s->min_packet_seq) : 0; // TODO: consistent receipt and packet sequence?
    auto cleanup_receipt = (s->min_receipt_seq > 0 and s->last_finalised_outgoing_receipt_seq > s->min_receipt_seq) ? (s->last_finalised_outgoing_receipt_seq - s->min_receipt_seq) : 0;
    auto cleanup_block = (s->min_block_num > 0 and s->max_finished_block_num() > s->min_block_num) ? (s->max_finished_block_num() - s->min_block_num) : 0;
-   if (cleanup_packet >= MAX_CLEANUP_NUM or cleanup_receipt >= MAX_CLEANUP_NUM or cleanup_block >= MAX_CLEANUP_NUM) {
+   if (cleanup_packet >= max_cleanup_num or cleanup_receipt >= max_cleanup_num or cleanup_block >= max_cleanup_num) {
       app().get_io_service().post([=] {
          action a;
          a.name = ACTION_CLEANUP;
-         a.data = fc::raw::pack(eoc_icp::cleanup{MAX_CLEANUP_NUM});
+         a.data = fc::raw::pack(eoc_icp::cleanup{max_cleanup_num});
          wlog("cleanup *************************************");
          push_transaction(vector<action>{a});
       });
    }
 
-   if (cleanup_packet + cleanup_receipt + cleanup_block < 2*MAX_CLEANUP_NUM) {
+   if (cleanup_packet + cleanup_receipt + cleanup_block < 2*max_cleanup_num) {
       cumulative_cleanup_count_ = 0;
    }
 }
@@ -987,14 +1299,16 @@ void relay::cleanup() {
       resolver->async_resolve( query,
                                [weak_conn, this]( const boost::system::error_code& err,
                                           tcp::resolver::iterator endpoint_itr ){
-                                  auto c = weak_conn.lock();
-                                  if (!c) return;
-                                  if( !err ) {
-                                     connect( c, endpoint_itr );
-                                  } else {
-                                     elog( "Unable to resolve ${peer_addr}: ${error}",
-                                           (  "peer_addr", c->peer_name() )("error", err.message() ) );
-                                  }
+                                  app().get_io_service().post([weak_conn, err, endpoint_itr, this] {
+                                     auto c = weak_conn.lock();
+                                     if (!c) return;
+                                     if( !err ) {
+                                        connect( c, endpoint_itr );
+                                     } else {
+                                        elog( "Unable to resolve ${peer_addr}: ${error}",
+                                              (  "peer_addr", c->peer_name() )("error", err.message() ) );
+                                     }
+                                  });
                                });
    }
 
@@ -1007,69 +1321,76 @@ void relay::cleanup() {
       ++endpoint_itr;
       c->connecting = true;
       icp_connection_wptr weak_conn = c;
-      c->socket->async_connect( current_endpoint, [weak_conn, endpoint_itr, this] ( const boost::system::error_code& err ) {
+      boost::asio::post(c->strand, [c, current_endpoint, weak_conn, endpoint_itr, this] {
+         c->socket->async_connect( current_endpoint, boost::asio::bind_executor(c->strand, [weak_conn, endpoint_itr, this] ( const boost::system::error_code& err ) {
             auto c = weak_conn.lock();
             if (!c) return;
-            if( !err && c->socket->is_open() ) {
-               if (start_session( c )) {
+            tcp::endpoint remote, local;
+            auto ec = err ? err : prepare_socket( *c->socket, remote, local );
+            app().get_io_service().post([c, ec, remote, local, endpoint_itr, this] {
+               if( !ec ) {
+                  c->socket_open = true;
+                  c->remote_endpoint = remote;
+                  c->local_endpoint = local;
+                  start_session( c );
                   elog("send->handshake message,start_session");
                   c->send_handshake();
-               }
-            } else {
-               if( endpoint_itr != tcp::resolver::iterator() ) {
-                  close(c);
-                  connect( c, endpoint_itr );
-               }
-               else {
-                  elog( "connection failed to ${peer}: ${error}",
-                        ( "peer", c->peer_name())("error",err.message()));
-                  c->connecting = false;
+               } else {
+                  if( endpoint_itr != tcp::resolver::iterator() ) {
+                     close(c);
+                     connect( c, endpoint_itr );
+                  }
+                  else {
+                     elog( "connection failed to ${peer}: ${error}",
+                           ( "peer", c->peer_name())("error",ec.message()));
+                     c->connecting = false;
 
-                  close(c);
+                     close(c);
+                  }
                }
-            }
-         } );
+            });
+         }));
+      });
    }
 
-   bool relay::start_session( icp_connection_ptr con ) {
-      boost::asio::ip::tcp::no_delay nodelay( true );
+   boost::system::error_code relay::prepare_socket( tcp::socket& s, tcp::endpoint& remote, tcp::endpoint& local ) {
       boost::system::error_code ec;
-      con->socket->set_option( nodelay, ec );
-      if (ec) {
-         elog( "connection failed to ${peer}: ${error}",
-               ( "peer", con->peer_name())("error",ec.message()));
-         con->connecting = false;
-         close(con);
-         return false;
-      }
-      else {
-         start_read_message( con );
-         ++started_sessions;
-         return true;
-         // for now, we can just use the application main loop.
-         //     con->readloop_complete  = bf::async( [=](){ read_loop( con ); } );
-         //     con->writeloop_complete = bf::async( [=](){ write_loop con ); } );
-      }
+      s.set_option( boost::asio::ip::tcp::no_delay( true ), ec );
+      if( !ec )
+         remote = s.remote_endpoint( ec );
+      if( !ec )
+         local = s.local_endpoint( ec );
+      return ec;
+   }
+
+   void relay::start_session( icp_connection_ptr con ) {
+      start_read_message( con );
+      ++started_sessions;
    }
 
 
    void relay::start_listen_loop( ) {
-      auto socket = std::make_shared<tcp::socket>( std::ref( app().get_io_service() ) );
+      auto socket = std::make_shared<tcp::socket>( std::ref( *ioc_ ) );
       acceptor->async_accept( *socket, [socket,this]( boost::system::error_code ec ) {
+         // the socket is not shared yet, so it is read here rather than on the app thread
+         tcp::endpoint remote, local;
+         boost::system::error_code pec;
+         if( !ec )
+            pec = prepare_socket( *socket, remote, local );
+         app().get_io_service().post([socket, ec, pec, remote, local, this]() mutable { // connections are owned by the app thread
             if( !ec ) {
                uint32_t visitors = 0;
                uint32_t from_addr = 0;
-               auto paddr = socket->remote_endpoint(ec).address();
-               if (ec) {
-                  fc_elog(eosio::icp_logger,"Error getting remote endpoint: ${m}",("m", ec.message()));
+               auto paddr = remote.address();
+               if (pec) {
+                  fc_elog(eosio::icp_logger,"Error getting remote endpoint: ${m}",("m", pec.message()));
                }
                else {
                   for (auto &conn : connections) {
-                     if(conn->socket->is_open()) {
+                     if(conn->socket_open) {
                         if (conn->peer_addr.empty()) {
                            visitors++;
-                           boost::system::error_code ec;
-                           if (paddr == conn->socket->remote_endpoint(ec).address()) {
+                           if (paddr == conn->remote_endpoint.address()) {
                               from_addr++;
                            }
                         }
@@ -1081,7 +1402,7 @@ void relay::cleanup() {
                   }
                   if( from_addr < max_nodes_per_host && (max_client_count == 0 || num_clients < max_client_count )) {
                      ++num_clients;
-                     icp_connection_ptr c = std::make_shared<icp_connection>( socket );
+                     icp_connection_ptr c = std::make_shared<icp_connection>( socket, remote, local );
                      connections.insert( c );
                      start_session( c );
 
@@ -1095,7 +1416,10 @@ void relay::cleanup() {
                          fc_elog(icp_logger, "Error max_client_count ${m} exceeded",
                                  ( "m", max_client_count) );
                      }
-                     socket->close( );
+                     boost::asio::post( *ioc_, [socket] {
+                        boost::system::error_code ec;
+                        socket->close( ec );
+                     });
                   }
                }
             } else {
@@ -1115,9 +1439,14 @@ void relay::cleanup() {
             }
             start_listen_loop();
          });
+         });
    }
 
    void relay::start_read_message( icp_connection_ptr conn ) {
+      if (!conn->strand.running_in_this_thread()) {
+         boost::asio::post(conn->strand, [conn, this] { start_read_message(conn); });
+         return;
+      }
 
       try {
          if(!conn->socket) {
@@ -1144,7 +1473,7 @@ void relay::cleanup() {
 
          boost::asio::async_read(*conn->socket,
             conn->pending_message_buffer.get_buffer_sequence_for_boost_async_read(), completion_handler,
-            [this,weak_conn]( boost::system::error_code ec, std::size_t bytes_transferred ) {
+            boost::asio::bind_executor(conn->strand, [this,weak_conn]( boost::system::error_code ec, std::size_t bytes_transferred ) {
                auto conn = weak_conn.lock();
                if (!conn) {
                   return;
@@ -1173,7 +1502,7 @@ void relay::cleanup() {
                            if(message_length > icp_def_send_buffer_size*2 || message_length == 0) {
                               boost::system::error_code ec;
                               elog("incoming message length unexpected (${i}), from ${p}", ("i", message_length)("p",boost::lexical_cast<std::string>(conn->socket->remote_endpoint(ec))));
-                              close(conn);
+                              app().get_io_service().post([this, conn] { close( conn ); }); // connections are owned by the app thread
                               return;
                            }
 
@@ -1198,35 +1527,35 @@ void relay::cleanup() {
                      }
                      start_read_message(conn);
                   } else {
-                     auto pname = conn->peer_name();
+                     const auto& pname = conn->endpoint_name;
                      if (ec.value() != boost::asio::error::eof) {
                         elog( "Error reading message from ${p}: ${m}",("p",pname)( "m", ec.message() ) );
                      } else {
                         ilog( "Peer ${p} closed connection",("p",pname) );
                      }
-                     close( conn );
+                     app().get_io_service().post([this, conn] { close( conn ); });
                   }
                }
                catch(const std::exception &ex) {
-                  string pname = conn ? conn->peer_name() : "no connection name";
+                  string pname = conn ? conn->endpoint_name : "no connection name";
                   elog("Exception in handling read data from ${p} ${s}",("p",pname)("s",ex.what()));
-                  close( conn );
+                  app().get_io_service().post([this, conn] { close( conn ); });
                }
                catch(const fc::exception &ex) {
-                  string pname = conn ? conn->peer_name() : "no connection name";
+                  string pname = conn ? conn->endpoint_name : "no connection name";
                   elog("Exception in handling read data ${s}", ("p",pname)("s",ex.to_string()));
-                  close( conn );
+                  app().get_io_service().post([this, conn] { close( conn ); });
                }
                catch (...) {
-                  string pname = conn ? conn->peer_name() : "no connection name";
+                  string pname = conn ? conn->endpoint_name : "no connection name";
                   elog( "Undefined exception hanlding the read data from connection ${p}",( "p",pname));
-                  close( conn );
+                  app().get_io_service().post([this, conn] { close( conn ); });
                }
-            } );
+            }));
       } catch (...) {
-         string pname = conn ? conn->peer_name() : "no connection name";
+         string pname = conn ? conn->endpoint_name : "no connection name";
          elog( "Undefined exception handling reading ${p}",("p",pname) );
-         close( conn );
+         app().get_io_service().post([this, conn] { close( conn ); });
       }
    }
 
@@ -1234,7 +1563,7 @@ void relay::cleanup() {
    {
       size_t count = 0;
       for( auto &c : connections) {
-         if(c->socket->is_open())
+         if(c->socket_open)
             ++count;
       }
       return count;
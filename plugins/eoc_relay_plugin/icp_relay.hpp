@@ -13,6 +13,8 @@
 
 #include "cache.hpp"
 #include "api.hpp"
+#include "table.hpp"
+#include "journal.hpp"
 #include "icp_connection.hpp"
 #include "icp_sync_manager.hpp"
 namespace eosio{
@@ -39,24 +41,30 @@ class relay : public std::enable_shared_from_this<relay> {
 public:
    friend class eosio::eoc_relay_plugin;
    friend struct handshake_initializer;
+   friend class read_only;
    void start();
    void stop();
 
    read_only get_read_only_api() { return read_only{shared_from_this()}; }
    read_write get_read_write_api() { return read_write{shared_from_this()}; }
 
+   boost::asio::io_context& get_io_context() { return *ioc_; }
+
    void start_reconnect_timer();
 
    void update_local_head(bool force = false);
 
    void send(const icp_message& msg);
+   void bcast_icp_net_msg(const icp_net_message& msg, vector<icp_connection_ptr> conns);
    void send_icp_net_msg(const icp_net_message& msg);
    void send_icp_notice_msg(const icp_notice_message& msg);
+   void send_block_header_with_merkle_path(const block_state_ptr& s);
 
    void clear_cache_block_state();
 
    void open_channel(const block_header_state& seed);
    void push_transaction(vector<action> actions, function<void(bool)> callback = nullptr, packed_transaction::compression_type compression = packed_transaction::none);
+   void push_action_batches(vector<action> actions, function<void(size_t, size_t)> on_applied = nullptr);
    void handle_icp_actions(recv_transaction&& rt);
    chain::public_key_type get_authentication_key() const;
    chain::signature_type sign_compact(const chain::public_key_type& signer, const fc::sha256& digest) const;
@@ -65,6 +73,7 @@ public:
    tcp::endpoint                    listen_endpoint;
    std::uint16_t endpoint_port_;
    std::uint32_t num_threads_ = 1;
+   uint64_t max_write_queue_bytes = 0;
    std::vector<std::string> connect_to_peers_;
    std::unique_ptr<tcp::acceptor>        acceptor;
 
@@ -79,6 +88,11 @@ public:
 
    block_state_index block_states_;
 
+   contract_tables_cache tables_cache_; // only access on app io_service
+   action_rate relayed_actions_; // only access on app io_service
+   shipping_policy policy_; // only access on app io_service
+   packet_metrics packet_metrics_; // only access on app io_service
+
     void handle_message( icp_connection_ptr c, const icp_handshake_message &msg);
     void handle_message( icp_connection_ptr c, const icp_go_away_message & msg);
     void handle_message( icp_connection_ptr c, const icp_notice_message & msg);
@@ -87,6 +101,8 @@ public:
    void handle_message( icp_connection_ptr c, const block_header_with_merkle_path &msg );
    void handle_message( icp_connection_ptr c, const icp_actions &msg );
    void handle_message( icp_connection_ptr c, const packet_receipt_request &msg );
+   void handle_message( icp_connection_ptr c, const block_header_with_compact_merkle_path &msg );
+   void handle_message( icp_connection_ptr c, const packet_receipt_range_request &msg );
    
 
     bool is_valid( const icp_handshake_message &msg);
@@ -98,7 +114,8 @@ public:
 
     void connect( icp_connection_ptr c );
       void connect( icp_connection_ptr c, tcp::resolver::iterator endpoint_itr );
-      bool start_session( icp_connection_ptr c );
+      void start_session( icp_connection_ptr c );
+      static boost::system::error_code prepare_socket( tcp::socket& s, tcp::endpoint& remote, tcp::endpoint& local );
       void start_listen_loop( );
       void start_read_message( icp_connection_ptr c);
 
@@ -134,19 +151,33 @@ private:
    
 
    void cache_block_state(block_state_ptr b);
+   vector<block_id_type> make_merkle_path(const block_state_ptr& s, uint32_t from_block_num) const;
 
    void push_icp_actions(const sequence_ptr& s, recv_transaction&& rt);
+   // asks the peers to prove the gap in front of the given sequences again, false if there is none
+   bool request_genproof(const sequence& s, uint64_t start_packet_seq, uint64_t start_receipt_seq);
+
+   void flush_headers();
+   void push_headers(const std::shared_ptr<vector<block_header_with_merkle_path>>& run, const std::shared_ptr<vector<char>>& valid);
+
+   struct action_batches;
+   uint32_t max_batch_size() const;
+   void submit_action_batches(const std::shared_ptr<action_batches>& b, vector<std::pair<size_t, size_t>> batches);
 
    void cleanup();
+
+   void journal(const journal_record& r); // applies `r` to the indexes and appends it to the journal
+   void apply_journal_record(const journal_record& r);
+   void compact_journal();
    // void cleanup_sequences();
 
-   std::unique_ptr<boost::asio::io_context> ioc_;
+   std::unique_ptr<boost::asio::io_context> ioc_; // sockets, reads, writes and message (de)serialization
+   std::unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> ioc_work_;
    std::vector<std::thread> socket_threads_;
    
    std::shared_ptr<boost::asio::deadline_timer> timer_; // only access on app io_service
  
 
-   channels::applied_transaction::channel_type::handle on_applied_transaction_handle_;
    channels::accepted_block_with_action_digests::channel_type::handle on_accepted_block_handle_;
    channels::irreversible_block::channel_type::handle on_irreversible_block_handle_;
    channels::rejected_block::channel_type::handle on_bad_block_handle_;
@@ -156,6 +187,21 @@ private:
    uint32_t tx_max_net_usage_ = 0;
    uint32_t delaysec_ = 0;
 
+   uint32_t max_batch_actions_ = 1; // 1 pushes every inbound action in its own transaction
+   uint32_t max_headers_per_transaction_ = 1;
+
+   // inbound headers, linked to each other, waiting to be pushed as one transaction of `addblocks` actions
+   vector<block_header_with_merkle_path> pending_headers_;
+   uint32_t inflight_header_num_ = 0; // last header of the run being verified or pushed, 0 if none
+   uint32_t last_shipped_block_num_ = 0; // outbound
+   uint32_t action_cpu_estimate_us_ = 0; // used to fit batches into max_transaction_cpu_usage
+
+   uint32_t max_genproof_range_ = 256; // served per range request and per sequence kind
+   fc::microseconds genproof_retry_interval_ = fc::seconds(60);
+   uint64_t genproof_requested_packet_end_ = 0; // ends of the ranges requested in the current retry interval
+   uint64_t genproof_requested_receipt_end_ = 0;
+   fc::time_point genproof_requested_time_;
+
    fc::time_point last_transaction_time_ = fc::time_point::now();
 
    // uint32_t cumulative_cleanup_sequences_ = 0;
@@ -163,7 +209,10 @@ private:
 
    send_transaction_index send_transactions_;
    block_with_action_digests_index block_with_action_digests_;
+   block_id_ring block_ids_; // fed by accepted blocks, only access on app io_service
    recv_transaction_index recv_transactions_;
+   fc::path state_dir_;
+   relay_journal journal_; // persists the four indexes above, only access on app io_service
    uint32_t pending_schedule_version_ = 0;
 
    head local_head_;
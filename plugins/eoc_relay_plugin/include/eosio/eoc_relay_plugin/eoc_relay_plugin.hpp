@@ -7,9 +7,13 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/bind.hpp>
 #include <boost/multi_index_container.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <thread>
 #include <appbase/application.hpp>
 #include <eosio/chain_plugin/chain_plugin.hpp>
 #include <eosio/chain/block.hpp>
+#include <eosio/eoc_relay_plugin/foreign_block_cache.hpp>
 #include <httpc.hpp>
 #include <localize.hpp>
 #include <fc/io/json.hpp>
@@ -22,21 +26,13 @@ namespace eosio {
   using namespace chain;
  
     class eoc_relay_plugin;
-  struct signed_blockplus
-  {
-      public:
-      uint32_t m_nNum;
-      eosio::chain::signed_block m_block;   
-  };
 
-  
     extern eosio::client::http::http_context context;
-    struct indexblocknum{};
-    typedef boost::multi_index::multi_index_container<
-        signed_blockplus,
-        indexed_by<
-        ordered_unique<tag<indexblocknum>,member<signed_blockplus, uint32_t, &signed_blockplus::m_nNum> >
-        > >blockcontainer;
+
+    /// signs a transaction digest with the private key of one public key, called on the signing threads
+    using signature_provider_type = std::function<chain::signature_type(const chain::digest_type&)>;
+    signature_provider_type make_key_signature_provider(const chain::private_key_type& key);
+    signature_provider_type make_keosd_signature_provider(const string& wallet_url, const chain::public_key_type& key);
  
 /**
  *  This is a template plugin, intended to serve as a starting point for making new plugins
@@ -56,6 +52,10 @@ public:
    uint32_t get_num_send(); 
    void analy_dif_chainmsg(std::vector<eosio::chain::signed_block_ptr> & vecBlocks);
    void recv_dif_chainmsg(const difchain_message &msg);
+   void recv_dif_chain_block(const chain_id_type& chain_id, const signed_block &block);
+   uint32_t next_dif_chain_block_num(const chain_id_type& chain_id) const; ///< first block of that chain not received yet
+   signed_block_ptr get_dif_chain_block(const chain_id_type& chain_id, uint32_t block_num) { return m_dif_chain_blocks.get_block(chain_id, block_num); }
+   const foreign_block_cache::stats_type& get_dif_chain_cache_stats() const { return m_dif_chain_blocks.stats(); }
    void get_info();
    void get_relay_info();
    void sendrelayaction();
@@ -63,10 +63,11 @@ public:
     fc::variant json_from_file_or_string(const string& file_or_str, fc::json::parse_type ptype = fc::json::legacy_parser);
       void transaction_next(const fc::static_variant<fc::exception_ptr, eosio::chain::transaction_trace_ptr>& param);
       void send_actions(std::vector<chain::action>&& actions, int32_t extra_kcpu = 1000, packed_transaction::compression_type compression = packed_transaction::none );
-      fc::variant determine_required_keys(const signed_transaction& trx) ;
-      void sign_transaction(signed_transaction& trx, fc::variant& required_keys, const chain_id_type& chain_id);
+      /// without any provider, the public keys of the keosd wallet are loaded and signed with on first use
+      void add_signature_provider(const chain::public_key_type& key, signature_provider_type provider);
+      flat_set<chain::public_key_type> determine_required_keys(const transaction& trx);
       bytes variant_to_bin( const account_name& account, const action_name& action, const fc::variant& action_args_var ) ;
-      blockcontainer m_container;
+      foreign_block_cache m_dif_chain_blocks;
       uint64_t m_nblockno;
       uint64_t m_nnodeid;
    string                       connect( const string& endpoint );
@@ -75,8 +76,27 @@ public:
    eoc_icp::read_write get_read_write_api();
 
 private:
+   void load_keosd_keys();
+   void start_signing_threads();
+   void stop_signing_threads();
+
+   struct required_keys_entry {
+      flat_set<chain::public_key_type> keys;
+      fc::time_point                   expires;
+   };
   
    std::shared_ptr<class eoc_icp::relay> relay_;
+
+   std::map<chain::public_key_type, signature_provider_type> m_signature_providers; // only access on app thread
+   std::map<chain::permission_level, required_keys_entry> m_required_keys; // cached per authorization, only access on app thread
+   bool m_keosd_keys_loading = false;
+   bool m_keosd_keys_loaded = false;
+   std::vector<std::function<void()>> m_waiting_for_keys; // sends queued while the keosd keys load
+
+   uint32_t m_sign_thread_count = 2;
+   std::unique_ptr<boost::asio::io_context> m_sign_ioc; // signing and keosd round-trips, off the app thread
+   std::unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> m_sign_ioc_work;
+   std::vector<std::thread> m_sign_threads;
 };
 
 
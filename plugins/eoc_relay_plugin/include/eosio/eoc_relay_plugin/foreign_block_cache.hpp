@@ -0,0 +1,119 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <fstream>
+#include <map>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/composite_key.hpp>
+
+#include <eosio/chain/block.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/reflect/reflect.hpp>
+
+namespace eosio {
+   using chain::block_id_type;
+   using chain::signed_block;
+   using chain::signed_block_ptr;
+   using namespace boost::multi_index;
+
+   /**
+    * Blocks received from other chains, keyed by (chain id, block number, block id) so that blocks of
+    * different forks are kept apart.
+    *
+    * At most `max_memory_blocks` blocks are held in memory. The oldest ones past that are packed into a
+    * spill file and unpacked again when looked up. Blocks `retained_irreversible` or more below the last
+    * irreversible block of their chain are evicted from both, so the cache stays bounded however long the
+    * node runs.
+    */
+   class foreign_block_cache {
+   public:
+      struct stats_type {
+         uint64_t inserted = 0;
+         uint64_t duplicates = 0;
+         uint64_t stale = 0;    ///< rejected, already below the eviction point
+         uint64_t hits = 0;
+         uint64_t spill_hits = 0;
+         uint64_t misses = 0;
+         uint64_t spilled = 0;
+         uint64_t evicted = 0;
+         uint32_t memory_blocks = 0;
+         uint32_t spilled_blocks = 0;
+      };
+
+      enum class insert_result { inserted, duplicate, stale };
+
+      explicit foreign_block_cache( uint32_t max_memory_blocks = 256, uint32_t retained_irreversible = 4096 )
+         : max_memory_blocks(max_memory_blocks), retained_irreversible(retained_irreversible) {}
+      ~foreign_block_cache();
+
+      /// the spill file is created in `dir` on first use, without it old blocks are evicted instead of spilled
+      void set_spill_dir( const fc::path& dir );
+
+      insert_result insert( const fc::sha256& chain_id, const signed_block& block );
+
+      signed_block_ptr get_block( const fc::sha256& chain_id, const block_id_type& id );
+      /// lowest block id of that number when the cache holds several forks of it
+      signed_block_ptr get_block( const fc::sha256& chain_id, uint32_t block_num );
+
+      /// evicts the blocks of `chain_id` that fell `retained_irreversible` below `block_num`, never moves back
+      void set_last_irreversible( const fc::sha256& chain_id, uint32_t block_num );
+      uint32_t last_irreversible( const fc::sha256& chain_id ) const;
+
+      const stats_type& stats() const { return stats_; }
+
+   private:
+      struct entry {
+         fc::sha256       chain_id;
+         uint32_t         block_num = 0;
+         block_id_type    block_id;
+         bool             in_memory = true;
+         signed_block_ptr block;          ///< null once spilled
+         uint64_t         spill_pos = 0;
+         uint32_t         spill_size = 0;
+      };
+
+      struct by_num;
+      struct by_id;
+      struct by_memory;
+      typedef multi_index_container<
+         entry,
+         indexed_by<
+            ordered_unique< tag<by_num>,
+               composite_key< entry,
+                  member<entry, fc::sha256, &entry::chain_id>,
+                  member<entry, uint32_t, &entry::block_num>,
+                  member<entry, block_id_type, &entry::block_id> > >,
+            ordered_unique< tag<by_id>,
+               composite_key< entry,
+                  member<entry, fc::sha256, &entry::chain_id>,
+                  member<entry, block_id_type, &entry::block_id> > >,
+            ordered_non_unique< tag<by_memory>,
+               composite_key< entry,
+                  member<entry, bool, &entry::in_memory>,
+                  member<entry, uint32_t, &entry::block_num> > >
+         >
+      > entry_index;
+
+      uint32_t eviction_point( const fc::sha256& chain_id ) const;
+      signed_block_ptr load( const entry& e );
+      void spill_oldest();
+
+      uint32_t                          max_memory_blocks;
+      uint32_t                          retained_irreversible;
+      entry_index                       entries_;
+      std::map<fc::sha256, uint32_t>    last_irreversible_;
+      fc::path                          spill_file_;
+      std::fstream                      spill_stream_;
+      uint64_t                          spill_end_ = 0;
+      stats_type                        stats_;
+   };
+}
+
+FC_REFLECT( eosio::foreign_block_cache::stats_type,
+            (inserted)(duplicates)(stale)(hits)(spill_hits)(misses)(spilled)(evicted)(memory_blocks)(spilled_blocks) )
@@ -0,0 +1,113 @@
+#include "journal.hpp"
+
+#include <fc/crypto/city.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/log/logger.hpp>
+
+namespace eoc_icp {
+
+constexpr uint32_t relay_journal::MAGIC;
+constexpr uint32_t relay_journal::VERSION;
+
+constexpr auto JOURNAL_FILE_NAME = "journal.log";
+constexpr uint32_t MAX_RECORD_SIZE = 64 * 1024 * 1024;
+
+void relay_journal::open(const fc::path& dir, const std::function<void(const journal_record&)>& apply) {
+   if (not fc::is_directory(dir)) fc::create_directories(dir);
+   path_ = dir / JOURNAL_FILE_NAME;
+   records_ = 0;
+
+   if (fc::exists(path_)) {
+      std::fstream in(path_.generic_string(), std::ios::in | std::ios::binary);
+      uint32_t magic = 0, version = 0;
+      in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+      in.read(reinterpret_cast<char*>(&version), sizeof(version));
+      FC_ASSERT(in and magic == MAGIC and version == VERSION, "unsupported icp relay journal ${p}", ("p", path_));
+
+      uint64_t good_size = in.tellg();
+      vector<char> payload;
+      while (true) {
+         uint32_t size = 0;
+         uint64_t checksum = 0;
+         in.read(reinterpret_cast<char*>(&size), sizeof(size));
+         in.read(reinterpret_cast<char*>(&checksum), sizeof(checksum));
+         if (not in or size > MAX_RECORD_SIZE) break;
+         payload.resize(size);
+         in.read(payload.data(), size);
+         if (not in or fc::city_hash64(payload.data(), size) != checksum) break;
+
+         journal_record r;
+         fc::datastream<const char*> ds(payload.data(), payload.size());
+         fc::raw::unpack(ds, r);
+         apply(r);
+         ++records_;
+         good_size = in.tellg();
+      }
+      in.close();
+
+      if (good_size < fc::file_size(path_)) {
+         wlog("truncating torn tail of icp relay journal ${p} at ${s} bytes", ("p", path_)("s", good_size));
+         boost::filesystem::resize_file(path_, good_size);
+      }
+      ilog("replayed ${n} icp relay journal records", ("n", records_));
+   } else {
+      std::fstream out(path_.generic_string(), std::ios::out | std::ios::binary);
+      write_header(out);
+   }
+
+   stream_.open(path_.generic_string(), std::ios::in | std::ios::out | std::ios::binary | std::ios::ate);
+   FC_ASSERT(stream_.is_open(), "cannot open icp relay journal ${p}", ("p", path_));
+}
+
+void relay_journal::close() {
+   if (stream_.is_open()) stream_.close();
+}
+
+void relay_journal::append(const journal_record& r) {
+   if (not stream_.is_open()) return;
+   write_record(stream_, r);
+   stream_.flush();
+   ++records_;
+}
+
+void relay_journal::compact(const std::function<void(const std::function<void(const journal_record&)>&)>& write_live) {
+   if (not stream_.is_open()) return;
+
+   auto tmp_path = path_;
+   tmp_path.replace_extension(".tmp");
+   uint64_t records = 0;
+   {
+      std::fstream out(tmp_path.generic_string(), std::ios::out | std::ios::trunc | std::ios::binary);
+      write_header(out);
+      write_live([&](const journal_record& r) {
+         write_record(out, r);
+         ++records;
+      });
+      out.flush();
+      FC_ASSERT(out, "failed to write icp relay journal ${p}", ("p", tmp_path));
+   }
+
+   stream_.close();
+   fc::rename(tmp_path, path_); // atomic, the old log stays valid until here
+   stream_.open(path_.generic_string(), std::ios::in | std::ios::out | std::ios::binary | std::ios::ate);
+   FC_ASSERT(stream_.is_open(), "cannot open icp relay journal ${p}", ("p", path_));
+
+   ilog("compacted icp relay journal from ${o} to ${n} records", ("o", records_)("n", records));
+   records_ = records;
+}
+
+void relay_journal::write_header(std::fstream& s) {
+   s.write(reinterpret_cast<const char*>(&MAGIC), sizeof(MAGIC));
+   s.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+}
+
+void relay_journal::write_record(std::fstream& s, const journal_record& r) {
+   auto payload = fc::raw::pack(r);
+   uint32_t size = payload.size();
+   uint64_t checksum = fc::city_hash64(payload.data(), payload.size());
+   s.write(reinterpret_cast<const char*>(&size), sizeof(size));
+   s.write(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+   s.write(payload.data(), payload.size());
+}
+
+}
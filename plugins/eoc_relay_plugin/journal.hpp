@@ -0,0 +1,84 @@
+#pragma once
+
+#include <fstream>
+
+#include <fc/filesystem.hpp>
+#include <fc/static_variant.hpp>
+
+#include "cache.hpp"
+#include "message.hpp"
+
+namespace eoc_icp {
+
+struct journal_erase_recv_transaction {
+   uint32_t block_num = 0;
+   block_id_type block_id;
+   uint64_t start_packet_seq = 0;
+   uint64_t start_receipt_seq = 0;
+
+   bool matches(const recv_transaction& rt) const {
+      return rt.block_num == block_num and rt.block_id == block_id
+             and rt.start_packet_seq == start_packet_seq and rt.start_receipt_seq == start_receipt_seq;
+   }
+};
+
+struct journal_clear_block_states {};
+
+struct journal_prune {
+   uint32_t irreversible_block_num = 0;
+};
+
+// Each record is a put (insert or replace) into, or an erase from, one of the relay indexes.
+using journal_record = fc::static_variant<send_transaction,
+                                          block_with_action_digests,
+                                          recv_transaction,
+                                          journal_erase_recv_transaction,
+                                          block_header_state,
+                                          journal_clear_block_states,
+                                          journal_prune>;
+
+/**
+ * Append-only log of the changes made to the in-memory relay indexes, replayed on startup.
+ *
+ * A record is framed as `uint32_t size, uint64_t city_hash64(payload), payload`. Every append is
+ * flushed, so a crashed process loses nothing; a torn tail left by a crashed host fails the size or
+ * checksum test on replay and is truncated. Once most records are obsolete, the log is rewritten
+ * from the live indexes into a temporary file which then replaces it.
+ */
+class relay_journal {
+public:
+   static constexpr uint32_t MAGIC = 0x4c4a4349; // "ICJL"
+   static constexpr uint32_t VERSION = 1;
+   static constexpr uint64_t COMPACT_MIN_RECORDS = 10000;
+
+   // Opens (or creates) the journal in `dir` and calls `apply` for every valid record in it.
+   void open(const fc::path& dir, const std::function<void(const journal_record&)>& apply);
+   void close();
+   bool is_open() const { return stream_.is_open(); }
+
+   void append(const journal_record& r);
+
+   // Whether the log holds enough obsolete records, given how many are still live, to be worth a rewrite.
+   bool should_compact(uint64_t live_records) const {
+      return records_ >= COMPACT_MIN_RECORDS and records_ > 4 * live_records;
+   }
+   // Replaces the log by the records produced by `write_live`, which is given an append function.
+   void compact(const std::function<void(const std::function<void(const journal_record&)>&)>& write_live);
+
+private:
+   void write_header(std::fstream& s);
+   void write_record(std::fstream& s, const journal_record& r);
+
+   fc::path path_;
+   std::fstream stream_;
+   uint64_t records_ = 0;
+};
+
+}
+
+FC_REFLECT(eoc_icp::send_transaction, (id)(block_num)(start_packet_seq)(start_receipt_seq)(packet_actions)(receipt_actions)(receiptend_actions))
+FC_REFLECT(eoc_icp::block_with_action_digests, (id)(action_digests))
+FC_REFLECT(eoc_icp::recv_transaction, (block_num)(block_id)(start_packet_seq)(start_receipt_seq)(action_add_block)(packet_actions)(receipt_actions)(receiptend_actions))
+FC_REFLECT(eoc_icp::journal_erase_recv_transaction, (block_num)(block_id)(start_packet_seq)(start_receipt_seq))
+FC_REFLECT_EMPTY(eoc_icp::journal_clear_block_states)
+FC_REFLECT(eoc_icp::journal_prune, (irreversible_block_num))
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <fc/io/raw.hpp>
+#include <fc/bitutil.hpp>
 
 #include "api.hpp"
 #include "cache.hpp"
@@ -57,8 +58,11 @@ struct icp_packet {
    uint8_t status;
    uint8_t shadow;
 
+   // `seq` is the leading field, read it without unpacking the rest
    static uint64_t get_seq(const bytes& data, uint64_t& min_seq) {
-      auto seq = fc::raw::unpack<icp_packet>(data).seq;
+      uint64_t seq = 0;
+      fc::datastream<const char*> ds(data.data(), data.size());
+      fc::raw::unpack(ds, seq);
       if (min_seq == 0 or seq < min_seq) min_seq = seq;
       return seq;
    }
@@ -72,7 +76,9 @@ struct icp_receipt {
    uint8_t shadow;
 
    static uint64_t get_seq(const bytes& data, uint64_t& min_seq) {
-      auto seq = fc::raw::unpack<icp_receipt>(data).seq;
+      uint64_t seq = 0;
+      fc::datastream<const char*> ds(data.data(), data.size());
+      fc::raw::unpack(ds, seq);
       if (min_seq == 0 or seq < min_seq) min_seq = seq;
       return seq;
    }
@@ -103,6 +109,48 @@ struct block_header_with_merkle_path {
    block_header_state block_header;
    vector<block_id_type> merkle_path;
 };
+// Wire form of `block_header_with_merkle_path`: the block number embedded in every id is implied by its
+// position, and the last id equals `block_header.header.previous`, so only the remaining 28 bytes of
+// each id except the last one are sent.
+struct block_header_with_compact_merkle_path {
+   static constexpr size_t id_suffix_size = sizeof(block_id_type) - sizeof(uint32_t);
+
+   block_header_state block_header;
+   uint32_t first_block_num = 0;
+   uint32_t path_size = 0;
+   bytes id_suffixes;
+
+   static block_header_with_compact_merkle_path compress(const block_header_with_merkle_path& b) {
+      block_header_with_compact_merkle_path c;
+      c.block_header = b.block_header;
+      c.path_size = static_cast<uint32_t>(b.merkle_path.size());
+      if (b.merkle_path.empty()) return c;
+
+      c.first_block_num = block_header::num_from_id(b.merkle_path.front());
+      c.id_suffixes.resize((b.merkle_path.size() - 1) * id_suffix_size);
+      auto out = c.id_suffixes.data();
+      for (size_t i = 0; i + 1 < b.merkle_path.size(); ++i, out += id_suffix_size) {
+         memcpy(out, b.merkle_path[i].data() + sizeof(uint32_t), id_suffix_size);
+      }
+      return c;
+   }
+
+   block_header_with_merkle_path expand() const {
+      block_header_with_merkle_path b{block_header};
+      if (path_size == 0) return b;
+
+      FC_ASSERT(id_suffixes.size() == (path_size - 1) * id_suffix_size, "invalid compact merkle path");
+      b.merkle_path.resize(path_size);
+      auto in = id_suffixes.data();
+      for (uint32_t i = 0; i + 1 < path_size; ++i, in += id_suffix_size) {
+         auto& id = b.merkle_path[i];
+         id._hash[0] = fc::endian_reverse_u32(first_block_num + i);
+         memcpy(id.data() + sizeof(uint32_t), in, id_suffix_size);
+      }
+      b.merkle_path.back() = block_header.header.previous;
+      return b;
+   }
+};
 struct icp_actions {
    block_header block_header;
    vector<digest_type> action_digests;
@@ -132,6 +180,17 @@ struct packet_receipt_request {
    }
 };
 
+// Packets [first_packet_seq, end_packet_seq) and receipts [first_receipt_seq, end_receipt_seq) to prove again,
+// each range is served with one `genproof` action per sequence, batched like inbound actions.
+struct packet_receipt_range_request {
+   uint64_t first_packet_seq = 0;
+   uint64_t end_packet_seq = 0;
+   uint64_t first_receipt_seq = 0;
+   uint64_t end_receipt_seq = 0;
+
+   bool empty() const { return first_packet_seq >= end_packet_seq and first_receipt_seq >= end_receipt_seq; }
+};
+
 using icp_message = fc::static_variant<
    hello,
    ping,
@@ -162,9 +221,11 @@ FC_REFLECT(eoc_icp::pong, (sent)(code))
 FC_REFLECT(eoc_icp::channel_seed, (seed))
 FC_REFLECT(eoc_icp::head_notice, (head))
 FC_REFLECT(eoc_icp::block_header_with_merkle_path, (block_header)(merkle_path))
+FC_REFLECT(eoc_icp::block_header_with_compact_merkle_path, (block_header)(first_block_num)(path_size)(id_suffixes))
 FC_REFLECT(eoc_icp::send_transaction_internal, (peer_action)(action)(action_receipt))
 FC_REFLECT(eoc_icp::icp_actions, (block_header)(action_digests)(start_packet_seq)(start_receipt_seq)(packet_actions)(receipt_actions)(receiptend_actions))
 FC_REFLECT(eoc_icp::packet_receipt_request, (packet_seq)(receipt_seq)(finalised_receipt))
+FC_REFLECT(eoc_icp::packet_receipt_range_request, (first_packet_seq)(end_packet_seq)(first_receipt_seq)(end_receipt_seq))
 
 FC_REFLECT(eoc_icp::icp_action, (action)(action_receipt)(block_id)(merkle_path))
 FC_REFLECT(eoc_icp::bytes_data, (data))
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <map>
+
+#include <fc/time.hpp>
+#include <fc/reflect/reflect.hpp>
+
+namespace eoc_icp {
+
+using std::string;
+using std::vector;
+
+/**
+ * Latency histogram with power of two millisecond buckets: bucket 0 counts latencies below 1ms,
+ * bucket i counts [2^(i-1), 2^i) ms, and the last bucket everything longer.
+ */
+class latency_histogram {
+public:
+   static constexpr size_t BUCKETS = 24;
+
+   struct summary {
+      uint64_t count = 0;
+      double avg_ms = 0;
+      uint64_t max_ms = 0;
+      uint64_t p50_ms = 0; // upper bound of the bucket holding the percentile
+      uint64_t p99_ms = 0;
+      vector<uint64_t> buckets;
+   };
+
+   void add(fc::microseconds latency) {
+      auto ms = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0) / 1000);
+      size_t i = 0;
+      while (i + 1 < BUCKETS and (uint64_t(1) << i) <= ms) ++i;
+      ++buckets_[i];
+      ++count_;
+      sum_ms_ += ms;
+      max_ms_ = std::max(max_ms_, ms);
+   }
+
+   summary summarize() const {
+      summary s;
+      s.count = count_;
+      s.max_ms = max_ms_;
+      if (count_ == 0) return s;
+
+      s.avg_ms = double(sum_ms_) / count_;
+      s.p50_ms = percentile(50);
+      s.p99_ms = percentile(99);
+      auto last = BUCKETS;
+      while (last > 0 and buckets_[last - 1] == 0) --last;
+      s.buckets.assign(buckets_.begin(), buckets_.begin() + last);
+      return s;
+   }
+
+private:
+   uint64_t percentile(uint64_t p) const {
+      uint64_t target = (count_ * p + 99) / 100, seen = 0;
+      for (size_t i = 0; i < BUCKETS; ++i) {
+         seen += buckets_[i];
+         if (seen >= target) return std::min(uint64_t(1) << i, max_ms_);
+      }
+      return max_ms_;
+   }
+
+   std::array<uint64_t, BUCKETS> buckets_{};
+   uint64_t count_ = 0;
+   uint64_t sum_ms_ = 0;
+   uint64_t max_ms_ = 0;
+};
+
+/**
+ * Timestamps of the stages a packet goes through on this relay, and histograms of the time between them.
+ *
+ * Outgoing packets: applied in a local block -> block irreversible -> `icp_actions` sent to the peer.
+ * Incoming packets: `icp_actions` received -> source block irreversible on the local contract (peer LIB)
+ * -> `onpacket` applied. Both ends of a packet are traced by their own relay, so no clocks are compared.
+ */
+class packet_metrics {
+public:
+   static constexpr size_t MAX_TRACES = 1024; // per direction, oldest sequences are dropped first
+
+   enum stage { applied, irreversible, sent, received, ready, delivered, num_stages };
+
+   struct trace {
+      uint64_t seq = 0;
+      bool outgoing = false;
+      vector<fc::time_point> stages = vector<fc::time_point>(num_stages); // zero if not reached
+   };
+
+   void mark(bool outgoing, uint64_t seq, stage s, fc::time_point now = fc::time_point::now()) {
+      auto& traces = outgoing ? outgoing_ : incoming_;
+      auto it = traces.find(seq);
+      if (it == traces.end()) {
+         if (s != first_stage(outgoing)) return; // started before the relay did, or already dropped
+         if (traces.size() >= MAX_TRACES) traces.erase(traces.begin());
+         it = traces.emplace(seq, trace{seq, outgoing}).first;
+      }
+
+      auto& t = it->second.stages;
+      if (t[s] != fc::time_point()) return; // first time only, e.g. a retried push
+      t[s] = now;
+      if (s > 0 and t[s - 1] != fc::time_point()) {
+         histograms_[s - 1].add(now - t[s - 1]);
+      }
+      if (s == delivered and t[received] != fc::time_point()) {
+         end_to_end_.add(now - t[received]);
+      }
+   }
+
+   // histogram of the time from `s` to the stage after it
+   const latency_histogram& stage_latency(stage s) const { return histograms_[s]; }
+   const latency_histogram& incoming_latency() const { return end_to_end_; }
+
+   vector<trace> recent(size_t n) const {
+      vector<trace> result;
+      for (auto* traces: {&outgoing_, &incoming_}) {
+         auto skip = traces->size() > n ? traces->size() - n : 0;
+         auto it = traces->begin();
+         std::advance(it, skip);
+         for (; it != traces->end(); ++it) result.push_back(it->second);
+      }
+      return result;
+   }
+
+   static const char* stage_name(stage s) {
+      static const char* names[] = {"applied", "irreversible", "sent", "received", "ready", "delivered"};
+      return names[s];
+   }
+
+   uint64_t genproof_requests_sent = 0;
+   uint64_t genproof_requests_received = 0;
+
+private:
+   static stage first_stage(bool outgoing) { return outgoing ? applied : received; }
+
+   std::map<uint64_t, trace> outgoing_;
+   std::map<uint64_t, trace> incoming_;
+   std::array<latency_histogram, num_stages> histograms_;
+   latency_histogram end_to_end_;
+};
+
+}
+
+FC_REFLECT(eoc_icp::latency_histogram::summary, (count)(avg_ms)(max_ms)(p50_ms)(p99_ms)(buckets))
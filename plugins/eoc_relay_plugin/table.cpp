@@ -0,0 +1,114 @@
+#include "table.hpp"
+
+#include <fc/io/raw.hpp>
+
+namespace eoc_icp {
+
+// secondary index positions, as packed into the table name by multi_index (position - 2)
+constexpr uint64_t INDEX_BLOCKSTATE_LIBBLOCKNUM = 3; // i128
+constexpr uint64_t INDEX_BLOCK_ID = 0; // sha256
+constexpr uint64_t INDEX_BLOCK_BLOCKNUM = 2; // i64
+
+const table_id_object* contract_tables::find_table(table_name table, uint64_t index_position) const {
+   // see multi_index packing of index name, the first secondary index shares the primary table id
+   table.value = (table.value & 0xFFFFFFFFFFFFFFF0ULL) | (index_position & 0x000000000000000FULL);
+   return chain_.db().find<table_id_object, by_code_scope_table>(boost::make_tuple(contract_, contract_, table));
+}
+
+template<typename Row>
+optional<Row> contract_tables::unpack_first_row(table_name table) const {
+   const auto* t_id = find_table(table);
+   if (not t_id) return optional<Row>();
+
+   const auto& idx = chain_.db().get_index<key_value_index, by_scope_primary>();
+   auto it = idx.lower_bound(boost::make_tuple(t_id->id));
+   if (it == idx.end() or it->t_id != t_id->id) return optional<Row>();
+
+   fc::datastream<const char*> ds(it->value.data(), it->value.size());
+   Row row;
+   fc::raw::unpack(ds, row);
+   return row;
+}
+
+optional<uint64_t> contract_tables::get_min_primary_key(table_name table) const {
+   const auto* t_id = find_table(table);
+   if (not t_id) return optional<uint64_t>();
+
+   const auto& idx = chain_.db().get_index<key_value_index, by_scope_primary>();
+   auto it = idx.lower_bound(boost::make_tuple(t_id->id));
+   if (it == idx.end() or it->t_id != t_id->id) return optional<uint64_t>();
+   return it->primary_key;
+}
+
+optional<blockstate_row> contract_tables::get_blockstate() const {
+   const auto& d = chain_.db();
+   const auto* t_id = find_table(TABLE_BLOCKSTATE);
+   const auto* index_t_id = find_table(TABLE_BLOCKSTATE, INDEX_BLOCKSTATE_LIBBLOCKNUM);
+   if (not t_id or not index_t_id) return optional<blockstate_row>();
+
+   const auto& secidx = d.get_index<index128_index, by_secondary>();
+   auto it = secidx.lower_bound(boost::make_tuple(index_t_id->id));
+   if (it == secidx.end() or it->t_id != index_t_id->id) return optional<blockstate_row>();
+
+   const auto* obj = d.find<key_value_object, by_scope_primary>(boost::make_tuple(t_id->id, it->primary_key));
+   if (not obj) return optional<blockstate_row>();
+
+   fc::datastream<const char*> ds(obj->value.data(), obj->value.size());
+   blockstate_row row;
+   fc::raw::unpack(ds, row);
+   return row;
+}
+
+optional<block_id_type> contract_tables::get_block_id(uint32_t block_num) const {
+   const auto& d = chain_.db();
+   const auto* num_t_id = find_table(TABLE_BLOCK, INDEX_BLOCK_BLOCKNUM);
+   const auto* id_t_id = find_table(TABLE_BLOCK, INDEX_BLOCK_ID);
+   if (not num_t_id or not id_t_id) return optional<block_id_type>();
+
+   const auto& numidx = d.get_index<index64_index, by_secondary>();
+   auto it = numidx.lower_bound(boost::make_tuple(num_t_id->id, uint64_t(block_num)));
+   if (it == numidx.end() or it->t_id != num_t_id->id or it->secondary_key != block_num) return optional<block_id_type>();
+
+   const auto* id_obj = d.find<index256_object, by_primary>(boost::make_tuple(id_t_id->id, it->primary_key));
+   if (not id_obj) return optional<block_id_type>();
+
+   block_id_type id;
+   memcpy(id._hash, id_obj->secondary_key.data(), sizeof(id._hash));
+   return id;
+}
+
+bool contract_tables::has_block(const block_id_type& id) const {
+   const auto* id_t_id = find_table(TABLE_BLOCK, INDEX_BLOCK_ID);
+   if (not id_t_id) return false;
+
+   key256_t k; // same layout as the sha256/hex key type of get_table_rows
+   memcpy(k.data(), id._hash, sizeof(id._hash));
+
+   const auto& idx = chain_.db().get_index<index256_index, by_secondary>();
+   auto it = idx.lower_bound(boost::make_tuple(id_t_id->id, k));
+   return it != idx.end() and it->t_id == id_t_id->id and it->secondary_key == k;
+}
+
+optional<uint32_t> contract_tables::get_min_block_num() const {
+   const auto* num_t_id = find_table(TABLE_BLOCK, INDEX_BLOCK_BLOCKNUM);
+   if (not num_t_id) return optional<uint32_t>();
+
+   const auto& numidx = chain_.db().get_index<index64_index, by_secondary>();
+   auto it = numidx.lower_bound(boost::make_tuple(num_t_id->id));
+   if (it == numidx.end() or it->t_id != num_t_id->id) return optional<uint32_t>();
+   return static_cast<uint32_t>(it->secondary_key);
+}
+
+optional<peer_row> contract_tables::get_peer() const {
+   return unpack_first_row<peer_row>(TABLE_PEER);
+}
+
+optional<uint64_t> contract_tables::get_min_packet_seq() const {
+   return get_min_primary_key(TABLE_PACKETS); // primary key is the packet seq
+}
+
+optional<uint64_t> contract_tables::get_min_receipt_seq() const {
+   return get_min_primary_key(TABLE_RECEIPTS); // primary key is the receipt seq
+}
+
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <eosio/chain/controller.hpp>
+#include <eosio/chain/contract_table_objects.hpp>
+
+#include "api.hpp"
+
+namespace eoc_icp {
+
+using namespace eosio;
+using namespace eosio::chain;
+
+static const table_name TABLE_BLOCKSTATE{"blockstate"};
+static const table_name TABLE_BLOCK{"block"};
+static const table_name TABLE_PEER{"peer"};
+static const table_name TABLE_PACKETS{"packets"};
+static const table_name TABLE_RECEIPTS{"receipts"};
+
+// Leading fields of a `blockstate` row, which is stored as a `block_header_state`.
+// fc::raw unpacking stops after the last declared field, the rest of the row is never touched.
+struct blockstate_row {
+   block_id_type id;
+   uint32_t block_num = 0;
+   signed_block_header header;
+   uint32_t dpos_proposed_irreversible_blocknum = 0;
+   uint32_t dpos_irreversible_blocknum = 0;
+   uint32_t bft_irreversible_blocknum = 0;
+};
+
+// Leading fields of the singleton `peer` row.
+struct peer_row {
+   uint64_t last_outgoing_packet_seq = 0;
+   uint64_t last_incoming_packet_seq = 0;
+   uint64_t last_outgoing_receipt_seq = 0;
+   uint64_t last_incoming_receipt_seq = 0;
+   uint64_t last_finalised_outgoing_receipt_seq = 0;
+   uint32_t last_incoming_packet_block_num = 0;
+   uint32_t last_incoming_receipt_block_num = 0;
+   uint32_t last_incoming_receiptend_block_num = 0;
+};
+
+/**
+ * Typed, read-only access to the tables of the local icp contract.
+ *
+ * Rows are read straight from the chainbase `key_value_object`s and secondary index objects,
+ * without going through the contract ABI. Block ids/numbers and packet/receipt sequences are
+ * taken from the index keys, so only `blockstate` and `peer` rows are actually unpacked.
+ */
+class contract_tables {
+public:
+   contract_tables(const controller& chain, account_name contract) : chain_(chain), contract_(contract) {}
+
+   optional<blockstate_row> get_blockstate() const; // first row by `libblocknum`
+   optional<block_id_type> get_block_id(uint32_t block_num) const;
+   bool has_block(const block_id_type& id) const;
+   optional<uint32_t> get_min_block_num() const;
+
+   optional<peer_row> get_peer() const;
+   optional<uint64_t> get_min_packet_seq() const;
+   optional<uint64_t> get_min_receipt_seq() const;
+
+private:
+   const table_id_object* find_table(table_name table, uint64_t index_position = 0) const;
+   optional<uint64_t> get_min_primary_key(table_name table) const;
+
+   template<typename Row>
+   optional<Row> unpack_first_row(table_name table) const;
+
+   const controller& chain_;
+   account_name contract_;
+};
+
+/**
+ * Caches the head and sequence read from the contract tables for the current head block and pending block.
+ * Must be invalidated whenever a transaction touching the contract is applied.
+ *
+ * Holding the pending block state keeps its address from being reused, so a pending block that is aborted
+ * and started again at the same head is never mistaken for the one the values were read in.
+ */
+struct contract_tables_cache {
+   block_id_type head_block_id;
+   block_state_ptr pending;
+   head_ptr head;
+   sequence_ptr sequence;
+   sequence_ptr sequence_with_min;
+
+   bool valid_for(const controller& chain) const {
+      return head_block_id == chain.head_block_id() && pending == chain.pending_block_state();
+   }
+
+   void reset(const controller& chain) {
+      reset();
+      head_block_id = chain.head_block_id();
+      pending = chain.pending_block_state();
+   }
+
+   void reset() {
+      head_block_id = block_id_type();
+      pending.reset();
+      head.reset();
+      sequence.reset();
+      sequence_with_min.reset();
+   }
+};
+
+}
+
+FC_REFLECT(eoc_icp::blockstate_row, (id)(block_num)(header)(dpos_proposed_irreversible_blocknum)(dpos_irreversible_blocknum)(bft_irreversible_blocknum))
+FC_REFLECT(eoc_icp::peer_row, (last_outgoing_packet_seq)(last_incoming_packet_seq)(last_outgoing_receipt_seq)(last_incoming_receipt_seq)
+                              (last_finalised_outgoing_receipt_seq)(last_incoming_packet_block_num)(last_incoming_receipt_block_num)
+                              (last_incoming_receiptend_block_num))
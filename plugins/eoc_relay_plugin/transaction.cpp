@@ -1,5 +1,6 @@
 #include "icp_relay.hpp"
 
+#include <eosio/chain/global_property_object.hpp>
 #include <eosio/producer_plugin/producer_plugin.hpp>
 #include <fc/io/json.hpp>
 
@@ -129,4 +130,86 @@ void relay::push_transaction(vector<action> actions, function<void(bool)> callba
    });
 }
 
+struct relay::action_batches {
+   using range = std::pair<size_t, size_t>; // [first, last) of `actions`
+
+   vector<action> actions;
+   function<void(size_t, size_t)> on_applied;
+   vector<range> failed; // in the current round
+   size_t outstanding = 0;
+};
+
+uint32_t relay::max_batch_size() const {
+   if (max_batch_actions_ <= 1 or action_cpu_estimate_us_ == 0) return std::max(max_batch_actions_, 1u);
+
+   auto& chain = app().get_plugin<chain_plugin>().chain();
+   uint32_t cpu_budget_us = chain.get_global_properties().configuration.max_transaction_cpu_usage;
+   if (tx_max_cpu_usage_ > 0) cpu_budget_us = std::min(cpu_budget_us, uint32_t(tx_max_cpu_usage_) * 1000);
+   return std::max(1u, std::min(max_batch_actions_, cpu_budget_us / action_cpu_estimate_us_));
+}
+
+void relay::push_action_batches(vector<action> actions, function<void(size_t, size_t)> on_applied) {
+   if (actions.empty()) return;
+
+   auto b = std::make_shared<action_batches>();
+   b->actions = move(actions);
+   b->on_applied = move(on_applied);
+   vector<action_batches::range> batches;
+   auto batch_size = max_batch_size();
+   for (size_t first = 0; first < b->actions.size(); first += batch_size) {
+      batches.emplace_back(first, std::min(b->actions.size(), first + batch_size));
+   }
+   submit_action_batches(b, move(batches));
+}
+
+// Submits all pending batches back to back, without waiting for each other.
+// Once every batch of a round has completed, each failed batch is split in half and resubmitted in
+// sequence order, so actions rejected only because an earlier one failed get applied in the next round.
+// A single action which still fails is skipped, as it would have been when pushed on its own.
+void relay::submit_action_batches(const std::shared_ptr<action_batches>& b, vector<action_batches::range> batches) {
+   b->outstanding = batches.size();
+   for (auto r: batches) {
+      vector<action> batch(b->actions.begin() + r.first, b->actions.begin() + r.second);
+
+      auto done = [this, b, r](bool success) {
+         if (success) {
+            if (b->on_applied) b->on_applied(r.first, r.second);
+            if (relayed_actions_.add(r.second - r.first)) {
+               ilog("relayed ${n} icp actions, ${r} actions/sec", ("n", relayed_actions_.total)("r", relayed_actions_.per_second));
+            }
+         } else {
+            b->failed.push_back(r);
+         }
+         if (--b->outstanding > 0) return;
+
+         std::sort(b->failed.begin(), b->failed.end());
+         vector<action_batches::range> retries;
+         for (auto& f: b->failed) {
+            if (f.second - f.first > 1) {
+               auto middle = f.first + (f.second - f.first) / 2;
+               retries.emplace_back(f.first, middle);
+               retries.emplace_back(middle, f.second);
+            } else {
+               wlog("skip icp action ${a} which failed on its own", ("a", b->actions[f.first].name));
+            }
+         }
+         b->failed.clear();
+         if (not retries.empty()) {
+            app().get_io_service().post([this, b, retries] { submit_action_batches(b, retries); });
+         }
+      };
+
+      // a push that throws before handing the transaction on never calls back, so report it as failed here
+      try {
+         push_transaction(move(batch), done);
+      } catch (const fc::exception& e) {
+         elog("cannot push icp actions [${f}, ${l}): ${e}", ("f", r.first)("l", r.second)("e", e.to_detail_string()));
+         done(false);
+      } catch (const std::exception& e) {
+         elog("cannot push icp actions [${f}, ${l}): ${e}", ("f", r.first)("l", r.second)("e", e.what()));
+         done(false);
+      }
+   }
+}
+
 }
@@ -57,6 +57,7 @@ struct async_result_visitor : public fc::visitor<std::string> {
 
 #define ICP_RELAY_RO_CALL(call_name, http_response_code) CALL(eoc_icp, ro_api, eoc_icp::read_only, call_name, http_response_code)
 #define ICP_RELAY_RW_CALL(call_name, http_response_code) CALL(eoc_icp, rw_api, eoc_icp::read_write, call_name, http_response_code)
+#define ICP_METRICS_CALL(call_name, http_response_code) CALL(icp, ro_api, eoc_icp::read_only, call_name, http_response_code)
 #define ICP_RELAY_RW_CALL_ASYNC(call_name, call_result, http_response_code) CALL_ASYNC(eoc_icp, rw_api, eoc_icp::read_write, call_name, call_result, http_response_code)
 
 void icp_relay_api_plugin::plugin_startup() {
@@ -69,7 +70,9 @@ void icp_relay_api_plugin::plugin_startup() {
    _http_plugin.add_api({
       ICP_RELAY_RO_CALL(get_info, 200),
       ICP_RELAY_RO_CALL(get_block, 200),
-      ICP_RELAY_RW_CALL(open_channel, 200)
+      ICP_RELAY_RO_CALL(get_connections, 200),
+      ICP_RELAY_RW_CALL(open_channel, 200),
+      ICP_METRICS_CALL(metrics, 200)
    });
 }
 
@@ -88,27 +88,9 @@ namespace eosio {
                   const std::string& path) { return call( url, path, fc::variant() ); }
 
 
-   auto abi_serializer_resolver = [](const name& account) -> optional<abi_serializer> {
-   static unordered_map<account_name, optional<abi_serializer> > abi_cache;
-   auto it = abi_cache.find( account );
-   if ( it == abi_cache.end() ) {
-      eosio::chain_apis::read_only::get_abi_params abi_param;
-      abi_param.account_name= account;
-      eosio::chain_apis::read_only readonlydata = app().get_plugin<chain_plugin>().get_read_only_api();
-      eosio::chain_apis::read_only::get_abi_results  abi_results=readonlydata.get_abi( abi_param );
-      optional<abi_serializer> abis;
-      if( abi_results.abi.valid() ) {
-         abis.emplace( *abi_results.abi, abi_serializer_max_time );
-      } else {
-         std::cerr << "ABI for contract " << account.to_string() << " not found. Action data will be shown in hex only." << std::endl;
-      }
-      abi_cache.emplace( account, abis );
-
-      return abis;
-   }
-
-   return it->second;
-    };
+   auto abi_serializer_resolver = [](const name& account) -> std::shared_ptr<const abi_serializer> {
+      return app().get_plugin<chain_plugin>().chain().get_cached_abi_serializer( account, abi_serializer_max_time );
+   };
 
 
    
@@ -258,7 +240,7 @@ namespace eosio {
         eosio::chain::bytes databytes;
         try{  
             auto abis = abi_serializer_resolver( account );
-            if(abis.valid() == false )
+            if( !abis )
                 return databytes; 
             auto action_type = abis->get_action_type( action );
             if(action_type.empty() )
@@ -17,6 +17,20 @@ namespace eosio {
       handshake_message last_handshake;
    };
 
+   /// memory held to avoid relaying a transaction or block to a peer twice
+   struct dedup_status {
+      uint32_t local_txns = 0;          ///< transactions known to this node
+      uint64_t local_txn_bytes = 0;     ///< serialized copies of them kept for relaying
+      uint32_t local_expiry_keys = 0;   ///< ids waiting for expiry, some already erased as irreversible
+      uint32_t peer_txns = 0;           ///< transaction ids known per peer, over all connections
+      uint32_t peer_blocks = 0;         ///< block ids known per peer, over all connections
+      uint32_t peer_expiry_keys = 0;
+      uint64_t approx_bytes = 0;        ///< all of the above including container overhead, estimated
+      uint64_t expired_txns = 0;        ///< local transactions expired since startup
+      uint64_t last_sweep_us = 0;
+      bool     sweep_behind = false;    ///< the last expiry sweep ran out of time and continues shortly
+   };
+
    class net_plugin : public appbase::plugin<net_plugin>
    {
       public:
@@ -36,6 +50,7 @@ namespace eosio {
         string                       disconnect( const string& endpoint );
         optional<connection_status>  status( const string& endpoint )const;
         vector<connection_status>    connections()const;
+        dedup_status                 dedup_stats()const;
 
         size_t num_peers() const;
       private:
@@ -45,3 +60,5 @@ namespace eosio {
 }
 
 FC_REFLECT( eosio::connection_status, (peer)(connecting)(syncing)(last_handshake) )
+FC_REFLECT( eosio::dedup_status, (local_txns)(local_txn_bytes)(local_expiry_keys)(peer_txns)(peer_blocks)(peer_expiry_keys)
+            (approx_bytes)(expired_txns)(last_sweep_us)(sweep_behind) )
@@ -134,6 +134,21 @@ namespace eosio {
     signed_block               signedblock;                   
   };
 
+  /**
+   * Contiguous blocks of this chain for a peer on another chain: blocks[i] is block first_block_num + i,
+   * a packed signed_block compressed with zlib.
+   */
+  struct difchain_block_stream {
+    uint32_t                   first_block_num = 0;
+    vector<bytes>              blocks;
+  };
+
+  /// blocks [next_block_num, next_block_num + credit) the receiver of difchain_block_stream is ready for
+  struct difchain_stream_credit {
+    uint32_t                   next_block_num = 0;
+    uint32_t                   credit = 0;
+  };
+
   struct request_message {
     request_message () : req_trx(), req_blocks() {}
     ordered_txn_ids req_trx;
@@ -176,7 +191,9 @@ namespace eosio {
                                       difchain_message,
                                       block_header_with_merkle_path,
                                       channel_seed,
-                                      icp_actions>;
+                                      icp_actions,
+                                      difchain_block_stream,
+                                      difchain_stream_credit>;
 
 } // namespace eosio
 
@@ -196,6 +213,8 @@ FC_REFLECT( eosio::notice_message, (known_trx)(known_blocks) )
 FC_REFLECT( eosio::request_message, (req_trx)(req_blocks) )
 FC_REFLECT( eosio::sync_request_message, (start_block)(end_block) )
 FC_REFLECT( eosio::difchain_message, (network_version)(chain_id)(signedblock))
+FC_REFLECT( eosio::difchain_block_stream, (first_block_num)(blocks))
+FC_REFLECT( eosio::difchain_stream_credit, (next_block_num)(credit))
 FC_REFLECT( eosio::block_header_with_merkle_path,(block_header)(merkle_path))
 FC_REFLECT( eosio::channel_seed,(seed))
 FC_REFLECT( eosio::icp_actions,(block_header)(action_digests)(peer_actions)(actions)(action_receipts))
@@ -9,6 +9,7 @@
 #include <eosio/chain/controller.hpp>
 #include <eosio/chain/exceptions.hpp>
 #include <eosio/chain/block.hpp>
+#include <eosio/chain/block_log.hpp>
 #include <eosio/chain/plugin_interface.hpp>
 #include <eosio/producer_plugin/producer_plugin.hpp>
 #include <eosio/utilities/key_conversion.hpp>
@@ -27,7 +28,12 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/host_name.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/bind_executor.hpp>
 #include <boost/intrusive/set.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
 #include <eosio/eoc_relay_plugin/eoc_relay_plugin.hpp>
 //#include <eosio/net_difchain_plugin/net_difchain_plugin.hpp>
 using namespace eosio::chain::plugin_interface::compat;
@@ -51,6 +57,7 @@ namespace eosio {
    using fc::time_point_sec;
    using eosio::chain::transaction_id_type;
    namespace bip = boost::interprocess;
+   namespace bio = boost::iostreams;
 
    class connection;
 
@@ -73,13 +80,103 @@ namespace eosio {
       return r;
    }
 
+   /**
+    * Hierarchical timing wheel of keys by expiration second.
+    *
+    * Keys due within `slots` seconds sit in a per second slot, keys due within `slots * slots` seconds in a
+    * per `slots` seconds slot that is moved down a level when its window starts, anything later in an
+    * ordered overflow. Adding is O(1) for the first two levels and expiring walks only the slots that fell
+    * due, so a sweep can stop after any key and pick up there on the next one. The wheel holds no other
+    * state: the owner looks each due key up and adds it back if its expiration was pushed out meanwhile.
+    */
+   template<typename Key>
+   class expiry_wheel {
+   public:
+      static constexpr uint32_t slots = 64;
+
+      void add( const Key& k, time_point_sec expires ) {
+         if( size_ == 0 )
+            cur_ = std::max( cur_, time_point_sec( time_point::now() ).sec_since_epoch() );
+         ++size_;
+         place( k, std::max( expires.sec_since_epoch(), cur_ ) );
+      }
+
+      /// calls `on_due` for at most `max_keys` keys due at or before `now`, returns the number of keys passed
+      template<typename F>
+      size_t expire( time_point_sec now, size_t max_keys, F&& on_due ) {
+         const uint32_t now_sec = now.sec_since_epoch();
+         size_t n = 0;
+         while( cur_ <= now_sec ) {
+            if( size_ == overflow_.size() ) { // both levels empty, skip ahead instead of walking every second
+               if( overflow_.empty() ) {
+                  cur_ = now_sec + 1;
+                  break;
+               }
+               uint32_t first = overflow_.begin()->first;
+               cur_ = std::max( cur_, std::min( now_sec, first - first % slots - (slots - 1) * slots ) );
+               pull_overflow();
+            }
+            auto& due = near_[cur_ % slots];
+            while( !due.empty() ) {
+               if( n == max_keys )
+                  return n;
+               Key k = std::move( due.back() );
+               due.pop_back();
+               --size_;
+               ++n;
+               on_due( k );
+            }
+            if( ++cur_ % slots == 0 )
+               cascade();
+         }
+         return n;
+      }
+
+      /// keys due at or before `now` are left
+      bool behind( time_point_sec now )const { return size_ > 0 && cur_ <= now.sec_since_epoch(); }
+      size_t size()const { return size_; }
+
+   private:
+      void place( const Key& k, uint32_t expires ) {
+         uint32_t delta = expires - cur_;
+         if( delta < slots )
+            near_[expires % slots].push_back( k );
+         else if( delta < slots * slots )
+            far_[(expires / slots) % slots].emplace_back( expires, k );
+         else
+            overflow_.emplace( expires, k );
+      }
+
+      /// a new window of `slots` seconds started at cur_, spread its keys over the per second slots
+      void cascade() {
+         pull_overflow();
+         auto window = std::move( far_[(cur_ / slots) % slots] );
+         far_[(cur_ / slots) % slots].clear();
+         for( const auto& e : window )
+            place( e.second, e.first );
+      }
+
+      void pull_overflow() {
+         while( !overflow_.empty() && overflow_.begin()->first < cur_ + slots * slots ) {
+            place( overflow_.begin()->second, overflow_.begin()->first );
+            overflow_.erase( overflow_.begin() );
+         }
+      }
+
+      uint32_t                                                   cur_ = 0; ///< next second to expire
+      size_t                                                     size_ = 0;
+      std::array<vector<Key>, slots>                             near_;
+      std::array<vector<std::pair<uint32_t, Key>>, slots>        far_;
+      std::multimap<uint32_t, Key>                               overflow_;
+   };
+
    struct node_transaction_state {
       transaction_id_type id;
       time_point_sec  expires;  /// time after which this may be purged.
                                 /// Expires increased while the txn is
                                 /// "in flight" to anoher peer
       packed_transaction packed_txn;
-      vector<char>    serialized_txn; /// the received raw bundle
+      std::shared_ptr<vector<char>> serialized_txn; /// the received raw bundle, shared with the write queues
       uint32_t        block_num = 0; /// block transaction was included in
       uint32_t        true_block = 0; /// used to reset block_uum when request is 0
       uint16_t        requests = 0; /// the number of "in flight" requests for this txn
@@ -102,7 +199,6 @@ namespace eosio {
       }
    } incr_in_flight(1), decr_in_flight(-1);
 
-   struct by_expiry;
    struct by_block_num;
 
    typedef multi_index_container<
@@ -113,12 +209,6 @@ namespace eosio {
             member < node_transaction_state,
                      transaction_id_type,
                      &node_transaction_state::id > >,
-         ordered_non_unique<
-            tag< by_expiry >,
-            member< node_transaction_state,
-                    fc::time_point_sec,
-                    &node_transaction_state::expires >
-            >,
          ordered_non_unique<
             tag<by_block_num>,
             member< node_transaction_state,
@@ -177,16 +267,31 @@ namespace eosio {
       int                           started_sessions = 0;
 
       node_transaction_index        local_txns;
+      expiry_wheel<transaction_id_type> local_txn_expiry; ///< expiration order of local_txns
+      uint64_t                      local_txn_bytes = 0; ///< serialized transactions held in local_txns
+      uint64_t                      expired_txns = 0;
+      fc::microseconds              last_txn_sweep;
+      bool                          txn_sweep_behind = false; ///< the last sweep ran out of time
 
       shared_ptr<tcp::resolver>     resolver;
 
       bool                          use_socket_read_watermark = false;
 
+      /// sockets, message framing and unpacking run here, everything else on the application thread
+      uint32_t                      net_thread_count = 1;
+      unique_ptr<boost::asio::io_context> net_ioc;
+      unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> net_ioc_work;
+      vector<std::thread>           net_threads;
+
+      uint32_t                      difchain_stream_window = 0;
+      uint32_t                      difchain_stream_batch = 1;
+
       channels::transaction_ack::channel_type::handle  incoming_transaction_ack_subscription;
 
       void connect( connection_ptr c );
       void connect( connection_ptr c, tcp::resolver::iterator endpoint_itr );
-      bool start_session( connection_ptr c );
+      void start_session( connection_ptr c );
+      static boost::system::error_code prepare_socket( tcp::socket& s, tcp::endpoint& remote, tcp::endpoint& local );
       void start_listen_loop( );
       void start_read_message( connection_ptr c);
 
@@ -195,6 +300,8 @@ namespace eosio {
 
       template<typename VerifierFunc>
       void send_all( const net_message &msg, VerifierFunc verify );
+      template<typename VerifierFunc>
+      void send_all( const std::shared_ptr<vector<char>>& send_buffer, VerifierFunc verify );
 
       void accepted_block_header(const block_state_ptr&);
       void accepted_block(const block_state_ptr&);
@@ -229,17 +336,22 @@ namespace eosio {
       void handle_message( connection_ptr c, const request_message &msg);
       void handle_message( connection_ptr c, const sync_request_message &msg);
       void handle_message( connection_ptr c, const signed_block &msg);
+      void process_block( connection_ptr c, const signed_block &msg);
       void handle_message( connection_ptr c, const packed_transaction &msg);
       void handle_message( connection_ptr c, const difchain_message &msg);
+      void handle_message( connection_ptr c, const difchain_block_stream &msg);
+      void handle_message( connection_ptr c, const difchain_stream_credit &msg);
       void handle_message( connection_ptr c, const block_header_with_merkle_path& msg);
       void handle_message( connection_ptr c, const channel_seed& msg);
       void handle_message( connection_ptr c, const icp_actions& msg);
 
       void start_conn_timer(boost::asio::steady_timer::duration du, std::weak_ptr<connection> from_connection);
-      void start_txn_timer( );
+      void start_txn_timer( boost::asio::steady_timer::duration du );
       void start_monitors( );
 
       void expire_txns( );
+      bool expire_local_txns( time_point_sec now, uint32_t lib, const time_point& max_time );
+      bool expire_peer_state( const connection_ptr& c, time_point_sec now, uint32_t lib, const time_point& max_time );
       void connection_monitor(std::weak_ptr<connection> from_connection);
       /** \name Peer Timestamps
        *  Time message handling
@@ -330,7 +442,12 @@ namespace eosio {
    constexpr auto     def_txn_expire_wait = std::chrono::seconds(3);
    constexpr auto     def_resp_expected_wait = std::chrono::seconds(5);
    constexpr auto     def_sync_fetch_span = 100;
+   constexpr auto     def_sync_fetch_peers = 4;
    constexpr uint32_t  def_max_just_send = 1500; // roughly 1 "mtu"
+   constexpr uint32_t  def_net_threads = 1;
+   constexpr uint32_t  def_difchain_stream_window = 200; // blocks
+   constexpr uint32_t  def_difchain_stream_batch = 50; // blocks
+   constexpr size_t    expire_chunk = 64; // entries expired between checks of max-cleanup-time-msec
    constexpr bool     large_msg_notify = false;
 
    constexpr auto     message_header_size = 4;
@@ -355,8 +472,9 @@ namespace eosio {
     */
    constexpr uint16_t proto_base = 0;
    constexpr uint16_t proto_explicit_sync = 1;
+   constexpr uint16_t proto_difchain_stream = 2;      // difchain_block_stream under a difchain_stream_credit window
 
-   constexpr uint16_t net_version = proto_explicit_sync;
+   constexpr uint16_t net_version = proto_difchain_stream;
 
    /**
     *  Index by id
@@ -386,7 +504,6 @@ namespace eosio {
       transaction_state,
       indexed_by<
          ordered_unique< tag<by_id>, member<transaction_state, transaction_id_type, &transaction_state::id > >,
-         ordered_non_unique< tag< by_expiry >, member< transaction_state,fc::time_point_sec,&transaction_state::expires >>,
          ordered_non_unique<
             tag<by_block_num>,
             member< transaction_state,
@@ -476,15 +593,18 @@ namespace eosio {
    public:
       explicit connection( string endpoint );
 
-      explicit connection( socket_ptr s );
+      connection( socket_ptr s, const tcp::endpoint& remote, const tcp::endpoint& local );
       ~connection();
       void initialize();
       void update_chainid(const chain_id_type & chainid);
       const chain_id_type& get_chainid();
       peer_block_state_index  blk_state;
       transaction_state_index trx_state;
+      expiry_wheel<transaction_id_type> trx_expiry; ///< expiration order of trx_state
       optional<sync_state>    peer_requested;  // this peer is requesting info from us
       socket_ptr              socket;
+      /// serializes the socket and pending_message_buffer on the net threads
+      boost::asio::strand<boost::asio::io_context::executor_type> strand;
 
       fc::message_buffer<1024*1024>    pending_message_buffer;
       fc::optional<std::size_t>        outstanding_read_bytes;
@@ -503,7 +623,16 @@ namespace eosio {
       bool                    connecting = false;
       bool                    syncing = false;
       uint16_t                protocol_version  = 0;
+      /// window granted by a peer on another chain, the next block to stream to it and the first one past the window
+      uint32_t                difchain_next_block = 0;
+      uint32_t                difchain_block_limit = 0;
       string                  peer_addr;
+      const string            endpoint_name;       ///< fixed at creation, for logging on the net threads where peer_name() would race
+      /// whether the socket is open, kept by the application thread which must not ask the socket itself since
+      /// only the strand touches it; the endpoints are those of the socket as last opened
+      bool                    socket_open = false;
+      tcp::endpoint           remote_endpoint;
+      tcp::endpoint           local_endpoint;
       unique_ptr<boost::asio::steady_timer> response_expected;
       optional<request_message> pending_fetch;
       go_away_reason         no_retry = no_reason;
@@ -549,7 +678,8 @@ namespace eosio {
       void send_handshake();
       //Breeze send different chain message
       void send_difchainmsg();
-      const tcp::socket& get_socket(); 
+      void send_difchain_stream();
+      void send_difchain_credit(uint32_t next_block_num);
      
       /** \name Peer Timestamps
        *  Time message handling
@@ -587,6 +717,13 @@ namespace eosio {
       void stop_send();
 
       void enqueue( const net_message &msg, bool trigger_send = true );
+      /** \brief Queue a message already serialized by create_send_buffer
+       *
+       * The buffer is not copied, so a broadcast serializes a message once and
+       * every connection's write queue refers to the same bytes.
+       */
+      void enqueue_buffer( const std::shared_ptr<vector<char>>& send_buffer, bool trigger_send = true,
+                           go_away_reason close_after_send = no_reason );
       void cancel_sync(go_away_reason);
       void flush_queues();
       bool enqueue_sync_block();
@@ -619,14 +756,11 @@ namespace eosio {
       fc::optional<fc::variant_object> _logger_variant;
       const fc::variant_object& get_logger_variant()  {
          if (!_logger_variant) {
-            boost::system::error_code ec;
-            auto rep = socket->remote_endpoint(ec);
-            string ip = ec ? "<unknown>" : rep.address().to_string();
-            string port = ec ? "<unknown>" : std::to_string(rep.port());
+            string ip = socket_open ? remote_endpoint.address().to_string() : "<unknown>";
+            string port = socket_open ? std::to_string(remote_endpoint.port()) : "<unknown>";
 
-            auto lep = socket->local_endpoint(ec);
-            string lip = ec ? "<unknown>" : lep.address().to_string();
-            string lport = ec ? "<unknown>" : std::to_string(lep.port());
+            string lip = socket_open ? local_endpoint.address().to_string() : "<unknown>";
+            string lport = socket_open ? std::to_string(local_endpoint.port()) : "<unknown>";
 
             _logger_variant.emplace(fc::mutable_variant_object()
                ("_name", peer_name())
@@ -662,30 +796,51 @@ namespace eosio {
          in_sync
       };
 
+      struct sync_range {
+         connection_ptr peer;
+         uint32_t       next = 0; ///< next block expected from peer, a range is sent in order
+         uint32_t       end = 0;
+      };
+
+      struct buffered_block {
+         connection_ptr   peer;
+         signed_block_ptr block;
+      };
+
       uint32_t       sync_known_lib_num;
       uint32_t       sync_last_requested_num;
       uint32_t       sync_next_expected_num;
       uint32_t       sync_req_span;
-      connection_ptr source;
+      uint32_t       sync_max_peers;
+      vector<sync_range>                 sync_ranges;     ///< in flight, at most one per peer
+      std::map<uint32_t, uint32_t>       sync_unassigned; ///< start -> end, given up by slow or closed peers
+      std::map<uint32_t, buffered_block> sync_buffer;     ///< arrived ahead of sync_next_expected_num
+      time_point     sync_rate_start;
+      uint32_t       sync_rate_blocks = 0;
       stages         state;
 
       chain_plugin* chain_plug = nullptr;
 
       constexpr auto stage_str(stages s );
+      bool release_range(connection_ptr c);
+      void reset_ranges();
+      void report_sync_rate();
 
    public:
-      explicit sync_manager(uint32_t span);
+      sync_manager(uint32_t span, uint32_t max_peers);
       void set_state(stages s);
       bool sync_required();
       void send_handshakes();
       bool is_active(connection_ptr conn);
       void reset_lib_num(connection_ptr conn);
-      void request_next_chunk(connection_ptr conn = connection_ptr() );
+      void request_next_chunk(connection_ptr conn = connection_ptr(), connection_ptr skip = connection_ptr() );
       void start_sync(connection_ptr c, uint32_t target);
       void reassign_fetch(connection_ptr c, go_away_reason reason);
       void verify_catchup(connection_ptr c, uint32_t num, block_id_type id);
       void rejected_block(connection_ptr c, uint32_t blk_num);
       void recv_block(connection_ptr c, const block_id_type &blk_id, uint32_t blk_num);
+      bool buffer_block(connection_ptr c, const signed_block& blk);
+      signed_block_ptr next_buffered_block(connection_ptr& from);
       void recv_handshake(connection_ptr c, const handshake_message& msg);
       void recv_notice(connection_ptr c, const notice_message& msg);
    };
@@ -717,7 +872,8 @@ namespace eosio {
       : blk_state(),
         trx_state(),
         peer_requested(),
-        socket( std::make_shared<tcp::socket>( std::ref( app().get_io_service() ))),
+        socket( std::make_shared<tcp::socket>( std::ref( *my_impl->net_ioc ))),
+        strand( my_impl->net_ioc->get_executor() ),
         node_id(),
         last_handshake_recv(),
         last_handshake_sent(),
@@ -726,6 +882,7 @@ namespace eosio {
         syncing(false),
         protocol_version(0),
         peer_addr(endpoint),
+        endpoint_name(endpoint),
         response_expected(),
         pending_fetch(),
         no_retry(no_reason),
@@ -738,11 +895,12 @@ namespace eosio {
       initialize();
    }
 
-   connection::connection( socket_ptr s )
+   connection::connection( socket_ptr s, const tcp::endpoint& remote, const tcp::endpoint& local )
       : blk_state(),
         trx_state(),
         peer_requested(),
         socket( s ),
+        strand( my_impl->net_ioc->get_executor() ),
         node_id(),
         last_handshake_recv(),
         last_handshake_sent(),
@@ -751,6 +909,10 @@ namespace eosio {
         syncing(false),
         protocol_version(0),
         peer_addr(),
+        endpoint_name(remote.address().to_string() + ":" + std::to_string(remote.port())),
+        socket_open(true),
+        remote_endpoint(remote),
+        local_endpoint(local),
         response_expected(),
         pending_fetch(),
         no_retry(no_reason),
@@ -772,7 +934,7 @@ namespace eosio {
    }
 
    bool connection::connected() {
-      return (socket && socket->is_open() && !connecting);
+      return (socket_open && !connecting);
    }
 
    bool connection::current() {
@@ -783,6 +945,9 @@ namespace eosio {
       peer_requested.reset();
       blk_state.clear();
       trx_state.clear();
+      trx_expiry = expiry_wheel<transaction_id_type>();
+      difchain_next_block = 0;
+      difchain_block_limit = 0;
    }
 
    void connection::flush_queues() {
@@ -791,12 +956,17 @@ namespace eosio {
 
    void connection::close() {
       if(socket) {
-         socket->close();
+         boost::asio::post(strand, [self = shared_from_this()] {
+            boost::system::error_code ec;
+            self->socket->close(ec);
+            self->pending_message_buffer.reset();
+         });
       }
       else {
          wlog("no socket to close!");
       }
       flush_queues();
+      socket_open = false;
       connecting = false;
       syncing = false;
       if( last_req ) {
@@ -809,7 +979,6 @@ namespace eosio {
       my_impl->sync_master->reset_lib_num(shared_from_this());
       fc_dlog(logger, "canceling wait on ${p}", ("p",peer_name()));
       cancel_wait();
-      pending_message_buffer.reset();
    }
 
    void connection::update_chainid(const chain_id_type & chainid)
@@ -826,7 +995,7 @@ namespace eosio {
 
    void connection::txn_send_pending(const vector<transaction_id_type> &ids) {
       for(auto tx = my_impl->local_txns.begin(); tx != my_impl->local_txns.end(); ++tx ){
-         if(tx->serialized_txn.size() && tx->block_num == 0) {
+         if(tx->serialized_txn && tx->block_num == 0) {
             bool found = false;
             for(auto known : ids) {
                if( known == tx->id) {
@@ -836,7 +1005,7 @@ namespace eosio {
             }
             if(!found) {
                my_impl->local_txns.modify(tx,incr_in_flight);
-               queue_write(std::make_shared<vector<char>>(tx->serialized_txn),
+               queue_write(tx->serialized_txn,
                            true,
                            [tx_id=tx->id](boost::system::error_code ec, std::size_t ) {
                               auto& local_txns = my_impl->local_txns;
@@ -855,9 +1024,9 @@ namespace eosio {
    void connection::txn_send(const vector<transaction_id_type> &ids) {
       for(auto t : ids) {
          auto tx = my_impl->local_txns.get<by_id>().find(t);
-         if( tx != my_impl->local_txns.end() && tx->serialized_txn.size()) {
+         if( tx != my_impl->local_txns.end() && tx->serialized_txn) {
             my_impl->local_txns.modify( tx,incr_in_flight);
-            queue_write(std::make_shared<vector<char>>(tx->serialized_txn),
+            queue_write(tx->serialized_txn,
                         true,
                         [t](boost::system::error_code ec, std::size_t ) {
                            auto& local_txns = my_impl->local_txns;
@@ -977,13 +1146,12 @@ namespace eosio {
       enqueue(last_handshake_sent);
    }
 
-   const tcp::socket& connection::get_socket()
-   {
-         return *socket;
-   }
-
    void connection::send_difchainmsg()
    {
+         if(protocol_version >= proto_difchain_stream) {
+            send_difchain_stream();
+            return;
+         }
          //ilog("begin send difchain msg -----------------------");
          std::vector<signed_block_ptr> blocks;
          appbase::app().find_plugin<eoc_relay_plugin>()->analy_dif_chainmsg(blocks);
@@ -1001,6 +1169,92 @@ namespace eosio {
          //ilog(" send difchain msg  success -----------------------");
    }
 
+   static bytes zlib_compress_block(const char* in, size_t size) {
+      bytes out;
+      bio::filtering_ostream comp;
+      comp.push(bio::zlib_compressor(bio::zlib::default_compression));
+      comp.push(bio::back_inserter(out));
+      bio::write(comp, in, size);
+      bio::close(comp);
+      return out;
+   }
+
+   struct block_size_limiter {
+      using char_type = char;
+      using category = bio::multichar_output_filter_tag;
+
+      template<typename Sink>
+      size_t write(Sink &sink, const char* s, size_t count)
+      {
+         EOS_ASSERT(total + count <= def_send_buffer_size*2, plugin_exception, "Exceeded maximum decompressed block size");
+         total += count;
+         return bio::write(sink, s, count);
+      }
+
+      size_t total = 0;
+   };
+
+   static signed_block zlib_decompress_block(const bytes& data) {
+      try {
+         bytes out;
+         bio::filtering_ostream decomp;
+         decomp.push(bio::zlib_decompressor());
+         decomp.push(block_size_limiter());
+         decomp.push(bio::back_inserter(out));
+         bio::write(decomp, data.data(), data.size());
+         bio::close(decomp);
+         return fc::raw::unpack<signed_block>(out);
+      } catch( fc::exception& er ) {
+         throw;
+      } catch( ... ) {
+         fc::unhandled_exception er( FC_LOG_MESSAGE( warn, "internal decompression error"), std::current_exception() );
+         throw er;
+      }
+   }
+
+   void connection::send_difchain_stream()
+   {
+      if(difchain_block_limit == 0)
+         return; // no window granted yet
+      controller& cc = app().find_plugin<chain_plugin>()->chain();
+      uint32_t last = std::min(cc.last_irreversible_block_num(), difchain_block_limit - 1);
+      auto blocks = cc.get_block_log_reader(); // irreversible, so compressed straight from the mapped log
+      while(difchain_next_block <= last) {
+         difchain_block_stream msg;
+         msg.first_block_num = difchain_next_block;
+         size_t bytes_in_msg = 0;
+         while(difchain_next_block <= last && msg.blocks.size() < my_impl->difchain_stream_batch
+               && bytes_in_msg < def_send_buffer_size) {
+            auto raw = blocks->get_serialized_block(difchain_next_block);
+            vector<char> archived;
+            if(!raw.second) {
+               archived = blocks->read_serialized_block_by_num(difchain_next_block); // only kept compressed
+               if(archived.empty())
+                  break;
+               raw = {archived.data(), archived.size()};
+            }
+            msg.blocks.emplace_back(zlib_compress_block(raw.first, raw.second));
+            bytes_in_msg += msg.blocks.back().size();
+            ++difchain_next_block;
+         }
+         if(msg.blocks.empty()) {
+            elog("block ${n} is missing, difchain stream to ${p} stopped", ("n", difchain_next_block)("p", peer_name()));
+            return;
+         }
+         fc_dlog(logger, "send difchain blocks ${f} to ${l} to ${p}",
+                 ("f", msg.first_block_num)("l", difchain_next_block - 1)("p", peer_name()));
+         enqueue(net_message(msg));
+      }
+   }
+
+   void connection::send_difchain_credit(uint32_t next_block_num)
+   {
+      difchain_stream_credit credit;
+      credit.next_block_num = next_block_num;
+      credit.credit = my_impl->difchain_stream_window;
+      enqueue(net_message(credit));
+   }
+
    char* connection::convert_tstamp(const tstamp& t)
    {
       const long long NsecPerSec{1000000000};
@@ -1039,7 +1293,7 @@ namespace eosio {
       if(write_queue.empty() || !out_queue.empty())
          return;
       connection_wptr c(shared_from_this());
-      if(!socket->is_open()) {
+      if(!socket_open) {
          fc_elog(logger,"socket not open to ${p}",("p",peer_name()));
          my_impl->close(c.lock());
          return;
@@ -1051,7 +1305,8 @@ namespace eosio {
          out_queue.push_back(m);
          write_queue.pop_front();
       }
-      boost::asio::async_write(*socket, bufs, [c](boost::system::error_code ec, std::size_t w) {
+      // the queues stay on the application thread, only the write itself runs on the strand
+      auto on_written = [c](boost::system::error_code ec, std::size_t w) {
             try {
                auto conn = c.lock();
                if(!conn)
@@ -1093,7 +1348,12 @@ namespace eosio {
                string pname = conn ? conn->peer_name() : "no connection name";
                elog("Exception in do_queue_write to ${p}", ("p",pname) );
             }
-         });
+         };
+      boost::asio::post(strand, [s = socket, st = strand, bufs = std::move(bufs), on_written] {
+         boost::asio::async_write(*s, bufs, boost::asio::bind_executor(st, [on_written](boost::system::error_code ec, std::size_t w) {
+            app().get_io_service().post([on_written, ec, w] { on_written(ec, w); });
+         }));
+      });
    }
 
    void connection::cancel_sync(go_away_reason reason) {
@@ -1114,6 +1374,18 @@ namespace eosio {
       }
    }
 
+   /// wire format of a message that is already packed, such as a block as it is stored in the block log
+   static std::shared_ptr<vector<char>> create_send_buffer( uint32_t which, const char* packed, size_t size ) {
+      fc::unsigned_int tag( which );
+      uint32_t payload_size = fc::raw::pack_size( tag ) + size;
+      auto send_buffer = std::make_shared<vector<char>>( sizeof(payload_size) + payload_size );
+      fc::datastream<char*> ds( send_buffer->data(), send_buffer->size() );
+      ds.write( reinterpret_cast<char*>(&payload_size), sizeof(payload_size) );
+      fc::raw::pack( ds, tag );
+      ds.write( packed, size );
+      return send_buffer;
+   }
+
    bool connection::enqueue_sync_block() {
       controller& cc = app().find_plugin<chain_plugin>()->chain();
       if (!peer_requested)
@@ -1124,6 +1396,13 @@ namespace eosio {
          peer_requested.reset();
       }
       try {
+         // irreversible blocks are sent as they are packed in the block log, without an unpack and repack
+         auto blocks = cc.get_block_log_reader();
+         auto raw = blocks->get_serialized_block(num);
+         if(raw.second) {
+            enqueue_buffer( create_send_buffer( net_message::tag<signed_block>::value, raw.first, raw.second ), trigger_send );
+            return true;
+         }
          signed_block_ptr sb = cc.fetch_block_by_number(num);
          if(sb) {
             enqueue( *sb, trigger_send);
@@ -1135,12 +1414,8 @@ namespace eosio {
       return false;
    }
 
-   void connection::enqueue( const net_message &m, bool trigger_send ) {
-      go_away_reason close_after_send = no_reason;
-      if (m.contains<go_away_message>()) {
-         close_after_send = m.get<go_away_message>().reason;
-      }
-
+   /// size prefixed wire format of a message, ready to be shared by several connections
+   static std::shared_ptr<vector<char>> create_send_buffer( const net_message &m ) {
       uint32_t payload_size = fc::raw::pack_size( m );
       char * header = reinterpret_cast<char*>(&payload_size);
       size_t header_size = sizeof(payload_size);
@@ -1151,6 +1426,20 @@ namespace eosio {
       fc::datastream<char*> ds( send_buffer->data(), buffer_size);
       ds.write( header, header_size );
       fc::raw::pack( ds, m );
+      return send_buffer;
+   }
+
+   void connection::enqueue( const net_message &m, bool trigger_send ) {
+      go_away_reason close_after_send = no_reason;
+      if (m.contains<go_away_message>()) {
+         close_after_send = m.get<go_away_message>().reason;
+      }
+
+      enqueue_buffer(create_send_buffer(m), trigger_send, close_after_send);
+   }
+
+   void connection::enqueue_buffer( const std::shared_ptr<vector<char>>& send_buffer, bool trigger_send,
+                                    go_away_reason close_after_send ) {
       connection_wptr weak_this = shared_from_this();
       queue_write(send_buffer,trigger_send,
                   [weak_this, close_after_send](boost::system::error_code ec, std::size_t ) {
@@ -1262,13 +1551,26 @@ namespace eosio {
             pending_message_buffer.peek(blk_buffer.data(), message_length, index);
          }
          auto ds = pending_message_buffer.create_datastream();
-         net_message msg;
-         fc::raw::unpack(ds, msg);
-         msgHandler m(impl, shared_from_this() );
-         msg.visit(m);
+         auto msg = std::make_shared<net_message>();
+         fc::raw::unpack(ds, *msg);
+         if (msg->contains<packed_transaction>()) {
+            msg->get<packed_transaction>().id(); // decompresses and unpacks the transaction on this thread
+         } else if (msg->contains<signed_block>()) {
+            // its transaction signatures are recovered on the chain thread pool while it waits for the app thread
+            impl.chain_plug->chain().prepare_block( signed_block_ptr( msg, &msg->get<signed_block>() ));
+         }
+         app().get_io_service().post([&impl, c = shared_from_this(), msg] {
+            try {
+               msgHandler m(impl, c);
+               msg->visit(m);
+            } catch(  const fc::exception& e ) {
+               edump((e.to_detail_string() ));
+               impl.close( c );
+            }
+         });
       } catch(  const fc::exception& e ) {
          edump((e.to_detail_string() ));
-         impl.close( shared_from_this() );
+         app().get_io_service().post([&impl, c = shared_from_this()] { impl.close( c ); });
          return false;
       }
       return true;
@@ -1294,12 +1596,12 @@ namespace eosio {
 
    //-----------------------------------------------------------
 
-    sync_manager::sync_manager( uint32_t req_span )
+    sync_manager::sync_manager( uint32_t req_span, uint32_t max_peers )
       :sync_known_lib_num( 0 )
       ,sync_last_requested_num( 0 )
       ,sync_next_expected_num( 1 )
       ,sync_req_span( req_span )
-      ,source()
+      ,sync_max_peers( std::max<uint32_t>( max_peers, 1 ))
       ,state(in_sync)
    {
       chain_plug = app( ).find_plugin<chain_plugin>( );
@@ -1335,18 +1637,48 @@ namespace eosio {
 
    void sync_manager::reset_lib_num(connection_ptr c) {
       if(state == in_sync) {
-         source.reset();
+         reset_ranges();
       }
       if( c->current() ) {
          if( c->last_handshake_recv.last_irreversible_block_num > sync_known_lib_num) {
             sync_known_lib_num =c->last_handshake_recv.last_irreversible_block_num;
          }
-      } else if( c == source ) {
-         sync_last_requested_num = 0;
+      } else if( release_range( c )) {
          request_next_chunk();
       }
    }
 
+   bool sync_manager::release_range(connection_ptr c) {
+      auto r = std::find_if( sync_ranges.begin(), sync_ranges.end(), [&c]( const sync_range& r ) { return r.peer == c; } );
+      if( r == sync_ranges.end() )
+         return false;
+      if( r->next <= r->end ) {
+         fc_dlog(logger, "range ${s} to ${e} of ${p} will be requested elsewhere", ("s",r->next)("e",r->end)("p",c->peer_name()));
+         sync_unassigned[r->next] = r->end;
+      }
+      sync_ranges.erase( r );
+      return true;
+   }
+
+   void sync_manager::reset_ranges() {
+      sync_last_requested_num = 0;
+      sync_ranges.clear();
+      sync_unassigned.clear();
+      sync_buffer.clear();
+   }
+
+   void sync_manager::report_sync_rate() {
+      auto now = time_point::now();
+      auto elapsed = now - sync_rate_start;
+      if( sync_rate_blocks > 0 && elapsed.count() > 0 ) {
+         fc_ilog(logger, "syncing at ${r} blocks/sec, next expected ${ne} of ${lib}, ${f} ranges in flight, ${b} blocks buffered",
+                 ("r", uint64_t(sync_rate_blocks) * 1000000 / elapsed.count())("ne",sync_next_expected_num)("lib",sync_known_lib_num)
+                 ("f",sync_ranges.size())("b",sync_buffer.size()));
+      }
+      sync_rate_start = now;
+      sync_rate_blocks = 0;
+   }
+
    bool sync_manager::sync_required( ) {
       fc_dlog(logger, "last req = ${req}, last recv = ${recv} known = ${known} our head = ${head}",
               ("req",sync_last_requested_num)("recv",sync_next_expected_num)("known",sync_known_lib_num)("head",chain_plug->chain( ).fork_db_head_block_num( )));
@@ -1355,89 +1687,67 @@ namespace eosio {
               chain_plug->chain( ).fork_db_head_block_num( ) < sync_last_requested_num );
    }
 
-   void sync_manager::request_next_chunk( connection_ptr conn ) {
-      uint32_t head_block = chain_plug->chain().fork_db_head_block_num();
-
-      if (head_block < sync_last_requested_num && source && source->current()) {
-         fc_ilog (logger, "ignoring request, head is ${h} last req = ${r} source is ${p}",
-                  ("h",head_block)("r",sync_last_requested_num)("p",source->peer_name()));
-         return;
-      }
-
+   void sync_manager::request_next_chunk( connection_ptr conn, connection_ptr skip ) {
       /* ----------
-       * next chunk provider selection criteria
-       * a provider is supplied and able to be used, use it.
-       * otherwise select the next available from the list, round-robin style.
+       * ranges are handed out to every current peer not already serving one, up to sync_max_peers,
+       * a supplied provider first. Ranges given up by other peers go out before new ones.
        */
-
-      if (conn && conn->current() ) {
-         source = conn;
+      auto available = [this]( const connection_ptr& c ) {
+         return c && c->current() &&
+                std::none_of( sync_ranges.begin(), sync_ranges.end(), [&c]( const sync_range& r ) { return r.peer == c; } );
+      };
+      vector<connection_ptr> peers;
+      if( conn != skip && available( conn )) {
+         peers.push_back( conn );
       }
-      else {
-         if (my_impl->connections.size() == 1) {
-            if (!source) {
-               source = *my_impl->connections.begin();
-            }
-         }
-         else {
-            // init to a linear array search
-            auto cptr = my_impl->connections.begin();
-            auto cend = my_impl->connections.end();
-            // do we remember the previous source?
-            if (source) {
-               //try to find it in the list
-               cptr = my_impl->connections.find(source);
-               cend = cptr;
-               if (cptr == my_impl->connections.end()) {
-                  //not there - must have been closed! cend is now connections.end, so just flatten the ring.
-                  source.reset();
-                  cptr = my_impl->connections.begin();
-               } else {
-                  //was found - advance the start to the next. cend is the old source.
-                  if (++cptr == my_impl->connections.end() && cend != my_impl->connections.end() ) {
-                     cptr = my_impl->connections.begin();
-                  }
-               }
-            }
-
-            //scan the list of peers looking for another able to provide sync blocks.
-            while (cptr != cend) {
-               //select the first one which is current and break out.
-               if ((*cptr)->current()) {
-                  source = *cptr;
-                  break;
-               }
-               else {
-                  // advance the iterator in a round robin fashion.
-                  if (++cptr == my_impl->connections.end()) {
-                     cptr = my_impl->connections.begin();
-                  }
-               }
-            }
-            // no need to check the result, either source advanced or the whole list was checked and the old source is reused.
+      for( const auto& c : my_impl->connections ) {
+         if( c != conn && c != skip && available( c )) {
+            peers.push_back( c );
          }
       }
+      if( peers.empty() && available( skip )) {
+         peers.push_back( skip ); // the only peer left
+      }
 
       // verify there is an available source
-      if (!source || !source->current() ) {
+      if( peers.empty() && sync_ranges.empty() ) {
          elog("Unable to continue syncing at this time");
          sync_known_lib_num = chain_plug->chain().last_irreversible_block_num();
-         sync_last_requested_num = 0;
+         reset_ranges();
          set_state(in_sync); // probably not, but we can't do anything else
          return;
       }
 
-      if( sync_last_requested_num != sync_known_lib_num ) {
-         uint32_t start = sync_next_expected_num;
-         uint32_t end = start + sync_req_span - 1;
-         if( end > sync_known_lib_num )
-            end = sync_known_lib_num;
-         if( end > 0 && end >= start ) {
-            fc_ilog(logger, "requesting range ${s} to ${e}, from ${n}",
-                    ("n",source->peer_name())("s",start)("e",end));
-            source->request_sync_blocks(start, end);
+      // blocks past the window wait in the buffer for a slower range in front of them
+      const uint64_t window_end = uint64_t(sync_next_expected_num) + uint64_t(sync_max_peers) * sync_req_span;
+      for( const auto& peer : peers ) {
+         if( sync_ranges.size() >= sync_max_peers ) {
+            break;
+         }
+         uint32_t start = 0, end = 0;
+         if( !sync_unassigned.empty() ) {
+            start = sync_unassigned.begin()->first;
+            end = sync_unassigned.begin()->second;
+            sync_unassigned.erase( sync_unassigned.begin() );
+         } else if( sync_last_requested_num < sync_known_lib_num ) {
+            start = std::max( sync_last_requested_num + 1, sync_next_expected_num );
+            if( start >= window_end ) {
+               break;
+            }
+            end = start + sync_req_span - 1;
+            if( end > sync_known_lib_num )
+               end = sync_known_lib_num;
+            if( end == 0 || end < start ) {
+               break;
+            }
             sync_last_requested_num = end;
+         } else {
+            break;
          }
+         fc_ilog(logger, "requesting range ${s} to ${e}, from ${n}",
+                 ("n",peer->peer_name())("s",start)("e",end));
+         sync_ranges.push_back( sync_range{ peer, start, end } );
+         peer->request_sync_blocks(start, end);
       }
    }
 
@@ -1465,7 +1775,10 @@ namespace eosio {
 
       if (state == in_sync) {
          set_state(lib_catchup);
+         reset_ranges();
          sync_next_expected_num = chain_plug->chain().last_irreversible_block_num() + 1;
+         sync_rate_start = time_point::now();
+         sync_rate_blocks = 0;
       }
 
       fc_ilog(logger, "Catching up with chain, our last req is ${cc}, theirs is ${t} peer ${p}",
@@ -1478,10 +1791,9 @@ namespace eosio {
       fc_ilog(logger, "reassign_fetch, our last req is ${cc}, next expected is ${ne} peer ${p}",
               ( "cc",sync_last_requested_num)("ne",sync_next_expected_num)("p",c->peer_name()));
 
-      if (c == source) {
+      if( release_range( c )) {
          c->cancel_sync (reason);
-         sync_last_requested_num = 0;
-         request_next_chunk();
+         request_next_chunk( connection_ptr(), c );
       }
    }
 
@@ -1604,8 +1916,7 @@ namespace eosio {
    void sync_manager::rejected_block (connection_ptr c, uint32_t blk_num) {
       if (state != in_sync ) {
          fc_ilog (logger, "block ${bn} not accepted from ${p}",("bn",blk_num)("p",c->peer_name()));
-         sync_last_requested_num = 0;
-         source.reset();
+         reset_ranges();
          my_impl->close(c);
          set_state(in_sync);
          send_handshakes();
@@ -1614,17 +1925,27 @@ namespace eosio {
    void sync_manager::recv_block (connection_ptr c, const block_id_type &blk_id, uint32_t blk_num) {
       fc_dlog(logger," got block ${bn} from ${p}",("bn",blk_num)("p",c->peer_name()));
       if (state == lib_catchup) {
+         if (blk_num < sync_next_expected_num) {
+            fc_dlog (logger, "block ${bn} already received from another peer",("bn",blk_num));
+            if( std::any_of( sync_ranges.begin(), sync_ranges.end(), [&c]( const sync_range& r ) { return r.peer == c; } )) {
+               c->sync_wait();
+            } else if( sync_ranges.size() < sync_max_peers ) {
+               request_next_chunk();
+            }
+            return;
+         }
          if (blk_num != sync_next_expected_num) {
             fc_ilog (logger, "expected block ${ne} but got ${bn}",("ne",sync_next_expected_num)("bn",blk_num));
             my_impl->close(c);
             return;
          }
          sync_next_expected_num = blk_num + 1;
+         ++sync_rate_blocks;
       }
       if (state == head_catchup) {
          fc_dlog (logger, "sync_manager in head_catchup state");
          set_state(in_sync);
-         source.reset();
+         reset_ranges();
 
          block_id_type null_id;
          for (auto cp : my_impl->connections) {
@@ -1643,19 +1964,67 @@ namespace eosio {
       else if (state == lib_catchup) {
          if( blk_num == sync_known_lib_num ) {
             fc_dlog( logger, "All caught up with last known last irreversible block resending handshake");
+            report_sync_rate();
+            reset_ranges();
             set_state(in_sync);
             send_handshakes();
          }
-         else if (blk_num == sync_last_requested_num) {
-            request_next_chunk();
-         }
          else {
-            fc_dlog(logger,"calling sync_wait on connection ${p}",("p",c->peer_name()));
-            c->sync_wait();
+            if( sync_rate_blocks >= sync_req_span ) {
+               report_sync_rate();
+            }
+            if( std::any_of( sync_ranges.begin(), sync_ranges.end(), [&c]( const sync_range& r ) { return r.peer == c; } )) {
+               fc_dlog(logger,"calling sync_wait on connection ${p}",("p",c->peer_name()));
+               c->sync_wait();
+            }
+            if( sync_ranges.size() < sync_max_peers ) {
+               request_next_chunk();
+            }
          }
       }
    }
 
+   bool sync_manager::buffer_block( connection_ptr c, const signed_block& blk ) {
+      if( state != lib_catchup ) {
+         return false;
+      }
+      auto r = std::find_if( sync_ranges.begin(), sync_ranges.end(), [&c]( const sync_range& r ) { return r.peer == c; } );
+      uint32_t blk_num = blk.block_num();
+      if( r == sync_ranges.end() || blk_num != r->next ) {
+         return false; // not part of a range, handled as before
+      }
+      bool range_done = ++r->next > r->end;
+      if( range_done ) {
+         sync_ranges.erase( r );
+      }
+      if( blk_num <= sync_next_expected_num ) {
+         return false; // applied right away
+      }
+
+      if( !sync_buffer.count( blk_num )) {
+         sync_buffer[blk_num] = buffered_block{ c, std::make_shared<signed_block>( blk ) };
+      }
+      if( range_done ) {
+         request_next_chunk();
+      } else {
+         c->sync_wait();
+      }
+      return true;
+   }
+
+   signed_block_ptr sync_manager::next_buffered_block( connection_ptr& from ) {
+      while( !sync_buffer.empty() && sync_buffer.begin()->first < sync_next_expected_num ) {
+         sync_buffer.erase( sync_buffer.begin() );
+      }
+      if( state != lib_catchup || sync_buffer.empty() || sync_buffer.begin()->first != sync_next_expected_num ) {
+         return signed_block_ptr();
+      }
+      from = sync_buffer.begin()->second.peer;
+      auto blk = sync_buffer.begin()->second.block;
+      sync_buffer.erase( sync_buffer.begin() );
+      return blk;
+   }
+
    //------------------------------------------------------------------------
 
    void dispatch_manager::bcast_block (const signed_block &bsum) {
@@ -1693,6 +2062,7 @@ namespace eosio {
       }
       else {
          pbstate.is_known = true;
+         std::shared_ptr<vector<char>> send_buffer; // serialized once, for the first peer that needs it
          for (auto cp : my_impl->connections) {
             if (skips.find(cp) != skips.end() || !cp->current()) {
                continue;
@@ -1702,7 +2072,9 @@ namespace eosio {
                continue;   
             }
             cp->add_peer_block(pbstate);
-            cp->enqueue( bsum );
+            if (!send_buffer)
+               send_buffer = create_send_buffer(msg);
+            cp->enqueue_buffer( send_buffer );
          }
       }
    }
@@ -1757,19 +2129,21 @@ namespace eosio {
       net_message msg(trx);
       packsiz = fc::raw::pack_size(msg);
       bufsiz = packsiz + sizeof(packsiz);
-      vector<char> buff(bufsiz);
-      fc::datastream<char*> ds( buff.data(), bufsiz);
+      auto buff = std::make_shared<vector<char>>(bufsiz);
+      fc::datastream<char*> ds( buff->data(), bufsiz);
       ds.write( reinterpret_cast<char*>(&packsiz), sizeof(packsiz) );
       fc::raw::pack( ds, msg );
       node_transaction_state nts = {id,
                                     trx_expiration,
                                     trx,
-                                    std::move(buff),
+                                    buff,
                                     0, 0, 0};
       my_impl->local_txns.insert(std::move(nts));
+      my_impl->local_txn_expiry.add(id, trx_expiration);
+      my_impl->local_txn_bytes += bufsiz;
 
       if( !large_msg_notify || bufsiz <= just_send_it_max) {
-         my_impl->send_all( trx, [id, &skips, trx_expiration](connection_ptr c) -> bool {
+         my_impl->send_all( buff, [id, &skips, trx_expiration](connection_ptr c) -> bool {
                if( skips.find(c) != skips.end() || c->syncing ) {
                   return false;
                }
@@ -1777,6 +2151,7 @@ namespace eosio {
                bool unknown = bs == c->trx_state.end();
                if( unknown) {
                   c->trx_state.insert(transaction_state({id,true,true,0,trx_expiration,time_point() }));
+                  c->trx_expiry.add(id, trx_expiration);
                   fc_dlog(logger, "sending whole trx to ${n}", ("n",c->peer_name() ) );
                } else {
                   update_txn_expiry ute(trx_expiration);
@@ -1799,6 +2174,7 @@ namespace eosio {
                if( unknown) {
                   fc_dlog(logger, "sending notice to ${n}", ("n",c->peer_name() ) );
                   c->trx_state.insert(transaction_state({id,false,true,0,trx_expiration,time_point() }));
+                  c->trx_expiry.add(id, trx_expiration);
                } else {
                   update_txn_expiry ute(trx_expiration);
                   c->trx_state.modify(bs, ute);
@@ -1847,8 +2223,10 @@ namespace eosio {
                //At this point the details of the txn are not known, just its id. This
                //effectively gives 120 seconds to learn of the details of the txn which
                //will update the expiry in bcast_transaction
-               c->trx_state.insert( (transaction_state){t,true,true,0,time_point_sec(time_point::now()) + 120,
-                        time_point()} );
+               auto expires = time_point_sec(time_point::now()) + 120;
+               if( c->trx_state.insert( (transaction_state){t,true,true,0,expires,time_point()} ).second ) {
+                  c->trx_expiry.add( t, expires );
+               }
 
                req.req_trx.ids.push_back( t );
                req_trx.push_back( t );
@@ -2000,67 +2378,74 @@ namespace eosio {
       ++endpoint_itr;
       c->connecting = true;
       connection_wptr weak_conn = c;
-      c->socket->async_connect( current_endpoint, [weak_conn, endpoint_itr, this] ( const boost::system::error_code& err ) {
+      boost::asio::post(c->strand, [c, current_endpoint, weak_conn, endpoint_itr, this] {
+         c->socket->async_connect( current_endpoint, boost::asio::bind_executor(c->strand, [weak_conn, endpoint_itr, this] ( const boost::system::error_code& err ) {
             auto c = weak_conn.lock();
             if (!c) return;
-            if( !err && c->socket->is_open() ) {
-               if (start_session( c )) {
+            tcp::endpoint remote, local;
+            auto ec = err ? err : prepare_socket( *c->socket, remote, local );
+            app().get_io_service().post([c, ec, remote, local, endpoint_itr, this] {
+               if( !ec ) {
+                  c->socket_open = true;
+                  c->remote_endpoint = remote;
+                  c->local_endpoint = local;
+                  start_session( c );
                   c->send_handshake ();
+               } else {
+                  if( endpoint_itr != tcp::resolver::iterator() ) {
+                     close(c);
+                     connect( c, endpoint_itr );
+                  }
+                  else {
+                     elog( "connection failed to ${peer}: ${error}",
+                           ( "peer", c->peer_name())("error",ec.message()));
+                     c->connecting = false;
+                     my_impl->close(c);
+                  }
                }
-            } else {
-               if( endpoint_itr != tcp::resolver::iterator() ) {
-                  close(c);
-                  connect( c, endpoint_itr );
-               }
-               else {
-                  elog( "connection failed to ${peer}: ${error}",
-                        ( "peer", c->peer_name())("error",err.message()));
-                  c->connecting = false;
-                  my_impl->close(c);
-               }
-            }
-         } );
+            });
+         }));
+      });
    }
 
-   bool net_plugin_impl::start_session( connection_ptr con ) {
-      boost::asio::ip::tcp::no_delay nodelay( true );
+   boost::system::error_code net_plugin_impl::prepare_socket( tcp::socket& s, tcp::endpoint& remote, tcp::endpoint& local ) {
       boost::system::error_code ec;
-      con->socket->set_option( nodelay, ec );
-      if (ec) {
-         elog( "connection failed to ${peer}: ${error}",
-               ( "peer", con->peer_name())("error",ec.message()));
-         con->connecting = false;
-         close(con);
-         return false;
-      }
-      else {
-         start_read_message( con );
-         ++started_sessions;
-         return true;
-         // for now, we can just use the application main loop.
-         //     con->readloop_complete  = bf::async( [=](){ read_loop( con ); } );
-         //     con->writeloop_complete = bf::async( [=](){ write_loop con ); } );
-      }
+      s.set_option( boost::asio::ip::tcp::no_delay( true ), ec );
+      if( !ec )
+         remote = s.remote_endpoint( ec );
+      if( !ec )
+         local = s.local_endpoint( ec );
+      return ec;
+   }
+
+   void net_plugin_impl::start_session( connection_ptr con ) {
+      start_read_message( con );
+      ++started_sessions;
    }
 
 
    void net_plugin_impl::start_listen_loop( ) {
-      auto socket = std::make_shared<tcp::socket>( std::ref( app().get_io_service() ) );
+      auto socket = std::make_shared<tcp::socket>( std::ref( *net_ioc ) );
       acceptor->async_accept( *socket, [socket,this]( boost::system::error_code ec ) {
+         // the socket is not shared yet, so it is read here rather than on the application thread
+         tcp::endpoint remote, local;
+         boost::system::error_code pec;
+         if( !ec )
+            pec = prepare_socket( *socket, remote, local );
+         app().get_io_service().post([socket, ec, pec, remote, local, this]() mutable { // connections are owned by the application thread
             if( !ec ) {
                uint32_t visitors = 0;
                uint32_t from_addr = 0;
-               auto paddr = socket->remote_endpoint(ec).address();
-               if (ec) {
-                  fc_elog(logger,"Error getting remote endpoint: ${m}",("m", ec.message()));
+               auto paddr = remote.address();
+               if (pec) {
+                  fc_elog(logger,"Error getting remote endpoint: ${m}",("m", pec.message()));
                }
                else {
                   for (auto &conn : connections) {
-                     if(conn->socket->is_open()) {
+                     if(conn->socket_open) {
                         if (conn->peer_addr.empty()) {
                            visitors++;
-                           boost::system::error_code ec;
-                           if (paddr == conn->socket->remote_endpoint(ec).address()) {
+                           if (paddr == conn->remote_endpoint.address()) {
                               from_addr++;
                            }
                         }
@@ -2072,7 +2457,7 @@ namespace eosio {
                   }
                   if( from_addr < max_nodes_per_host && (max_client_count == 0 || num_clients < max_client_count )) {
                      ++num_clients;
-                     connection_ptr c = std::make_shared<connection>( socket );
+                     connection_ptr c = std::make_shared<connection>( socket, remote, local );
                      connections.insert( c );
                      start_session( c );
 
@@ -2106,9 +2491,14 @@ namespace eosio {
             }
             start_listen_loop();
          });
+      });
    }
 
    void net_plugin_impl::start_read_message( connection_ptr conn ) {
+      if (!conn->strand.running_in_this_thread()) {
+         boost::asio::post(conn->strand, [conn, this] { start_read_message(conn); });
+         return;
+      }
 
       try {
          if(!conn->socket) {
@@ -2135,7 +2525,7 @@ namespace eosio {
 
          boost::asio::async_read(*conn->socket,
             conn->pending_message_buffer.get_buffer_sequence_for_boost_async_read(), completion_handler,
-            [this,weak_conn]( boost::system::error_code ec, std::size_t bytes_transferred ) {
+            boost::asio::bind_executor(conn->strand, [this,weak_conn]( boost::system::error_code ec, std::size_t bytes_transferred ) {
                auto conn = weak_conn.lock();
                if (!conn) {
                   return;
@@ -2164,7 +2554,7 @@ namespace eosio {
                            if(message_length > def_send_buffer_size*2 || message_length == 0) {
                               boost::system::error_code ec;
                               elog("incoming message length unexpected (${i}), from ${p}", ("i", message_length)("p",boost::lexical_cast<std::string>(conn->socket->remote_endpoint(ec))));
-                              close(conn);
+                              app().get_io_service().post([this, conn] { close( conn ); }); // connections are owned by the application thread
                               return;
                            }
 
@@ -2189,35 +2579,35 @@ namespace eosio {
                      }
                      start_read_message(conn);
                   } else {
-                     auto pname = conn->peer_name();
+                     const auto& pname = conn->endpoint_name;
                      if (ec.value() != boost::asio::error::eof) {
                         elog( "Error reading message from ${p}: ${m}",("p",pname)( "m", ec.message() ) );
                      } else {
                         ilog( "Peer ${p} closed connection",("p",pname) );
                      }
-                     close( conn );
+                     app().get_io_service().post([this, conn] { close( conn ); });
                   }
                }
                catch(const std::exception &ex) {
-                  string pname = conn ? conn->peer_name() : "no connection name";
+                  string pname = conn ? conn->endpoint_name : "no connection name";
                   elog("Exception in handling read data from ${p} ${s}",("p",pname)("s",ex.what()));
-                  close( conn );
+                  app().get_io_service().post([this, conn] { close( conn ); });
                }
                catch(const fc::exception &ex) {
-                  string pname = conn ? conn->peer_name() : "no connection name";
+                  string pname = conn ? conn->endpoint_name : "no connection name";
                   elog("Exception in handling read data ${s}", ("p",pname)("s",ex.to_string()));
-                  close( conn );
+                  app().get_io_service().post([this, conn] { close( conn ); });
                }
                catch (...) {
-                  string pname = conn ? conn->peer_name() : "no connection name";
+                  string pname = conn ? conn->endpoint_name : "no connection name";
                   elog( "Undefined exception hanlding the read data from connection ${p}",( "p",pname));
-                  close( conn );
+                  app().get_io_service().post([this, conn] { close( conn ); });
                }
-            } );
+            }));
       } catch (...) {
-         string pname = conn ? conn->peer_name() : "no connection name";
+         string pname = conn ? conn->endpoint_name : "no connection name";
          elog( "Undefined exception handling reading ${p}",("p",pname) );
-         close( conn );
+         app().get_io_service().post([this, conn] { close( conn ); });
       }
    }
 
@@ -2225,7 +2615,7 @@ namespace eosio {
    {
       size_t count = 0;
       for( auto &c : connections) {
-         if(c->socket->is_open())
+         if(c->socket_open)
             ++count;
       }
       return count;
@@ -2234,11 +2624,25 @@ namespace eosio {
 
    template<typename VerifierFunc>
    void net_plugin_impl::send_all( const net_message &msg, VerifierFunc verify) {
+      std::shared_ptr<vector<char>> send_buffer; // serialized once, for the first peer that needs it
       for( auto &c : connections) {
          if( c->current() && verify( c)) {
             if(c->get_chainid() != chain_id)
                   continue;
-            c->enqueue( msg );
+            if( !send_buffer )
+               send_buffer = create_send_buffer( msg );
+            c->enqueue_buffer( send_buffer );
+         }
+      }
+   }
+
+   template<typename VerifierFunc>
+   void net_plugin_impl::send_all( const std::shared_ptr<vector<char>>& send_buffer, VerifierFunc verify) {
+      for( auto &c : connections) {
+         if( c->current() && verify( c)) {
+            if(c->get_chainid() != chain_id)
+                  continue;
+            c->enqueue_buffer( send_buffer );
          }
       }
    }
@@ -2327,6 +2731,9 @@ namespace eosio {
 
           update_difchaincon(c,msg.chain_id);
          c->protocol_version = to_protocol_version(msg.network_version);
+         if(c->get_chainid() != chain_id && c->protocol_version >= proto_difchain_stream) {
+            c->send_difchain_credit(appbase::app().find_plugin<eoc_relay_plugin>()->next_dif_chain_block_num(c->get_chainid()));
+         }
          if(c->protocol_version != net_version) {
             if (network_version_match) {
                elog("Peer network version does not match expected ${nv} but got ${mnv}",
@@ -2582,6 +2989,31 @@ namespace eosio {
          appbase::app().find_plugin<eoc_relay_plugin>()->recv_dif_chainmsg(msg);
    }
 
+   void net_plugin_impl::handle_message( connection_ptr c, const difchain_block_stream &msg)
+   {
+      peer_ilog(c, "received difchain_block_stream");
+      auto relay = appbase::app().find_plugin<eoc_relay_plugin>();
+      uint32_t block_num = msg.first_block_num;
+      for(const auto& data : msg.blocks) {
+         auto block = zlib_decompress_block(data);
+         EOS_ASSERT(block.block_num() == block_num, plugin_exception, "difchain stream is not contiguous",
+                    ("expected", block_num)("got", block.block_num()));
+         relay->recv_dif_chain_block(c->get_chainid(), block);
+         ++block_num;
+      }
+      // slide the window past the blocks just consumed
+      c->send_difchain_credit(block_num);
+   }
+
+   void net_plugin_impl::handle_message( connection_ptr c, const difchain_stream_credit &msg)
+   {
+      peer_ilog(c, "received difchain_stream_credit");
+      // blocks already sent are in flight, only a later start moves the stream forward
+      c->difchain_next_block = std::max({c->difchain_next_block, msg.next_block_num, 1u});
+      c->difchain_block_limit = msg.next_block_num + msg.credit;
+      c->send_difchain_stream();
+   }
+
       void net_plugin_impl::handle_message( connection_ptr c, const block_header_with_merkle_path& msg){
 
       }
@@ -2599,6 +3031,18 @@ namespace eosio {
 
 
    void net_plugin_impl::handle_message( connection_ptr c, const signed_block &msg) {
+      if( sync_master->buffer_block( c, msg )) {
+         return; // ahead of the next block to apply, sent by another peer
+      }
+      process_block( c, msg );
+
+      connection_ptr from;
+      while( signed_block_ptr blk = sync_master->next_buffered_block( from )) {
+         process_block( from, *blk );
+      }
+   }
+
+   void net_plugin_impl::process_block( connection_ptr c, const signed_block &msg) {
       controller &cc = chain_plug->chain();
       block_id_type blk_id = msg.id();
       uint32_t blk_num = msg.block_num();
@@ -2679,15 +3123,15 @@ namespace eosio {
          });
    }
 
-   void net_plugin_impl::start_txn_timer() {
-      transaction_check->expires_from_now( txn_exp_period);
+   void net_plugin_impl::start_txn_timer(boost::asio::steady_timer::duration du) {
+      transaction_check->expires_from_now( du);
       transaction_check->async_wait( [this](boost::system::error_code ec) {
             if( !ec) {
                expire_txns( );
             }
             else {
                elog( "Error from transaction check monitor: ${m}",( "m", ec.message()));
-               start_txn_timer( );
+               start_txn_timer( txn_exp_period );
             }
          });
    }
@@ -2700,7 +3144,7 @@ namespace eosio {
                wlog ("Peer keepalive ticked sooner than expected: ${m}", ("m", ec.message()));
             }
             for (auto &c : connections ) {
-               if (c->socket->is_open()) {
+               if (c->socket_open) {
                   c->send_time();
                }
             }
@@ -2711,28 +3155,89 @@ namespace eosio {
       connector_check.reset(new boost::asio::steady_timer( app().get_io_service()));
       transaction_check.reset(new boost::asio::steady_timer( app().get_io_service()));
       start_conn_timer(connector_period, std::weak_ptr<connection>());
-      start_txn_timer();
+      start_txn_timer( txn_exp_period );
+   }
+
+   /**
+    * Erases entries included in blocks up to `lib` from an index by block number, `expire_chunk` at a
+    * time until `max_time`. Returns false if some are left for the next sweep.
+    */
+   template<typename Index, typename OnErase>
+   static bool erase_included( Index& index, uint32_t lib, const time_point& max_time, OnErase&& on_erase ) {
+      auto itr = index.lower_bound( 1 );
+      for( size_t n = 1; itr != index.end() && itr->block_num <= lib; ++n ) {
+         on_erase( *itr );
+         itr = index.erase( itr );
+         if( n % expire_chunk == 0 && time_point::now() >= max_time )
+            return itr == index.end() || itr->block_num > lib;
+      }
+      return true;
    }
 
+   /**
+    * Each sweep runs for at most max-cleanup-time-msec. When that is not enough, as under a flood of
+    * transactions, it continues right after the handlers queued meanwhile instead of waiting for
+    * txn_exp_period, so the main thread is never held for long and nothing piles up.
+    */
    void net_plugin_impl::expire_txns() {
-      start_txn_timer( );
-      auto &old = local_txns.get<by_expiry>();
-      auto ex_up = old.upper_bound( time_point::now());
-      auto ex_lo = old.lower_bound( fc::time_point_sec( 0));
-      old.erase( ex_lo, ex_up);
+      auto start = time_point::now();
+      auto max_time = start + fc::milliseconds( max_cleanup_time_ms );
+      time_point_sec now( start );
+      uint32_t lib = chain_plug->chain().last_irreversible_block_num();
+
+      bool done = expire_local_txns( now, lib, max_time );
+      for( auto itr = connections.begin(); done && itr != connections.end(); ++itr ) {
+         done = expire_peer_state( *itr, now, lib, max_time );
+      }
+      last_txn_sweep = time_point::now() - start;
+      txn_sweep_behind = !done;
+      start_txn_timer( done ? txn_exp_period : std::chrono::milliseconds(1) );
+   }
+
+   bool net_plugin_impl::expire_local_txns( time_point_sec now, uint32_t lib, const time_point& max_time ) {
+      auto& by_txn_id = local_txns.get<by_id>();
+      auto on_due = [&]( const transaction_id_type& id ) {
+         auto tx = by_txn_id.find( id );
+         if( tx == by_txn_id.end() )
+            return; // already erased as included in an irreversible block
+         if( tx->expires > now ) {
+            local_txn_expiry.add( id, tx->expires ); // pushed out while in flight
+            return;
+         }
+         local_txn_bytes -= tx->serialized_txn->size();
+         by_txn_id.erase( tx );
+         ++expired_txns;
+      };
+      while( local_txn_expiry.expire( now, expire_chunk, on_due ) == expire_chunk ) {
+         if( time_point::now() >= max_time )
+            return !local_txn_expiry.behind( now );
+      }
 
-      auto &stale = local_txns.get<by_block_num>();
-      controller &cc = chain_plug->chain();
-      uint32_t bn = cc.last_irreversible_block_num();
-      stale.erase( stale.lower_bound(1), stale.upper_bound(bn) );
-      for ( auto &c : connections ) {
-         auto &stale_txn = c->trx_state.get<by_block_num>();
-         stale_txn.erase( stale_txn.lower_bound(1), stale_txn.upper_bound(bn) );
-         auto &stale_txn_e = c->trx_state.get<by_expiry>();
-         stale_txn_e.erase(stale_txn_e.lower_bound(time_point_sec()), stale_txn_e.upper_bound(time_point::now()));
-         auto &stale_blk = c->blk_state.get<by_block_num>();
-         stale_blk.erase( stale_blk.lower_bound(1), stale_blk.upper_bound(bn) );
+      return erase_included( local_txns.get<by_block_num>(), lib, max_time, [this]( const node_transaction_state& tx ) {
+         local_txn_bytes -= tx.serialized_txn->size();
+      });
+   }
+
+   bool net_plugin_impl::expire_peer_state( const connection_ptr& c, time_point_sec now, uint32_t lib, const time_point& max_time ) {
+      auto& by_txn_id = c->trx_state.get<by_id>();
+      auto on_due = [&]( const transaction_id_type& id ) {
+         auto ts = by_txn_id.find( id );
+         if( ts == by_txn_id.end() )
+            return;
+         if( ts->expires > now ) {
+            c->trx_expiry.add( id, ts->expires );
+            return;
+         }
+         by_txn_id.erase( ts );
+      };
+      while( c->trx_expiry.expire( now, expire_chunk, on_due ) == expire_chunk ) {
+         if( time_point::now() >= max_time )
+            return !c->trx_expiry.behind( now );
       }
+
+      auto ignore = []( const auto& ) {};
+      return erase_included( c->trx_state.get<by_block_num>(), lib, max_time, ignore ) &&
+             erase_included( c->blk_state.get<by_block_num>(), lib, max_time, ignore );
    }
 
    void net_plugin_impl::connection_monitor(std::weak_ptr<connection> from_connection) {
@@ -2746,7 +3251,7 @@ namespace eosio {
             start_conn_timer(std::chrono::milliseconds(1), *it); // avoid exhausting
             return;
          }
-         if( !(*it)->socket->is_open() && !(*it)->connecting) {
+         if( !(*it)->socket_open && !(*it)->connecting) {
             if( (*it)->peer_addr.length() > 0) {
                connect(*it);
             }
@@ -2761,7 +3266,7 @@ namespace eosio {
    }
 
    void net_plugin_impl::close( connection_ptr c ) {
-      if( c->peer_addr.empty( ) && c->socket->is_open() ) {
+      if( c->peer_addr.empty( ) && c->socket_open ) {
          if (num_clients == 0) {
             fc_wlog( logger, "num_clients already at 0");
          }
@@ -2960,12 +3465,16 @@ namespace eosio {
            "Tuple of [PublicKey, WIF private key] (may specify multiple times)")
          ( "max-clients", bpo::value<int>()->default_value(def_max_clients), "Maximum number of clients from which connections are accepted, use 0 for no limit")
          ( "connection-cleanup-period", bpo::value<int>()->default_value(def_conn_retry_wait), "number of seconds to wait before cleaning up dead connections")
-         ( "max-cleanup-time-msec", bpo::value<int>()->default_value(10), "max connection cleanup time per cleanup call in millisec")
+         ( "max-cleanup-time-msec", bpo::value<int>()->default_value(10), "max connection or transaction cleanup time per cleanup call in millisec")
          ( "network-version-match", bpo::value<bool>()->default_value(false),
            "True to require exact match of peer network version.")
          ( "sync-fetch-span", bpo::value<uint32_t>()->default_value(def_sync_fetch_span), "number of blocks to retrieve in a chunk from any individual peer during synchronization")
+         ( "sync-fetch-peers", bpo::value<uint32_t>()->default_value(def_sync_fetch_peers), "number of peers fetching chunks at the same time during synchronization")
          ( "max-implicit-request", bpo::value<uint32_t>()->default_value(def_max_just_send), "maximum sizes of transaction or block messages that are sent without first sending a notice")
          ( "use-socket-read-watermark", bpo::value<bool>()->default_value(false), "Enable expirimental socket read watermark optimization")
+         ( "net-threads", bpo::value<uint32_t>()->default_value(def_net_threads), "Number of worker threads reading, writing and deserializing p2p messages")
+         ( "difchain-stream-window", bpo::value<uint32_t>()->default_value(def_difchain_stream_window), "Maximum number of blocks a peer on another chain may stream to this node ahead of the ones processed")
+         ( "difchain-stream-batch", bpo::value<uint32_t>()->default_value(def_difchain_stream_batch), "Maximum number of blocks in one difchain_block_stream message sent to a peer on another chain")
          ( "peer-log-format", bpo::value<string>()->default_value( "[\"${_name}\" ${_ip}:${_port}]" ),
            "The string used to format peers when logging messages about them.  Variables are escaped with ${<variable name>}.\n"
            "Available Variables:\n"
@@ -2991,7 +3500,7 @@ namespace eosio {
 
          my->network_version_match = options.at( "network-version-match" ).as<bool>();
 
-         my->sync_master.reset( new sync_manager( options.at( "sync-fetch-span" ).as<uint32_t>()));
+         my->sync_master.reset( new sync_manager( options.at( "sync-fetch-span" ).as<uint32_t>(), options.at( "sync-fetch-peers" ).as<uint32_t>()));
          my->dispatcher.reset( new dispatch_manager );
 
          my->connector_period = std::chrono::seconds( options.at( "connection-cleanup-period" ).as<int>());
@@ -3006,6 +3515,14 @@ namespace eosio {
 
          my->use_socket_read_watermark = options.at( "use-socket-read-watermark" ).as<bool>();
 
+         my->net_thread_count = options.at( "net-threads" ).as<uint32_t>();
+         EOS_ASSERT( my->net_thread_count > 0, chain::plugin_config_exception,
+                     "net-threads ${num} must be greater than 0", ("num", my->net_thread_count) );
+         my->net_ioc.reset( new boost::asio::io_context );
+
+         my->difchain_stream_window = options.at( "difchain-stream-window" ).as<uint32_t>();
+         my->difchain_stream_batch = std::max( options.at( "difchain-stream-batch" ).as<uint32_t>(), 1u );
+
          my->resolver = std::make_shared<tcp::resolver>( std::ref( app().get_io_service()));
          if( options.count( "p2p-listen-endpoint" )) {
             my->p2p_address = options.at( "p2p-listen-endpoint" ).as<string>();
@@ -3017,7 +3534,7 @@ namespace eosio {
 
             my->listen_endpoint = *my->resolver->resolve( query );
 
-            my->acceptor.reset( new tcp::acceptor( app().get_io_service()));
+            my->acceptor.reset( new tcp::acceptor( *my->net_ioc ));
          }
          if( options.count( "p2p-server-address" )) {
             my->p2p_address = options.at( "p2p-server-address" ).as<string>();
@@ -3090,6 +3607,11 @@ namespace eosio {
    }
 
    void net_plugin::plugin_startup() {
+      my->net_ioc_work.reset( new boost::asio::executor_work_guard<boost::asio::io_context::executor_type>( my->net_ioc->get_executor() ));
+      for( uint32_t i = 0; i < my->net_thread_count; ++i ) {
+         my->net_threads.emplace_back( [ioc = my->net_ioc.get()] { ioc->run(); } );
+      }
+
       if( my->acceptor ) {
          my->acceptor->open(my->listen_endpoint.protocol());
          my->acceptor->set_option(tcp::acceptor::reuse_address(true));
@@ -3147,6 +3669,14 @@ namespace eosio {
 
             my->acceptor.reset(nullptr);
          }
+         if( my->net_ioc ) {
+            my->net_ioc_work.reset();
+            my->net_ioc->stop();
+            for( auto& t : my->net_threads ) {
+               t.join();
+            }
+            my->net_threads.clear();
+         }
          ilog( "exit shutdown" );
       }
       FC_CAPTURE_AND_RETHROW()
@@ -3190,6 +3720,29 @@ namespace eosio {
       return optional<connection_status>();
    }
 
+   dedup_status net_plugin::dedup_stats()const {
+      // ordered index nodes carry a parent, two children and the color
+      constexpr size_t index_node = 3 * sizeof(void*);
+      dedup_status result;
+      result.local_txns = my->local_txns.size();
+      result.local_txn_bytes = my->local_txn_bytes;
+      result.local_expiry_keys = my->local_txn_expiry.size();
+      for( const auto& c : my->connections ) {
+         result.peer_txns += c->trx_state.size();
+         result.peer_blocks += c->blk_state.size();
+         result.peer_expiry_keys += c->trx_expiry.size();
+      }
+      result.approx_bytes = result.local_txn_bytes +
+                            result.local_txns * (sizeof(node_transaction_state) + 2 * index_node) +
+                            result.peer_txns * (sizeof(transaction_state) + 2 * index_node) +
+                            result.peer_blocks * (sizeof(peer_block_state) + 2 * index_node) +
+                            (result.local_expiry_keys + result.peer_expiry_keys) * (sizeof(transaction_id_type) + sizeof(uint32_t));
+      result.expired_txns = my->expired_txns;
+      result.last_sweep_us = my->last_txn_sweep.count();
+      result.sweep_behind = my->txn_sweep_behind;
+      return result;
+   }
+
    vector<connection_status> net_plugin::connections()const {
       vector<connection_status> result;
       result.reserve( my->connections.size() );
@@ -3226,8 +3779,7 @@ namespace eosio {
                        iter->get()->update_chainid(chain_id);
                        break;
                  }
-                 if(iter->get()->get_socket().remote_endpoint().address().to_string() 
-                 ==  c->get_socket().remote_endpoint().address().to_string())
+                 if(iter->get()->remote_endpoint.address() == c->remote_endpoint.address())
                  {
                        iter->get()->update_chainid(chain_id);
                        break;
@@ -17,6 +17,7 @@
 
 #include <eosio/chain/contract_types.hpp>
 #include <eosio/chain/abi_serializer.hpp>
+#include <eosio/chain/abi_serializer_cache.hpp>
 #include <eosio/chain/eosio_contract.hpp>
 #include <eosio/abi_generator/abi_generator.hpp>
 
@@ -3471,4 +3472,42 @@ BOOST_AUTO_TEST_CASE(abi_deep_structs_validate)
    } FC_LOG_AND_RETHROW()
 }
 
+BOOST_AUTO_TEST_CASE(abi_serializer_cache_versions)
+{
+   try {
+      const char* abi_str = R"=====(
+      {
+         "types": [],
+         "structs": [{
+            "name": "transfer",
+            "base": "",
+            "fields": [{"name": "amount", "type": "uint64"}]
+         }],
+         "actions": [{"name": "transfer", "type": "transfer", "ricardian_contract": ""}],
+         "tables": [],
+         "ricardian_clauses": []
+      }
+      )=====";
+      auto packed = fc::raw::pack( fc::json::from_string( abi_str ).as<abi_def>() );
+      auto empty = fc::raw::pack( abi_def() );
+
+      abi_serializer_cache cache( 1 );
+      auto first = cache.get( N(alice), 1, packed.data(), packed.size(), max_serialization_time );
+      BOOST_REQUIRE( first );
+      BOOST_CHECK_EQUAL( "transfer", first->get_action_type( N(transfer) ) );
+      BOOST_CHECK( first == cache.get( N(alice), 1, packed.data(), packed.size(), max_serialization_time ) );
+
+      // a new abi_sequence, e.g. after setabi, is built again
+      auto second = cache.get( N(alice), 2, packed.data(), packed.size(), max_serialization_time );
+      BOOST_CHECK( second && first != second );
+
+      // only one entry, the least recently used one goes
+      cache.get( N(bob), 1, packed.data(), packed.size(), max_serialization_time );
+      BOOST_CHECK( second != cache.get( N(alice), 2, packed.data(), packed.size(), max_serialization_time ) );
+      BOOST_CHECK_EQUAL( 1u, cache.stats().entries );
+
+      BOOST_CHECK( !cache.get( N(carol), 1, empty.data(), empty.size(), max_serialization_time ) );
+   } FC_LOG_AND_RETHROW()
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,7 @@
 
 #include <boost/test/unit_test.hpp>
 #include <eosio/testing/tester.hpp>
+#include <eosio/chain/block_log.hpp>
 
 using namespace eosio;
 using namespace testing;
@@ -50,4 +51,183 @@ BOOST_AUTO_TEST_CASE(block_with_invalid_tx_test)
   
 }
 
+BOOST_AUTO_TEST_CASE(block_log_reader_test)
+{
+   tester chain;
+   chain.produce_blocks(20);
+
+   auto reader = chain.control->get_block_log_reader();
+   auto head_num = reader->head_block_num();
+   BOOST_REQUIRE( head_num > 1 );
+   for( uint32_t n = 1; n <= head_num; ++n ) {
+      auto b = chain.control->fetch_block_by_number( n );
+      auto packed = fc::raw::pack( *b );
+      auto raw = reader->get_serialized_block( n );
+      BOOST_REQUIRE_EQUAL( packed.size(), raw.second );
+      BOOST_CHECK( std::equal( packed.begin(), packed.end(), raw.first ) );
+      BOOST_CHECK_EQUAL( b->id(), reader->read_block_id_by_num( n ) );
+   }
+   BOOST_CHECK( !reader->read_block_by_num( head_num + 1 ) );
+   BOOST_CHECK_EQUAL( 0u, reader->get_serialized_block( head_num + 1 ).second );
+
+   // an older reader keeps its view while the log grows
+   chain.produce_blocks(5);
+   BOOST_CHECK_EQUAL( head_num, reader->head_block_num() );
+   BOOST_CHECK( chain.control->get_block_log_reader()->head_block_num() > head_num );
+   BOOST_CHECK_EQUAL( chain.control->fetch_block_by_number( head_num )->id(), reader->read_block_by_num( head_num )->id() );
+}
+
+BOOST_AUTO_TEST_CASE(block_log_retention_test)
+{
+   tester chain;
+   chain.produce_blocks(30);
+
+   fc::temp_directory tempdir;
+   block_log_retention retention;
+   retention.stride = 5;
+   retention.max_retained_files = 2;
+   retention.max_archived_files = 2;
+   {
+      block_log blog( tempdir.path(), retention );
+      blog.reset_to_genesis( genesis_state(), chain.control->fetch_block_by_number( 1 ) );
+      for( uint32_t n = 2; n <= 30; ++n )
+         blog.append( chain.control->fetch_block_by_number( n ) );
+      blog.wait_for_retention(); // closing the log would abandon it
+   }
+
+   auto retained = tempdir.path() / retention.retained_dir;
+   BOOST_CHECK( !fc::exists( retained / "blocks-1-5.log" ) );
+   BOOST_CHECK( !fc::exists( retained / "blocks-1-5.zlog" ) );
+   BOOST_CHECK( fc::exists( retained / "blocks-6-10.zlog" ) );
+   BOOST_CHECK( fc::exists( retained / "blocks-11-15.zlog" ) );
+   BOOST_CHECK( !fc::exists( retained / "blocks-11-15.log" ) );
+   BOOST_CHECK( fc::exists( retained / "blocks-16-20.log" ) );
+   BOOST_CHECK( fc::exists( retained / "blocks-21-25.log" ) );
+
+   block_log blog( tempdir.path(), retention );
+   BOOST_REQUIRE( blog.head() );
+   BOOST_CHECK_EQUAL( 30u, blog.head()->block_num() );
+
+   auto reader = blog.get_reader();
+   BOOST_CHECK_EQUAL( 6u, reader->first_block_num() );
+   BOOST_CHECK( !reader->read_block_by_num( 3 ) );
+   for( uint32_t n = 6; n <= 30; ++n ) {
+      auto b = chain.control->fetch_block_by_number( n );
+      BOOST_CHECK_EQUAL( b->id(), reader->read_block_id_by_num( n ) );
+      BOOST_CHECK( fc::raw::pack( *b ) == reader->read_serialized_block_by_num( n ) );
+      // only blocks that are not compressed can be handed out in place
+      BOOST_CHECK_EQUAL( n > 15, reader->get_serialized_block( n ).second > 0 );
+   }
+   BOOST_CHECK_EQUAL( blog.get_block_pos( 26 ), blog.get_reader()->get_block_pos( 26 ) );
+   BOOST_CHECK_EQUAL( block_log::npos, blog.get_block_pos( 25 ) );
+
+   // appending continues the active file
+   blog.append( chain.produce_block() );
+   BOOST_CHECK_EQUAL( chain.control->head_block_id(), blog.get_reader()->read_block_id_by_num( 31 ) );
+}
+
+BOOST_AUTO_TEST_CASE(block_log_rotation_crash_test)
+{
+   tester chain;
+   chain.produce_blocks(15);
+
+   block_log_retention retention;
+   retention.stride = 5;
+   fc::temp_directory tempdir;
+   // a full blocks.log, the next block would rotate it
+   auto write_full = [&]( const fc::path& dir ) {
+      block_log blog( dir, retention );
+      blog.reset_to_genesis( genesis_state(), chain.control->fetch_block_by_number( 1 ) );
+      for( uint32_t n = 2; n <= 5; ++n )
+         blog.append( chain.control->fetch_block_by_number( n ) );
+   };
+
+   // what a rotation writes before moving the full files away: the header of the next blocks.log and an empty index
+   auto rotated_dir = tempdir.path() / "rotated";
+   write_full( rotated_dir );
+   uint64_t header_size = 0;
+   {
+      block_log blog( rotated_dir, retention );
+      blog.append( chain.control->fetch_block_by_number( 6 ) );
+      header_size = blog.get_block_pos( 6 );
+   }
+   auto write_tmp = [&]( const fc::path& dir ) {
+      fc::copy( rotated_dir / "blocks.log", dir / "blocks.log.tmp" );
+      fc::resize_file( dir / "blocks.log.tmp", header_size );
+      std::ofstream( (dir / "blocks.index.tmp").generic_string().c_str() );
+   };
+
+   auto check = [&]( const fc::path& dir ) {
+      block_log blog( dir, retention );
+      BOOST_REQUIRE( blog.head() );
+      BOOST_CHECK_EQUAL( 5u, blog.head()->block_num() );
+      BOOST_CHECK( !fc::exists( dir / "blocks.log.tmp" ) );
+      BOOST_CHECK( !fc::exists( dir / "blocks.index.tmp" ) );
+      for( uint32_t n = 6; n <= 15; ++n )
+         blog.append( chain.control->fetch_block_by_number( n ) );
+      BOOST_CHECK( fc::exists( dir / retention.retained_dir / "blocks-6-10.log" ) );
+      auto reader = blog.get_reader();
+      for( uint32_t n = 1; n <= 15; ++n )
+         BOOST_CHECK_EQUAL( chain.control->fetch_block_by_number( n )->id(), reader->read_block_id_by_num( n ) );
+   };
+
+   // crashed before the full files were moved, the new ones are dropped
+   auto before_dir = tempdir.path() / "before";
+   write_full( before_dir );
+   write_tmp( before_dir );
+   check( before_dir );
+
+   // crashed after the full files were moved, the new ones are moved into place
+   auto after_dir = tempdir.path() / "after";
+   write_full( after_dir );
+   write_tmp( after_dir );
+   fc::create_directories( after_dir / retention.retained_dir );
+   fc::rename( after_dir / "blocks.index", after_dir / retention.retained_dir / "blocks-1-5.index" );
+   fc::rename( after_dir / "blocks.log", after_dir / retention.retained_dir / "blocks-1-5.log" );
+   check( after_dir );
+}
+
+BOOST_AUTO_TEST_CASE(block_log_repair_test)
+{
+   tester chain;
+   chain.produce_blocks(20);
+   auto last_num = chain.control->last_irreversible_block_num();
+   BOOST_REQUIRE( last_num > 5 );
+
+   fc::temp_directory tempdir;
+   auto blocks_dir = tempdir.path() / "blocks";
+   {
+      block_log blog( blocks_dir );
+      blog.reset_to_genesis( genesis_state(), chain.control->fetch_block_by_number( 1 ) );
+      for( uint32_t n = 2; n <= last_num; ++n )
+         blog.append( chain.control->fetch_block_by_number( n ) );
+   }
+
+   // the index is rebuilt from the positions after the blocks
+   fc::remove( blocks_dir / "blocks.index" );
+   {
+      block_log blog( blocks_dir );
+      BOOST_REQUIRE( blog.head() );
+      BOOST_CHECK_EQUAL( last_num, blog.head()->block_num() );
+      BOOST_CHECK_EQUAL( chain.control->fetch_block_by_number( 3 )->id(), blog.read_block_id_by_num( 3 ) );
+   }
+
+   // a block that was not completely written is cut off
+   fc::resize_file( blocks_dir / "blocks.log", fc::file_size( blocks_dir / "blocks.log" ) - 10 );
+   auto backup_dir = block_log::repair_log( blocks_dir );
+   BOOST_CHECK( fc::exists( backup_dir / "blocks.log" ) );
+   {
+      block_log blog( blocks_dir );
+      BOOST_REQUIRE( blog.head() );
+      BOOST_CHECK_EQUAL( last_num - 1, blog.head()->block_num() );
+      for( uint32_t n = 1; n < last_num; ++n )
+         BOOST_CHECK_EQUAL( chain.control->fetch_block_by_number( n )->id(), blog.read_block_id_by_num( n ) );
+   }
+
+   block_log::repair_log( blocks_dir, 3 );
+   block_log blog( blocks_dir );
+   BOOST_REQUIRE( blog.head() );
+   BOOST_CHECK_EQUAL( 3u, blog.head()->block_num() );
+}
+
 BOOST_AUTO_TEST_SUITE_END()
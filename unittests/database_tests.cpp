@@ -5,6 +5,8 @@
 
 #include <eosio/testing/tester.hpp>
 #include <eosio/chain/global_property_object.hpp>
+#include <eosio/chain/permission_object.hpp>
+#include <eosio/chain/snapshot.hpp>
 #include <fc/crypto/digest.hpp>
 
 #include <boost/test/unit_test.hpp>
@@ -99,4 +101,84 @@ BOOST_AUTO_TEST_SUITE(database_tests)
    }
 
 
+   struct snapshot_tester : tester {
+      using tester::tester;
+      const controller::config& config()const { return cfg; }
+   };
+
+   // Write the state to a snapshot and start another chain from it
+   BOOST_AUTO_TEST_CASE(snapshot_test) {
+      try {
+         snapshot_tester chain;
+         chain.create_accounts( {N(alice), N(bob)} );
+         chain.produce_blocks( 10 );
+
+         fc::temp_directory tempdir;
+         auto file = tempdir.path() / "snapshot.bin";
+
+         // not while transactions go into a pending block
+         BOOST_REQUIRE( chain.control->pending_block_state() );
+         BOOST_CHECK_THROW( chain.control->write_snapshot( file ), snapshot_exception );
+         chain.control->abort_block();
+         chain.control->write_snapshot( file );
+
+         auto header = snapshot::read_header( file );
+         BOOST_CHECK_EQUAL( chain.control->head_block_id(), header.head.id );
+         BOOST_CHECK( header.genesis.compute_chain_id() == chain.control->get_chain_id() );
+
+         auto cfg = chain.config();
+         cfg.blocks_dir = tempdir.path() / "blocks";
+         cfg.state_dir = tempdir.path() / "state";
+         cfg.snapshot = file;
+         snapshot_tester restored( cfg );
+         BOOST_CHECK_EQUAL( chain.control->head_block_id(), restored.control->head_block_id() );
+
+         const auto& db = chain.control->db();
+         const auto& rdb = restored.control->db();
+         BOOST_CHECK_EQUAL( db.get_index<account_index>().indices().size(), rdb.get_index<account_index>().indices().size() );
+         BOOST_CHECK_EQUAL( db.get_index<permission_index>().indices().size(), rdb.get_index<permission_index>().indices().size() );
+         for( auto name : {N(alice), N(bob), config::system_account_name} ) {
+            const auto& a = db.get<account_object, by_name>( name );
+            const auto& b = rdb.get<account_object, by_name>( name );
+            BOOST_CHECK_EQUAL( a.id._id, b.id._id ); // ids are kept
+            BOOST_CHECK( a.abi == b.abi );
+            const auto& p = db.get<permission_object, by_owner>( boost::make_tuple( name, config::active_name ) );
+            const auto& q = rdb.get<permission_object, by_owner>( boost::make_tuple( name, config::active_name ) );
+            BOOST_CHECK_EQUAL( p.id._id, q.id._id );
+            BOOST_CHECK( fc::raw::pack( p.auth.to_authority() ) == fc::raw::pack( q.auth.to_authority() ) );
+         }
+
+         // the restored chain follows the blocks produced after the snapshot
+         chain.produce_blocks( 5 );
+         for( auto n = header.head.block_num + 1; n <= chain.control->head_block_num(); ++n )
+            restored.push_block( chain.control->fetch_block_by_number( n ) );
+         BOOST_CHECK_EQUAL( chain.control->head_block_id(), restored.control->head_block_id() );
+         BOOST_CHECK( restored.control->fetch_block_by_number( header.head.block_num ) );
+
+         // a snapshot can be written while a block is accepted
+         auto at_block = chain.control->head_block_num() + 2;
+         auto accepted_file = tempdir.path() / "accepted.bin";
+         chain.control->accepted_block.connect( [&]( const block_state_ptr& b ) {
+            if( b->block_num == at_block )
+               chain.control->write_snapshot( accepted_file );
+         });
+         chain.produce_blocks( 3 );
+         BOOST_CHECK_EQUAL( chain.control->get_block_id_for_num( at_block ), snapshot::read_header( accepted_file ).head.id );
+
+         // a damaged section is refused
+         auto damaged = tempdir.path() / "damaged.bin";
+         fc::copy( file, damaged );
+         {
+            std::fstream f( damaged.generic_string(), std::ios::in | std::ios::out | std::ios::binary );
+            f.seekp( -1, std::ios::end );
+            f.put( 0x5a );
+         }
+         cfg.blocks_dir = tempdir.path() / "damaged-blocks";
+         cfg.state_dir = tempdir.path() / "damaged-state";
+         cfg.snapshot = damaged;
+         BOOST_CHECK_THROW( snapshot_tester{ cfg }, snapshot_validation_exception );
+      } FC_LOG_AND_RETHROW()
+   }
+
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -465,4 +465,58 @@ BOOST_AUTO_TEST_CASE( read_modes ) try {
 
 } FC_LOG_AND_RETHROW()
 
+struct journal_tester : tester {
+   fc::path journal_file()const { return cfg.state_dir / config::forkdb_journal_filename; }
+};
+
+BOOST_AUTO_TEST_CASE( fork_db_journal ) try {
+   journal_tester c;
+   c.produce_blocks(10);
+   auto r = c.create_accounts( {N(dan),N(sam),N(pam)} );
+   auto res = c.set_producers( {N(dan),N(sam),N(pam)} );
+   c.produce_blocks(100);
+   const auto& live = c.control->fork_db();
+   BOOST_REQUIRE( c.control->last_irreversible_block_num() + 1 < c.control->head_block_num() );
+
+   auto check_replay = [&]( const fc::path& journal ) {
+      fc::temp_directory dir;
+      fc::copy( journal, dir.path() / config::forkdb_journal_filename );
+      fork_database fdb( dir.path() );
+      BOOST_REQUIRE( fdb.head() );
+      BOOST_CHECK_EQUAL( live.head()->id, fdb.head()->id );
+      for( auto n = c.control->last_irreversible_block_num() + 1; n <= c.control->head_block_num(); ++n ) {
+         auto expected = live.get_block_in_current_chain_by_num( n );
+         BOOST_REQUIRE( expected );
+         auto replayed = fdb.get_block( expected->id );
+         BOOST_REQUIRE( replayed );
+         BOOST_CHECK( replayed->in_current_chain );
+         BOOST_CHECK_EQUAL( expected->validated, replayed->validated );
+         BOOST_CHECK_EQUAL( expected->bft_irreversible_blocknum, replayed->bft_irreversible_blocknum );
+      }
+   };
+
+   // read while the fork database is still open, as if the node had been killed
+   check_replay( c.journal_file() );
+
+   // a record that was not completely written is dropped
+   fc::temp_directory torn;
+   fc::copy( c.journal_file(), torn.path() / "journal" );
+   {
+      std::ofstream out( (torn.path() / "journal").generic_string().c_str(), std::ios::out | std::ios::binary | std::ios::app );
+      out.write( "\x40\0\0\0garbage", 11 );
+   }
+   check_replay( torn.path() / "journal" );
+
+   // compaction keeps only what was not pruned
+   auto journal_size = fc::file_size( c.journal_file() );
+   c.control->fork_db().compact();
+   BOOST_CHECK( fc::file_size( c.journal_file() ) < journal_size );
+   check_replay( c.journal_file() );
+
+   // and the journal keeps growing from there
+   c.produce_blocks(5);
+   check_replay( c.journal_file() );
+
+} FC_LOG_AND_RETHROW()
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,7 @@
 #include <eosio/chain/authority.hpp>
 #include <eosio/chain/types.hpp>
 #include <eosio/chain/asset.hpp>
+#include <eosio/chain/transaction_metadata.hpp>
 #include <eosio/testing/tester.hpp>
 
 #include <eosio/utilities/key_conversion.hpp>
@@ -645,6 +646,31 @@ BOOST_AUTO_TEST_CASE(transaction_test) { try {
 
 } FC_LOG_AND_RETHROW() }
 
+BOOST_AUTO_TEST_CASE(signature_recovery_cache_test) { try {
+   auto chain_id = chain_id_type( fc::sha256::hash( "test" ));
+   auto key1 = fc::crypto::private_key::regenerate( fc::sha256::hash( "key1" ));
+   auto key2 = fc::crypto::private_key::regenerate( fc::sha256::hash( "key2" ));
+
+   signed_transaction trx;
+   trx.expiration = fc::time_point_sec( 1000 );
+   trx.sign( key1, chain_id );
+
+   signature_recovery_cache cache( 1 );
+   transaction_metadata first( trx );
+   BOOST_CHECK( first.recover_keys( chain_id, cache ) == flat_set<public_key_type>{ key1.get_public_key() } );
+   transaction_metadata again( trx );
+   BOOST_CHECK( again.recover_keys( chain_id, cache ) == flat_set<public_key_type>{ key1.get_public_key() } );
+   BOOST_CHECK_EQUAL( 1u, cache.stats().hits );
+
+   // same id, other signatures
+   trx.signatures.clear();
+   trx.sign( key2, chain_id );
+   transaction_metadata resigned( trx );
+   BOOST_CHECK( resigned.recover_keys( chain_id, cache ) == flat_set<public_key_type>{ key2.get_public_key() } );
+   BOOST_CHECK_EQUAL( 1u, cache.stats().hits );
+   BOOST_CHECK_EQUAL( 1u, cache.stats().entries );
+} FC_LOG_AND_RETHROW() }
+
 BOOST_AUTO_TEST_SUITE_END()
 
 } // namespace eosio